@@ -0,0 +1,257 @@
+// Listing core benchmark: fill, sort and lookup over generated directories
+// (flat, long names, unicode names, deep tree), warm cache, best of RUNS.
+// One result per line as key=value pairs, to be compared across releases.
+//
+// Usage: bench_core [flat_entries]   (default: 1000000)
+#define _GNU_SOURCE
+#include "../src/files.h"
+#include "../src/sort.h"
+#include "../src/enums.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+#define LOOKUPS 1000
+#define NAMED_ENTRIES 100000
+#define DEEP_FANOUT 2
+#define DEEP_DEPTH 12
+#define DEEP_FILES 16
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *op, const char *set, unsigned long entries, double best_ns, const char *unit,
+                   unsigned long ops) {
+  printf("bench=core op=%s set=%s entries=%lu total_ms=%.2f ns_per_%s=%.1f\n", op, set, entries, best_ns / 1e6,
+         unit, best_ns / (ops ? ops : 1));
+}
+
+// ---- Generated directories ----
+
+typedef enum NameStyle { NAME_SHORT, NAME_LONG, NAME_UNICODE } NameStyle;
+
+static void make_name(char *dest, size_t size, NameStyle style, unsigned i) {
+  switch (style) {
+  case NAME_SHORT:
+    snprintf(dest, size, "file_%08u.txt", i);
+    break;
+  case NAME_LONG:
+    snprintf(dest, size,
+             "a_rather_long_file_name_as_made_by_downloads_and_cameras_%08u_"
+             "with_more_words_after_the_number_to_reach_two_hundred_bytes_"
+             "of_name_which_is_close_to_what_some_tools_produce_%u.tar.gz",
+             i, i % 97);
+    break;
+  case NAME_UNICODE:
+    snprintf(dest, size, "файл_日本語_%08u_ñé\U0001f600.txt", i);
+    break;
+  }
+}
+
+static void make_flat(const char *root, unsigned count, NameStyle style) {
+  int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+  char name[NAME_MAX + 1];
+  for (unsigned i = 0; i < count; i++) {
+    make_name(name, sizeof(name), style, i);
+    int fd = openat(dir_fd, name, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  close(dir_fd);
+}
+
+static unsigned long make_deep(const char *path, unsigned depth) {
+  unsigned long entries = 0;
+  char child[PATH_MAX];
+  for (unsigned i = 0; i < DEEP_FILES; i++) {
+    snprintf(child, sizeof(child), "%s/file_%04u.c", path, i);
+    int fd = open(child, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+      close(fd);
+      entries++;
+    }
+  }
+  if (depth == 0) {
+    return entries;
+  }
+  for (unsigned i = 0; i < DEEP_FANOUT; i++) {
+    snprintf(child, sizeof(child), "%s/dir_%04u", path, i);
+    if (mkdir(child, 0700) == 0) {
+      entries += 1 + make_deep(child, depth - 1);
+    }
+  }
+  return entries;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static void remove_tree(const char *root) {
+  nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// ---- Benchmarks ----
+
+static double time_fill(FilesArray *fa, char *path) {
+  double best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now_ns();
+    FilesArray_fill(fa, path);
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+static void bench_sort(const FilesArray *fa, const char *root, const char *set) {
+  static const struct {
+    const char *op;
+    SortMode mode;
+  } modes[] = {
+      {"sort_name", SORT_NAME},       {"sort_natural", SORT_NATURAL}, {"sort_locale", SORT_LOCALE},
+      {"sort_extension", SORT_EXTENSION}, {"sort_size", SORT_SIZE},   {"sort_mtime", SORT_MTIME},
+  };
+  int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    double best = 1e18;
+    for (int run = 0; run < RUNS; run++) {
+      FilesArray copy = {0};
+      if (FilesArray_copy(&copy, fa) != SUCCESS) {
+        return;
+      }
+      // Listing is in name order, start name sort from another one
+      if (modes[m].mode == SORT_NAME) {
+        FilesArray_sort_by(&copy, dir_fd, (FileSort){SORT_EXTENSION, true});
+      }
+      double start = now_ns();
+      FilesArray_sort_by(&copy, dir_fd, (FileSort){modes[m].mode, false});
+      double elapsed = now_ns() - start;
+      best = elapsed < best ? elapsed : best;
+      FilesArray_free(&copy);
+    }
+    report(modes[m].op, set, fa->files_count, best, "entry", fa->files_count);
+  }
+  close(dir_fd);
+}
+
+static void bench_lookup(const FilesArray *fa, const char *set) {
+  if (fa->files_count == 0) {
+    return;
+  }
+  // Names spread over whole listing, copied so lookup can't compare pointers
+  char (*names)[NAME_MAX + 1] = malloc(LOOKUPS * sizeof(*names));
+  if (names == NULL) {
+    return;
+  }
+  for (unsigned i = 0; i < LOOKUPS; i++) {
+    unsigned index = (unsigned long)i * fa->files_count / LOOKUPS;
+    snprintf(names[i], sizeof(names[i]), "%s", FilesArray_name(fa, index));
+  }
+  double best = 1e18;
+  unsigned long found = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now_ns();
+    for (unsigned i = 0; i < LOOKUPS; i++) {
+      found += FilesArray_find(fa, names[i]) >= 0;
+    }
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  if (found != (unsigned long)LOOKUPS * RUNS) {
+    fprintf(stderr, "lookup: %lu of %u names not found\n", (unsigned long)LOOKUPS * RUNS - found, LOOKUPS * RUNS);
+  }
+  report("lookup", set, fa->files_count, best, "lookup", LOOKUPS);
+  free(names);
+}
+
+static void bench_flat(const char *set, unsigned count, NameStyle style) {
+  char root[] = "/tmp/tf_bench_core_XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return;
+  }
+  make_flat(root, count, style);
+
+  FilesArray fa = {0};
+  double best = time_fill(&fa, root);
+  report("fill", set, fa.files_count, best, "entry", fa.files_count);
+  bench_sort(&fa, root, set);
+  bench_lookup(&fa, set);
+
+  FilesArray_free(&fa);
+  remove_tree(root);
+}
+
+static unsigned long fill_tree(FilesArray *fa, const char *path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  if (FilesArray_fill(fa, dir) != SUCCESS) {
+    return 0;
+  }
+  unsigned long entries = fa->files_count;
+  // Names of subdirectories, fa is refilled below
+  unsigned count = fa->files_count;
+  char (*children)[NAME_MAX + 1] = malloc((count ? count : 1) * sizeof(*children));
+  unsigned children_count = 0;
+  for (unsigned i = 0; children != NULL && i < count; i++) {
+    if (fa->entries[i].type == DIRECTORY) {
+      snprintf(children[children_count++], NAME_MAX + 1, "%s", FilesArray_name(fa, i));
+    }
+  }
+  for (unsigned i = 0; i < children_count; i++) {
+    char child[PATH_MAX];
+    snprintf(child, sizeof(child), "%s/%s", path, children[i]);
+    entries += fill_tree(fa, child);
+  }
+  free(children);
+  return entries;
+}
+
+static void bench_deep(void) {
+  char root[] = "/tmp/tf_bench_core_XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return;
+  }
+  make_deep(root, DEEP_DEPTH);
+
+  FilesArray fa = {0};
+  unsigned long entries = 0;
+  double best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now_ns();
+    entries = fill_tree(&fa, root);
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("fill", "deep", entries, best, "entry", entries);
+
+  FilesArray_free(&fa);
+  remove_tree(root);
+}
+
+int main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+  unsigned flat = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  bench_flat("flat", flat, NAME_SHORT);
+  bench_flat("long", NAMED_ENTRIES, NAME_LONG);
+  bench_flat("unicode", NAMED_ENTRIES, NAME_UNICODE);
+  bench_deep();
+  return 0;
+}
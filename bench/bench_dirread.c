@@ -0,0 +1,148 @@
+// Directory reading microbenchmark:
+// opendir/readdir (old FilesArray_fill path) vs getdents64 batches.
+//
+// Usage: bench_dirread [entries...]   (default: 10000 100000 1000000)
+#define _GNU_SOURCE
+#include "../src/files.h"
+#include "../src/enums.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Old path: readdir through glibc buffer + strcmp against "." and ".."
+static int fill_readdir(FilesArray *fa, const char *pwd) {
+  FilesArray_free(fa);
+  DIR *dirp = opendir(pwd);
+  if (dirp == NULL) {
+    return ERROR;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dirp)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    FilesArray_push(fa, entry->d_name, strlen(entry->d_name),
+                    entry->d_type == DT_DIR ? DIRECTORY : REGULAR);
+  }
+  closedir(dirp);
+  return SUCCESS;
+}
+
+static int fill_getdents(FilesArray *fa, const char *pwd, size_t buffer_size, unsigned *syscalls) {
+  FilesArray_free(fa);
+  int dir_fd = open(pwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return ERROR;
+  }
+  char *buffer = malloc(buffer_size);
+  bool eof = false;
+  *syscalls = 0;
+  while (!eof) {
+    if (FilesArray_read_batch(fa, dir_fd, buffer, buffer_size, &eof) != SUCCESS) {
+      break;
+    }
+    *syscalls += 1;
+  }
+  free(buffer);
+  close(dir_fd);
+  return SUCCESS;
+}
+
+static void make_tree(const char *root, unsigned count) {
+  int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+  char name[64];
+  for (unsigned i = 0; i < count; i++) {
+    snprintf(name, sizeof(name), "file_%08u.txt", i);
+    int fd = openat(dir_fd, name, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  close(dir_fd);
+}
+
+static void remove_tree(const char *root, unsigned count) {
+  int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+  char name[64];
+  for (unsigned i = 0; i < count; i++) {
+    snprintf(name, sizeof(name), "file_%08u.txt", i);
+    unlinkat(dir_fd, name, 0);
+  }
+  close(dir_fd);
+  rmdir(root);
+}
+
+// syscalls < 0: not observable (hidden inside glibc)
+static void report(const char *method, unsigned count, double best_ns, int syscalls) {
+  printf("%-18s entries=%-8u total_ms=%-9.2f ns_per_entry=%-7.1f getdents=",
+         method, count, best_ns / 1e6, best_ns / count);
+  if (syscalls < 0) {
+    printf("-\n");
+  } else {
+    printf("%d\n", syscalls);
+  }
+}
+
+static void bench(unsigned count) {
+  char root[] = "/tmp/tf_bench_dirread_XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return;
+  }
+  make_tree(root, count);
+
+  FilesArray fa = {0};
+  unsigned syscalls = 0;
+  double best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now_ns();
+    fill_readdir(&fa, root);
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("readdir", count, best, -1);
+
+  size_t buffer_sizes[] = {32 * 1024, 256 * 1024, 1024 * 1024};
+  for (int b = 0; b < 3; b++) {
+    best = 1e18;
+    for (int run = 0; run < RUNS; run++) {
+      double start = now_ns();
+      fill_getdents(&fa, root, buffer_sizes[b], &syscalls);
+      double elapsed = now_ns() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    char method[32];
+    snprintf(method, sizeof(method), "getdents64/%zuK", buffer_sizes[b] / 1024);
+    report(method, count, best, syscalls);
+  }
+
+  FilesArray_free(&fa);
+  remove_tree(root, count);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    unsigned defaults[] = {10000, 100000, 1000000};
+    for (int i = 0; i < 3; i++) {
+      bench(defaults[i]);
+    }
+    return 0;
+  }
+  for (int i = 1; i < argc; i++) {
+    bench(strtoul(argv[i], NULL, 10));
+  }
+  return 0;
+}
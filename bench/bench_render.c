@@ -0,0 +1,202 @@
+// Rendering benchmark: Window_draw, Window_move_highlight and trim_text
+// against an off-screen ncurses terminal (output goes to /dev/null),
+// listings of generated directories, best of RUNS.
+// One result per line as key=value pairs, to be compared across releases.
+//
+// Usage: bench_render [entries]   (default: 100000)
+#define _GNU_SOURCE
+#include "../src/window.h"
+#include "../src/enums.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+#define ROWS 50
+#define COLS 200
+#define FRAMES 200
+#define SCROLL_STEPS 2000
+#define TRIM_WIDTH 30
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *op, const char *set, unsigned long entries, double best_ns, const char *unit,
+                   unsigned long ops) {
+  printf("bench=render op=%s set=%s entries=%lu rows=%d cols=%d total_ms=%.2f ns_per_%s=%.1f\n", op, set,
+         entries, ROWS, COLS, best_ns / 1e6, unit, best_ns / (ops ? ops : 1));
+}
+
+// ---- Generated directories ----
+
+typedef enum NameStyle { NAME_SHORT, NAME_LONG, NAME_UNICODE } NameStyle;
+
+static void make_flat(const char *root, unsigned count, NameStyle style) {
+  int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+  char name[NAME_MAX + 1];
+  for (unsigned i = 0; i < count; i++) {
+    if (style == NAME_SHORT) {
+      snprintf(name, sizeof(name), "file_%08u.txt", i);
+    } else if (style == NAME_LONG) {
+      snprintf(name, sizeof(name),
+               "a_rather_long_file_name_as_made_by_downloads_and_cameras_%08u_"
+               "with_more_words_after_the_number_to_reach_two_hundred_bytes_%u.tar.gz",
+               i, i % 97);
+    } else {
+      snprintf(name, sizeof(name), "файл_日本語_%08u_ñé\U0001f600.txt", i);
+    }
+    int fd = openat(dir_fd, name, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  close(dir_fd);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+// ---- Benchmarks ----
+
+static void frame(WindowManager *wm, Window *win) {
+  Window_draw(wm, win);
+  doupdate();
+}
+
+static void bench_set(WindowManager *wm, const char *set, unsigned count, NameStyle style) {
+  char root[] = "/tmp/tf_bench_render_XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return;
+  }
+  make_flat(root, count, style);
+
+  Window *win = malloc(sizeof(Window));
+  if (win == NULL || Window_create(win, wm, root) != SUCCESS || Window_load(win) != SUCCESS) {
+    fprintf(stderr, "%s: window not created\n", set);
+    exit(EXIT_FAILURE);
+  }
+  while (win->loader != NULL) {
+    Window_poll_load(win);
+    usleep(1000);
+  }
+  unsigned long entries = win->listing->files.files_count;
+
+  // Names are decoded on first display only
+  double start = now_ns();
+  frame(wm, win);
+  report("draw_first", set, entries, now_ns() - start, "frame", 1);
+
+  double best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    start = now_ns();
+    for (int i = 0; i < FRAMES; i++) {
+      Window_clear(win);
+      frame(wm, win);
+    }
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("draw_full", set, entries, best, "frame", FRAMES);
+
+  // One row at a time, as holding j does (each new row decoded once)
+  best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    Window_select(win, 0);
+    win->scroll = 0;
+    frame(wm, win);
+    start = now_ns();
+    for (int i = 0; i < SCROLL_STEPS; i++) {
+      Window_move_highlight(win, 1, true);
+      frame(wm, win);
+    }
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("scroll_row", set, entries, best, "frame", SCROLL_STEPS);
+
+  best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    Window_select(win, 0);
+    win->scroll = 0;
+    frame(wm, win);
+    start = now_ns();
+    for (int i = 0; i < FRAMES; i++) {
+      Window_move_highlight(win, ROWS, true);
+      frame(wm, win);
+    }
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("scroll_page", set, entries, best, "frame", FRAMES);
+
+  wchar_t trimmed[TRIM_WIDTH + 1];
+  best = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    start = now_ns();
+    for (unsigned long i = 0; i < entries; i++) {
+      trim_text(false, trimmed, FilesArray_name(&win->listing->files, i), TRIM_WIDTH);
+    }
+    double elapsed = now_ns() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  report("trim_text", set, entries, best, "name", entries);
+
+  Window_free(&wm->first_window);
+  wm->window_counter = 0;
+  nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+int main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+  unsigned count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+  // Terminal that isn't there: everything is drawn, nothing is shown
+  FILE *out = fopen("/dev/null", "w");
+  FILE *in = fopen("/dev/null", "r");
+  SCREEN *screen = out && in ? newterm("xterm-256color", out, in) : NULL;
+  if (screen == NULL) {
+    fprintf(stderr, "no terminal\n");
+    return EXIT_FAILURE;
+  }
+  set_term(screen);
+  resize_term(ROWS, COLS);
+  curs_set(0);
+  use_default_colors();
+  start_color();
+  init_pair(1, COLOR_YELLOW, -1);
+  init_pair(2, COLOR_RED, -1);
+
+  // Window needs no watches, metadata engine or previews for drawing
+  WindowManager wm = {0};
+  wm.watch_fd = -1;
+  wm.meta.wake_fd = -1;
+  wm.previewer.wake_fd = -1;
+  JobQueue_init(&wm.jobs);
+
+  bench_set(&wm, "flat", count, NAME_SHORT);
+  bench_set(&wm, "long", count, NAME_LONG);
+  bench_set(&wm, "unicode", count, NAME_UNICODE);
+
+  ListingCache_free(&wm.cache);
+  JobQueue_free(&wm.jobs);
+  endwin();
+  delscreen(screen);
+  fclose(out);
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Recursive walk benchmark: nftw() vs Walker with 1..N threads
+// over a generated tree (warm cache, best of RUNS).
+//
+// Usage: bench_walk [fanout depth files_per_dir]   (default: 8 4 32)
+#define _GNU_SOURCE
+#include "../src/walker.h"
+#include "../src/enums.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long tree_entries;
+
+static void make_tree(int dir_fd, unsigned fanout, unsigned depth, unsigned files) {
+  char name[64];
+  for (unsigned i = 0; i < files; i++) {
+    snprintf(name, sizeof(name), "file_%04u.txt", i);
+    int fd = openat(dir_fd, name, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+      close(fd);
+      tree_entries++;
+    }
+  }
+  if (depth == 0) {
+    return;
+  }
+  for (unsigned i = 0; i < fanout; i++) {
+    snprintf(name, sizeof(name), "dir_%04u", i);
+    mkdirat(dir_fd, name, 0700);
+    tree_entries++;
+    int child_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+    if (child_fd >= 0) {
+      make_tree(child_fd, fanout, depth - 1, files);
+      close(child_fd);
+    }
+  }
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static atomic_ulong nftw_count;
+
+static int count_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)path;
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  atomic_fetch_add_explicit(&nftw_count, 1, memory_order_relaxed);
+  return 0;
+}
+
+// Per thread counters, padded so threads don't share cache lines
+typedef struct WalkCount {
+  unsigned long entries;
+  char padding[56];
+} WalkCount;
+
+static WalkAction walk_count(void *ctx, WalkThread *thread, const WalkEntry *entry) {
+  (void)entry;
+  ((WalkCount *)ctx)[thread->index].entries++;
+  return WALK_CONTINUE;
+}
+
+static void report(const char *method, unsigned long entries, double best_ns, double base_ns) {
+  printf("%-12s entries=%-8lu total_ms=%-9.2f ns_per_entry=%-7.1f speedup=%.2f\n",
+         method, entries, best_ns / 1e6, best_ns / entries, base_ns / best_ns);
+}
+
+int main(int argc, char **argv) {
+  unsigned fanout = argc > 3 ? strtoul(argv[1], NULL, 10) : 8;
+  unsigned depth = argc > 3 ? strtoul(argv[2], NULL, 10) : 4;
+  unsigned files = argc > 3 ? strtoul(argv[3], NULL, 10) : 32;
+
+  char root[] = "/tmp/tf_bench_walk_XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  int root_fd = open(root, O_RDONLY | O_DIRECTORY);
+  make_tree(root_fd, fanout, depth, files);
+  close(root_fd);
+  printf("tree fanout=%u depth=%u files_per_dir=%u entries=%lu cpus=%ld\n", fanout, depth, files,
+         tree_entries, sysconf(_SC_NPROCESSORS_ONLN));
+
+  // Also warms the cache
+  double base = 1e18;
+  for (int run = 0; run < RUNS; run++) {
+    atomic_store(&nftw_count, 0);
+    double start = now_ns();
+    nftw(root, count_entry, 64, FTW_PHYS);
+    double elapsed = now_ns() - start;
+    base = elapsed < base ? elapsed : base;
+  }
+  report("nftw", atomic_load(&nftw_count), base, base);
+
+  int thread_counts[] = {1, 2, 4, 8, 16};
+  for (int t = 0; t < 5; t++) {
+    WalkOptions options = {
+        .threads = thread_counts[t],
+        .max_depth = -1,
+        .symlinks = WALK_SYMLINKS_LIST,
+    };
+    WalkCount counts[16] = {0};
+    unsigned long entries = 0;
+    double best = 1e18;
+    for (int run = 0; run < RUNS; run++) {
+      memset(counts, 0, sizeof(counts));
+      double start = now_ns();
+      Walker_run(root, &options, walk_count, counts);
+      double elapsed = now_ns() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    for (int i = 0; i < thread_counts[t]; i++) {
+      entries += counts[i].entries;
+    }
+    char method[32];
+    snprintf(method, sizeof(method), "walker/%d", thread_counts[t]);
+    report(method, entries, best, base);
+  }
+
+  nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+  return 0;
+}
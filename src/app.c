@@ -1,6 +1,10 @@
 #include "app.h"
 #include "enums.h"
 #include "window.h"
+#include "watch.h"
+#include "session.h"
+#include "perf.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -9,6 +13,15 @@ extern void App_exit(App *app, const char *reason, ...) {
   // Free windows
   Window_free(&app->winmgr.first_window);
   Window_free(&app->winmgr.second_window);
+  ListingCache_free(&app->winmgr.cache);
+  MetaEngine_free(&app->winmgr.meta);
+  // Unfinished copies are removed
+  JobQueue_free(&app->winmgr.jobs);
+  Previewer_free(&app->winmgr.previewer);
+  Watch_free(&app->winmgr);
+  DirIndex_close(&app->dir_index);
+  Frecency_close(&app->winmgr.frecency);
+  Trace_dump();
 
   curs_set(1);
   echo();
@@ -64,6 +77,8 @@ extern void App_init_folders(App *app) {
   if (create_dir(app->data_paths.data) == ERROR) {
     App_exit(app, "Failed to create data folder at %s", app->data_paths.data);
   }
+  snprintf(app->data_paths.dir_index, PATH_MAX, "%s/dirindex", app->data_paths.data);
+  snprintf(app->data_paths.session, PATH_MAX, "%s/session", app->data_paths.data);
 }
 
 extern int App_parse_arguments(App *app, int argc, char **argv) {
@@ -76,9 +91,10 @@ extern int App_parse_arguments(App *app, int argc, char **argv) {
   if (argc < 2) {
     return SUCCESS;
   }
-  int argument_idx_start = 0;
+  int argument_idx_start = 1;
   // User want last application state
   if (strcmp(argv[argument_idx_start], "-l") == 0) {
+    app->state.restore_session = true;
     argument_idx_start++;
   }
   // Iterate through arguments
@@ -109,29 +125,113 @@ extern int App_parse_arguments(App *app, int argc, char **argv) {
     // If user want debug mode (for me mostly)
     if (strcmp(argument, "-debug") == 0) {
       app->state.debug = true;
+      Perf_enable();
+    }
+    // Spans written to data dir on exit and on SIGUSR1
+    if (strcmp(argument, "-trace") == 0) {
+      Trace_enable(app->data_paths.data);
     }
   }
 	return SUCCESS;
 }
 
+// Windows from session snapshot, false if there is none (or it is broken).
+// Listings are shown as saved, Window_revalidate checks them after first draw
+static bool App_restore_session(App *app) {
+  Session session;
+  if (Session_open(&session, app->data_paths.session) != SUCCESS) {
+    return false;
+  }
+  WindowManager *wm = &app->winmgr;
+  Window *windows[SESSION_WINDOWS_MAX] = {NULL};
+  for (unsigned int i = 0; i < session.header->count; i++) {
+    const SessionWindow *saved = &session.windows[i];
+    Window *win = malloc(sizeof(Window));
+    if (win == NULL || Window_create(win, wm, saved->pwd) == MALLOC_FAIL) {
+      free(win);
+      Session_close(&session);
+      App_exit(app, MALLOC_FAIL_MSG);
+    }
+    windows[i] = win;
+    win->relative_number = saved->relative_number;
+    win->details = saved->details;
+    win->sort = saved->sort;
+
+    // Second window in the same directory shares listing
+    Listing *listing = NULL;
+    if (i > 0 && saved->has_listing && session.windows[0].has_listing &&
+        saved->entries_offset == session.windows[0].entries_offset) {
+      listing = Listing_ref(windows[0]->listing);
+    } else {
+      listing = Session_listing(&session, i);
+    }
+    if (listing != NULL) {
+      Window_restore(win, listing, &saved->stamp, saved->highlight, saved->scroll);
+    } else if (Window_load(win) == MALLOC_FAIL) {
+      Session_close(&session);
+      App_exit(app, MALLOC_FAIL_MSG);
+    }
+  }
+  wm->active_window = windows[session.header->active];
+  if (session.header->preview_open && wm->window_counter == 1) {
+    WindowManager_toggle_preview(wm);
+  }
+  Session_close(&session);
+  // Relative paths (editor) are resolved against active window
+  if (chdir(wm->active_window->pwd) < 0) {
+    // Window_chdir goes to pwd first anyway
+  }
+  return true;
+}
+
+extern void App_save_session(App *app) {
+  Session_save(&app->winmgr, app->data_paths.session);
+}
+
 extern void App_init(App *app, int argc, char **argv) {	
+  // Nothing to close yet if init fails
+  app->winmgr.frecency.log_fd = -1;
+  app->winmgr.meta.wake_fd = -1;
+  app->winmgr.jobs.wake_fd = -1;
+  app->winmgr.previewer.wake_fd = -1;
 	// Init data folders
   App_init_folders(app);
+  // Jumping just won't have history without it
+  Frecency_open(&app->winmgr.frecency, app->data_paths.data);
 
   // Parsing arguments
   App_parse_arguments(app, argc, argv);
 
+  // Old index is usable right away, new one replaces it when ready
+  DirIndex_open(&app->dir_index, app->data_paths.dir_index);
+  DirIndexUpdate_start(&app->dir_index_update, app->data_paths.dir_index, FCD_INDEX_MAX_AGE_SEC);
+
   // Create first window
   app->winmgr.window_counter = 0;
+  // Without inotify windows just don't refresh by themselves
+  Watch_init(&app->winmgr);
+  // Without it details view just stays empty
+  MetaEngine_init(&app->winmgr.meta);
+  // Copy and move just don't run without it
+  JobQueue_init(&app->winmgr.jobs);
+  // Preview pane stays empty without it
+  Previewer_init(&app->winmgr.previewer);
+
+  if (app->state.restore_session && App_restore_session(app)) {
+    return;
+  }
 
   Window *first_window = malloc(sizeof(Window));
 	if (first_window == NULL) {
 		App_exit(app, MALLOC_FAIL_MSG);
 	}
-	Window_create(first_window,&app->winmgr, NULL);
+	if (Window_create(first_window,&app->winmgr, NULL) == MALLOC_FAIL) {
+		free(first_window);
+		App_exit(app, MALLOC_FAIL_MSG);
+	}
 
-  // Fill window with files
-  int fill_res = FilesArray_fill(&first_window->files, first_window->pwd); 
+  // Fill window with files (in background)
+  int fill_res = Window_load(first_window);
   if (fill_res > 0) {
     if (fill_res == MALLOC_FAIL){
       App_exit(app, MALLOC_FAIL_MSG);
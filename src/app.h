@@ -4,6 +4,7 @@
 #include "config.h"
 #include <linux/limits.h>
 #include "window.h"
+#include "dirindex.h"
 #include <string.h>
 #include <pwd.h>
 
@@ -12,17 +13,26 @@
 typedef struct AppState{
   char *editor;
   bool debug;
+  // "-l": windows of last session instead of current directory
+  bool restore_session;
 } AppState;
 
 typedef struct AppDataPaths{
   char cache[PATH_MAX];
   char data[PATH_MAX];
+  char dir_index[PATH_MAX];
+  char session[PATH_MAX];
 } AppDataPaths;
 
 typedef struct App{
   AppState state;
   AppDataPaths data_paths;
   WindowManager winmgr;
+  // fcd index, rebuilt in background when stale
+  DirIndex dir_index;
+  DirIndexUpdate dir_index_update;
+  // Instrumentation overlay ("-debug"), drawn over windows
+  WINDOW *perf_overlay;
 } App;
 
 extern void App_exit(App *app, const char *reason, ...);
@@ -33,4 +43,7 @@ extern int App_parse_arguments(App *app, int argc, char **argv);
 
 extern void App_init(App *app, int argc, char **argv);
 
+// Snapshot of windows for next "-l" start
+extern void App_save_session(App *app);
+
 #endif
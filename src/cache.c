@@ -0,0 +1,85 @@
+#include "cache.h"
+#include "enums.h"
+#include "perf.h"
+#include <stdlib.h>
+#include <string.h>
+
+extern bool DirStamp_equal(const DirStamp *a, const DirStamp *b) {
+  return a->dev == b->dev && a->ino == b->ino &&
+         a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+         a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+extern int DirStamp_get(const char *path, DirStamp *stamp) {
+  struct stat dir_stat;
+  Perf_count(PERF_STAT, 1);
+  if (stat(path, &dir_stat) < 0) {
+    return ERROR;
+  }
+  stamp->dev = dir_stat.st_dev;
+  stamp->ino = dir_stat.st_ino;
+  stamp->mtime = dir_stat.st_mtim;
+  stamp->ctime = dir_stat.st_ctim;
+  return SUCCESS;
+}
+
+static ListingCacheEntry *ListingCache_find(ListingCache *cache, const char *path) {
+  for (unsigned int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].path != NULL && strcmp(cache->entries[i].path, path) == 0) {
+      return &cache->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void ListingCacheEntry_free(ListingCacheEntry *entry) {
+  free(entry->path);
+  Listing_unref(&entry->listing);
+  memset(entry, 0, sizeof(*entry));
+}
+
+extern Listing *ListingCache_get(ListingCache *cache, const char *path, const DirStamp *stamp) {
+  ListingCacheEntry *entry = ListingCache_find(cache, path);
+  if (entry == NULL || entry->listing == NULL || !DirStamp_equal(&entry->stamp, stamp)) {
+    cache->misses++;
+    return NULL;
+  }
+  entry->last_used = ++cache->tick;
+  cache->hits++;
+  return Listing_ref(entry->listing);
+}
+
+extern void ListingCache_put(ListingCache *cache, const char *path, const DirStamp *stamp, Listing *listing) {
+  ListingCacheEntry *entry = ListingCache_find(cache, path);
+
+  if (entry == NULL && cache->count < LISTING_CACHE_SIZE) {
+    entry = &cache->entries[cache->count++];
+  }
+  // Full, evict least recently used
+  if (entry == NULL) {
+    entry = &cache->entries[0];
+    for (unsigned int i = 1; i < cache->count; i++) {
+      if (cache->entries[i].last_used < entry->last_used) {
+        entry = &cache->entries[i];
+      }
+    }
+  }
+  ListingCacheEntry_free(entry);
+
+  entry->path = strdup(path);
+  if (entry->path == NULL) {
+    // Leave empty slot, it never matches a lookup
+    ListingCacheEntry_free(entry);
+    return;
+  }
+  entry->listing = Listing_ref(listing);
+  entry->stamp = *stamp;
+  entry->last_used = ++cache->tick;
+}
+
+extern void ListingCache_free(ListingCache *cache) {
+  for (unsigned int i = 0; i < cache->count; i++) {
+    ListingCacheEntry_free(&cache->entries[i]);
+  }
+  cache->count = 0;
+}
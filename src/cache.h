@@ -0,0 +1,49 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "config.h"
+#include "listing.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// What is needed to tell if directory changed since it was read:
+// any create/delete/rename inside updates mtime/ctime,
+// replacing directory itself changes inode
+typedef struct DirStamp {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+} DirStamp;
+
+typedef struct ListingCacheEntry {
+  char *path;
+  DirStamp stamp;
+  Listing *listing;
+  unsigned long last_used;
+} ListingCacheEntry;
+
+// Bounded LRU of sorted listings keyed by canonical path.
+// Listings are shared with windows, not copied
+typedef struct ListingCache {
+  ListingCacheEntry entries[LISTING_CACHE_SIZE];
+  unsigned int count;
+  unsigned long tick;
+  unsigned long hits;
+  unsigned long misses;
+} ListingCache;
+
+extern int DirStamp_get(const char *path, DirStamp *stamp);
+
+extern bool DirStamp_equal(const DirStamp *a, const DirStamp *b);
+
+// New reference to cached listing of path if it is still valid for stamp, else NULL
+extern Listing *ListingCache_get(ListingCache *cache, const char *path, const DirStamp *stamp);
+
+// Keep reference to listing
+extern void ListingCache_put(ListingCache *cache, const char *path, const DirStamp *stamp, Listing *listing);
+
+extern void ListingCache_free(ListingCache *cache);
+
+#endif
@@ -10,6 +10,67 @@
 #define APP_NAME "tfiles"
 #define DATA_DIR ".local/share/" APP_NAME
 #define MALLOC_FAIL_MSG "Failed to allocate memory"
+//Buffer for getdents64 when reading directory.
+//Bigger buffer -> less syscalls on huge directories
+#define DIR_READ_BUFFER_SIZE (256 * 1024)
+//How many directory listings to keep for going back and forth
+#define LISTING_CACHE_SIZE 16
+//Changes in watched directories are applied at most once per interval
+#define PATCH_INTERVAL_MS 50
+#define WATCHED_MAX 4
+//Trimmed long names kept per window (slots, total wide chars)
+#define TRIM_CACHE_SIZE 256
+#define TRIM_CACHE_TEXT_MAX (64 * 1024)
+//Directory index for fcd: what is indexed, how often it is rebuilt
+#define FCD_INDEX_ROOT "/"
+#define FCD_INDEX_EXCLUDE "/proc", "/sys", "/dev", "/run"
+#define FCD_INDEX_MAX_AGE_SEC (30 * 60)
+#define FCD_RESULTS_MAX 256
+//Threads of recursive directory walks (index rebuild, ...)
+#define WALKER_THREADS_MAX 16
+//Frecency: visits logged before merging into table, rank total before aging
+#define FRECENCY_LOG_MAX 256
+#define FRECENCY_RANK_TOTAL_MAX 10000
+#define FRECENCY_RESULTS_MAX 256
+//How often pickers (fcd, ...) check for background results
+#define PICKER_POLL_MS 50
+//Details view: statx requests in flight, rows fetched around visible ones,
+//threads when io_uring is not available
+#define META_QUEUE_DEPTH 256
+#define META_PREFETCH_ROWS 128
+#define META_THREADS 4
+//Copy/move/delete jobs: threads, bytes per copy_file_range call / read buffer,
+//how often progress is redrawn while a job runs
+#define JOB_THREADS 2
+#define JOB_COPY_CHUNK (8 * 1024 * 1024)
+#define JOB_BUFFER_SIZE (1024 * 1024)
+#define JOB_PROGRESS_MS 250
+//Delete jobs: threads running unlinkat, names handed to them per batch
+#define JOB_UNLINK_THREADS 4
+#define JOB_UNLINK_BATCH 64
+//Preview pane: bytes read from head of file, previews kept,
+//rows after highlighted one read ahead, reading threads, tab width
+#define PREVIEW_MAX_BYTES (64 * 1024)
+#define PREVIEW_CACHE_SIZE 32
+#define PREVIEW_PREFETCH_ROWS 4
+#define PREVIEW_THREADS 2
+#define PREVIEW_TAB_WIDTH 4
+//Content search ("fg"): walker threads (reading is I/O bound, more than
+//CPUs keeps SSD queue full), read size, results kept, bytes of line shown
+#define GREP_THREADS 8
+#define GREP_READ_SIZE (256 * 1024)
+#define GREP_RESULTS_MAX 100000
+#define GREP_LINE_MAX 160
+#define GREP_EXCLUDE ".git"
+//Debug overlay ("-debug"): frames kept for p99 frame time, overlay width
+#define PERF_FRAMES 128
+#define PERF_OVERLAY_WIDTH 46
+//Keys handled at most between two frames (typeahead is drained before
+//drawing, runs of j/k are folded into one move)
+#define INPUT_DRAIN_MAX 512
+//Tracing ("-trace"): spans kept per thread, bytes of span detail (path, key)
+#define TRACE_RING_EVENTS 8192
+#define TRACE_ARG_MAX 96
 
 
 
@@ -29,19 +90,37 @@
 #define KEY_GOTO_FILE 'g'
 
 #define KEY_CREATE_WINDOW 'c'
-#define KEY_CLOSE_WINDOW 'd'
+#define KEY_CLOSE_WINDOW 'x'
 #define KEY_SWITCH_WINDOWS '\t'
 #define KEY_SWITCH_NUMBERS 'n'
+//Next sort mode: name, natural, locale, size, time, extension
+#define KEY_SORT 's'
+//Directories before files on/off
+#define KEY_SORT_DIRS_FIRST 'S'
 
 //Search file/directory && Start button for find shortcuts
 #define KEY_FIND_FILE 'f'
+//"fcd": jump to any directory by name
+#define KEY_FIND_CD 'c'
+#define KEY_FIND_CD1 'd'
+//Search content of files under current directory ("fg"), "/" in front for regex
+#define KEY_FIND_GREP 'g'
+//Jump to frequently and recently visited directory
+#define KEY_JUMP 'z'
 //Create new file
 #define KEY_CREATE_FILE 'a'
 //Delete current file
 #define KEY_DELETE_FILE 'd'
 //Rename current file
 #define KEY_RENAME_FILE 'r'
-//Get info about current file
+//Copy / move current file to directory of other window
+#define KEY_COPY_FILE 'y'
+#define KEY_MOVE_FILE 'm'
+//Stop running and queued file jobs
+#define KEY_CANCEL_JOBS 'X'
+//Preview of highlighted file on/off (Enter on file opens it too)
+#define KEY_PREVIEW 'p'
+//Details (mode, owner, size, mtime) on/off
 #define KEY_FILE_INFO 'i'
 
 
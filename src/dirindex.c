@@ -0,0 +1,817 @@
+#define _GNU_SOURCE
+#include "dirindex.h"
+#include "config.h"
+#include "enums.h"
+#include "walker.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *index_exclude[] = {FCD_INDEX_EXCLUDE, NULL};
+
+
+static inline unsigned char lower(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline uint32_t trigram_of(const unsigned char *s) {
+  return (uint32_t)lower(s[0]) << 16 | (uint32_t)lower(s[1]) << 8 | lower(s[2]);
+}
+
+// Path order where '/' goes before any other char,
+// so a directory is directly followed by its whole subtree
+static int compare_paths(const char *a, const char *b) {
+  const unsigned char *ua = (const unsigned char *)a, *ub = (const unsigned char *)b;
+  while (*ua && *ua == *ub) {
+    ua++;
+    ub++;
+  }
+  int ca = *ua == '/' ? 1 : (*ua ? *ua + 1 : 0);
+  int cb = *ub == '/' ? 1 : (*ub ? *ub + 1 : 0);
+  return ca - cb;
+}
+
+// Case insensitive compare of at most n chars (n < 0: whole strings)
+static int compare_lower(const char *a, const char *b, long n) {
+  const unsigned char *ua = (const unsigned char *)a, *ub = (const unsigned char *)b;
+  for (; n != 0; ua++, ub++, n--) {
+    int diff = lower(*ua) - lower(*ub);
+    if (diff != 0 || *ua == '\0') {
+      return diff;
+    }
+  }
+  return 0;
+}
+
+static bool contains_lower(const char *haystack, const char *needle_lower, size_t needle_len) {
+  for (; *haystack; haystack++) {
+    size_t i = 0;
+    while (i < needle_len && haystack[i] && lower(haystack[i]) == (unsigned char)needle_lower[i]) {
+      i++;
+    }
+    if (i == needle_len) {
+      return true;
+    }
+  }
+  return needle_len == 0;
+}
+
+// ---- Reading ----
+
+// Section of count items at offset inside file, aligned for its items
+static bool section_fits(uint64_t size, uint64_t offset, uint64_t count, size_t item_size, size_t align) {
+  return offset % align == 0 && offset <= size && count <= (size - offset) / item_size;
+}
+
+// Every id and offset points inside index (file of another version or a
+// broken one would be read out of bounds otherwise)
+static bool DirIndex_valid(const char *map, const DirIndexHeader *header) {
+  const char *paths = map + header->paths_offset;
+  const DirIndexDir *dirs = (const DirIndexDir *)(map + header->dirs_offset);
+  const uint32_t *by_name = (const uint32_t *)(map + header->by_name_offset);
+  const DirIndexTrigram *trigrams = (const DirIndexTrigram *)(map + header->trigrams_offset);
+  const uint32_t *postings = (const uint32_t *)(map + header->postings_offset);
+  uint32_t count = header->dir_count;
+  for (uint32_t i = 0; i < count; i++) {
+    const DirIndexDir *dir = &dirs[i];
+    if ((uint64_t)dir->path_offset + dir->path_len >= header->paths_size ||
+        paths[dir->path_offset + dir->path_len] != '\0' || dir->name_start > dir->path_len ||
+        (dir->parent != DIRINDEX_NO_PARENT && dir->parent >= count) || by_name[i] >= count) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header->trigram_count; i++) {
+    if ((uint64_t)trigrams[i].postings_start + trigrams[i].postings_count > header->postings_count) {
+      return false;
+    }
+  }
+  for (uint64_t i = 0; i < header->postings_count; i++) {
+    if (postings[i] >= count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+extern int DirIndex_open(DirIndex *index, const char *index_path) {
+  memset(index, 0, sizeof(*index));
+  int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ERROR;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0 || (size_t)file_stat.st_size < sizeof(DirIndexHeader)) {
+    close(fd);
+    return ERROR;
+  }
+
+  void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return ERROR;
+  }
+
+  const DirIndexHeader *header = map;
+  uint64_t size = file_stat.st_size;
+  if (memcmp(header->magic, DIRINDEX_MAGIC, 4) != 0 || header->version != DIRINDEX_VERSION ||
+      !section_fits(size, header->paths_offset, header->paths_size, 1, 1) ||
+      !section_fits(size, header->dirs_offset, header->dir_count, sizeof(DirIndexDir), 8) ||
+      !section_fits(size, header->by_name_offset, header->dir_count, sizeof(uint32_t), 4) ||
+      !section_fits(size, header->trigrams_offset, header->trigram_count, sizeof(DirIndexTrigram), 4) ||
+      !section_fits(size, header->postings_offset, header->postings_count, sizeof(uint32_t), 4) ||
+      !DirIndex_valid(map, header)) {
+    munmap(map, file_stat.st_size);
+    return ERROR;
+  }
+
+  index->map = map;
+  index->map_size = file_stat.st_size;
+  index->header = header;
+  index->paths = (const char *)map + header->paths_offset;
+  index->dirs = (const DirIndexDir *)((const char *)map + header->dirs_offset);
+  index->by_name = (const uint32_t *)((const char *)map + header->by_name_offset);
+  index->trigrams = (const DirIndexTrigram *)((const char *)map + header->trigrams_offset);
+  index->postings = (const uint32_t *)((const char *)map + header->postings_offset);
+  return SUCCESS;
+}
+
+extern void DirIndex_close(DirIndex *index) {
+  if (index->map != NULL) {
+    munmap(index->map, index->map_size);
+  }
+  memset(index, 0, sizeof(*index));
+}
+
+static unsigned int DirIndex_count(const DirIndex *index) {
+  return index->header ? index->header->dir_count : 0;
+}
+
+// Id of directory with exactly this path, -1 if not indexed
+static int64_t DirIndex_find_path(const DirIndex *index, const char *path) {
+  int64_t low = 0, high = (int64_t)DirIndex_count(index) - 1;
+  while (low <= high) {
+    int64_t mid = low + (high - low) / 2;
+    int cmp = compare_paths(DirIndex_path(index, mid), path);
+    if (cmp == 0) {
+      return mid;
+    }
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return -1;
+}
+
+static const DirIndexTrigram *DirIndex_find_trigram(const DirIndex *index, uint32_t trigram) {
+  int64_t low = 0, high = (int64_t)index->header->trigram_count - 1;
+  while (low <= high) {
+    int64_t mid = low + (high - low) / 2;
+    if (index->trigrams[mid].trigram == trigram) {
+      return &index->trigrams[mid];
+    }
+    if (index->trigrams[mid].trigram < trigram) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+typedef struct Candidate {
+  uint32_t id;
+  uint32_t score;
+} Candidate;
+
+static int compare_candidates(const void *a, const void *b) {
+  const Candidate *ca = a, *cb = b;
+  if (ca->score != cb->score) {
+    return ca->score < cb->score ? -1 : 1;
+  }
+  return ca->id < cb->id ? -1 : (ca->id > cb->id);
+}
+
+// Best max candidates seen so far, kept as heap with the worst on top
+typedef struct TopCandidates {
+  Candidate *heap;
+  unsigned int count;
+  unsigned int max;
+} TopCandidates;
+
+static void TopCandidates_sift_down(TopCandidates *top, unsigned int i) {
+  for (;;) {
+    unsigned int worst = i, left = 2 * i + 1, right = left + 1;
+    if (left < top->count && compare_candidates(&top->heap[left], &top->heap[worst]) > 0) {
+      worst = left;
+    }
+    if (right < top->count && compare_candidates(&top->heap[right], &top->heap[worst]) > 0) {
+      worst = right;
+    }
+    if (worst == i) {
+      return;
+    }
+    Candidate tmp = top->heap[i];
+    top->heap[i] = top->heap[worst];
+    top->heap[worst] = tmp;
+    i = worst;
+  }
+}
+
+static void TopCandidates_add(TopCandidates *top, Candidate candidate) {
+  if (top->count < top->max) {
+    unsigned int i = top->count++;
+    while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+      if (compare_candidates(&candidate, &top->heap[parent]) <= 0) {
+        break;
+      }
+      top->heap[i] = top->heap[parent];
+      i = parent;
+    }
+    top->heap[i] = candidate;
+  } else if (compare_candidates(&candidate, &top->heap[0]) < 0) {
+    top->heap[0] = candidate;
+    TopCandidates_sift_down(top, 0);
+  }
+}
+
+static int compare_postings_size(const void *a, const void *b) {
+  const DirIndexTrigram *ta = *(const DirIndexTrigram *const *)a;
+  const DirIndexTrigram *tb = *(const DirIndexTrigram *const *)b;
+  return (ta->postings_count > tb->postings_count) - (ta->postings_count < tb->postings_count);
+}
+
+static bool postings_contain(const uint32_t *postings, uint32_t count, uint32_t id) {
+  uint32_t low = 0, high = count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (postings[mid] < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low < count && postings[low] == id;
+}
+
+// Lower score is better: exact name, name prefix, name substring; then shorter path
+static bool DirIndex_score(const DirIndex *index, uint32_t id, const char *term, size_t term_len,
+                           const char *query, size_t query_len, bool query_has_slash, uint32_t *score) {
+  const DirIndexDir *dir = &index->dirs[id];
+  const char *path = DirIndex_path(index, id);
+  const char *name = path + dir->name_start;
+
+  uint32_t kind;
+  size_t name_len = dir->path_len - dir->name_start;
+  if (name_len == term_len && compare_lower(name, term, -1) == 0) {
+    kind = 0;
+  } else if (compare_lower(name, term, term_len) == 0) {
+    kind = 1;
+  } else if (contains_lower(name, term, term_len)) {
+    kind = 2;
+  } else {
+    return false;
+  }
+  if (query_has_slash && !contains_lower(path, query, query_len)) {
+    return false;
+  }
+  *score = kind << 16 | dir->path_len;
+  return true;
+}
+
+extern unsigned int DirIndex_query(const DirIndex *index, const char *query, uint32_t *results,
+                                   unsigned int max_results) {
+  if (index->header == NULL || max_results == 0) {
+    return 0;
+  }
+
+  char query_lower[PATH_MAX];
+  size_t query_len = 0;
+  for (; query[query_len] && query_len + 1 < sizeof(query_lower); query_len++) {
+    query_lower[query_len] = lower(query[query_len]);
+  }
+  query_lower[query_len] = '\0';
+
+  // Basename part of query is what index is built from
+  const char *term = strrchr(query_lower, '/');
+  bool query_has_slash = term != NULL;
+  term = term ? term + 1 : query_lower;
+  size_t term_len = strlen(term);
+
+  // Every match is scored, only the best max_results are kept
+  TopCandidates top = {malloc(max_results * sizeof(Candidate)), 0, max_results};
+  if (top.heap == NULL) {
+    return 0;
+  }
+
+  if (term_len >= 3) {
+    // Posting lists of every trigram of term, intersected from the shortest
+    const DirIndexTrigram *lists[PATH_MAX];
+    unsigned int lists_count = 0;
+    for (size_t i = 0; i + 3 <= term_len; i++) {
+      const DirIndexTrigram *trigram = DirIndex_find_trigram(index, trigram_of((const unsigned char *)term + i));
+      if (trigram == NULL) {
+        free(top.heap);
+        return 0;
+      }
+      lists[lists_count++] = trigram;
+    }
+    qsort(lists, lists_count, sizeof(lists[0]), compare_postings_size);
+
+    const uint32_t *smallest = index->postings + lists[0]->postings_start;
+    for (uint32_t i = 0; i < lists[0]->postings_count; i++) {
+      uint32_t id = smallest[i];
+      bool in_all = true;
+      for (unsigned int l = 1; l < lists_count && in_all; l++) {
+        in_all = postings_contain(index->postings + lists[l]->postings_start, lists[l]->postings_count, id);
+      }
+      uint32_t score;
+      if (in_all && DirIndex_score(index, id, term, term_len, query_lower, query_len, query_has_slash, &score)) {
+        TopCandidates_add(&top, (Candidate){id, score});
+      }
+    }
+  } else {
+    // Too short for trigrams: prefix range of names sorted index
+    uint32_t count = index->header->dir_count;
+    uint32_t low = 0, high = count;
+    while (low < high) {
+      uint32_t mid = low + (high - low) / 2;
+      const DirIndexDir *dir = &index->dirs[index->by_name[mid]];
+      const char *name = index->paths + dir->path_offset + dir->name_start;
+      if (compare_lower(name, term, term_len) < 0) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    for (uint32_t i = low; i < count; i++) {
+      uint32_t id = index->by_name[i];
+      const DirIndexDir *dir = &index->dirs[id];
+      if (compare_lower(index->paths + dir->path_offset + dir->name_start, term, term_len) != 0) {
+        break;
+      }
+      uint32_t score;
+      if (DirIndex_score(index, id, term, term_len, query_lower, query_len, query_has_slash, &score)) {
+        TopCandidates_add(&top, (Candidate){id, score});
+      }
+    }
+  }
+
+  qsort(top.heap, top.count, sizeof(Candidate), compare_candidates);
+  for (unsigned int i = 0; i < top.count; i++) {
+    results[i] = top.heap[i].id;
+  }
+  free(top.heap);
+  return top.count;
+}
+
+// ---- Building ----
+
+typedef struct BuildDir {
+  int64_t mtime_sec;
+  uint64_t path_offset;
+  uint32_t mtime_nsec;
+  uint16_t path_len;
+  uint16_t name_start;
+} BuildDir;
+
+// Directories found by one walker thread
+typedef struct Builder {
+  BuildDir *dirs;
+  size_t count, size;
+  char *paths;
+  size_t paths_used, paths_size;
+} Builder;
+
+static const char *Builder_path(const Builder *builder, size_t id) {
+  return builder->paths + builder->dirs[id].path_offset;
+}
+
+static int Builder_add(Builder *builder, const char *path, size_t path_len, size_t name_start,
+                       const struct timespec *mtime) {
+  if (path_len > UINT16_MAX) {
+    return ERROR;
+  }
+  if (builder->count >= builder->size) {
+    size_t new_size = builder->size ? builder->size * 2 : 1024;
+    BuildDir *new_dirs = realloc(builder->dirs, new_size * sizeof(BuildDir));
+    if (new_dirs == NULL) {
+      return MALLOC_FAIL;
+    }
+    builder->dirs = new_dirs;
+    builder->size = new_size;
+  }
+  if (builder->paths_used + path_len + 1 > builder->paths_size) {
+    size_t new_size = builder->paths_size ? builder->paths_size * 2 : 64 * 1024;
+    while (new_size < builder->paths_used + path_len + 1) {
+      new_size *= 2;
+    }
+    char *new_paths = realloc(builder->paths, new_size);
+    if (new_paths == NULL) {
+      return MALLOC_FAIL;
+    }
+    builder->paths = new_paths;
+    builder->paths_size = new_size;
+  }
+
+  memcpy(builder->paths + builder->paths_used, path, path_len + 1);
+  builder->dirs[builder->count++] = (BuildDir){
+      .mtime_sec = mtime->tv_sec,
+      .mtime_nsec = mtime->tv_nsec,
+      .path_offset = builder->paths_used,
+      .path_len = path_len,
+      .name_start = name_start,
+  };
+  builder->paths_used += path_len + 1;
+  return SUCCESS;
+}
+
+// Move all directories of src to the end of dest
+static int Builder_append(Builder *dest, Builder *src) {
+  for (size_t i = 0; i < src->count; i++) {
+    const BuildDir *dir = &src->dirs[i];
+    struct timespec mtime = {dir->mtime_sec, dir->mtime_nsec};
+    int status = Builder_add(dest, Builder_path(src, i), dir->path_len, dir->name_start, &mtime);
+    if (status != SUCCESS) {
+      return status;
+    }
+  }
+  free(src->dirs);
+  free(src->paths);
+  memset(src, 0, sizeof(*src));
+  return SUCCESS;
+}
+
+// Subdirectories of old index, grouped by parent
+typedef struct OldChildren {
+  uint32_t *start;
+  uint32_t *ids;
+} OldChildren;
+
+static int OldChildren_build(OldChildren *children, const DirIndex *old) {
+  uint32_t count = DirIndex_count(old);
+  children->start = calloc(count + 1, sizeof(uint32_t));
+  children->ids = malloc((count ? count : 1) * sizeof(uint32_t));
+  if (children->start == NULL || children->ids == NULL) {
+    return MALLOC_FAIL;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (old->dirs[i].parent != DIRINDEX_NO_PARENT) {
+      children->start[old->dirs[i].parent + 1]++;
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    children->start[i + 1] += children->start[i];
+  }
+  uint32_t *fill = malloc((count ? count : 1) * sizeof(uint32_t));
+  if (fill == NULL) {
+    return MALLOC_FAIL;
+  }
+  memcpy(fill, children->start, count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < count; i++) {
+    if (old->dirs[i].parent != DIRINDEX_NO_PARENT) {
+      children->ids[fill[old->dirs[i].parent]++] = i;
+    }
+  }
+  free(fill);
+  return SUCCESS;
+}
+
+typedef struct BuildWalk {
+  Builder *builders;
+  const DirIndex *old;
+  const OldChildren *old_children;
+} BuildWalk;
+
+static WalkAction DirIndex_visit(void *ctx, WalkThread *thread, const WalkEntry *entry) {
+  BuildWalk *walk = ctx;
+  struct timespec mtime = {0};
+  struct stat dir_stat;
+  if (entry->dir_fd >= 0 && fstat(entry->dir_fd, &dir_stat) == 0) {
+    mtime = dir_stat.st_mtim;
+  }
+  Builder_add(&walk->builders[thread->index], entry->path, entry->path_len, entry->name_start, &mtime);
+  if (entry->dir_fd < 0 || walk->old_children->start == NULL) {
+    return WALK_CONTINUE;
+  }
+
+  // Directory didn't change since old index: take its subdirectories
+  // from there instead of reading it
+  const DirIndex *old = walk->old;
+  int64_t old_id = DirIndex_find_path(old, entry->path);
+  if (old_id < 0 || old->dirs[old_id].mtime_sec != mtime.tv_sec ||
+      old->dirs[old_id].mtime_nsec != (uint32_t)mtime.tv_nsec) {
+    return WALK_CONTINUE;
+  }
+  const OldChildren *old_children = walk->old_children;
+  for (uint32_t c = old_children->start[old_id]; c < old_children->start[old_id + 1]; c++) {
+    const DirIndexDir *child = &old->dirs[old_children->ids[c]];
+    const char *name = old->paths + child->path_offset + child->name_start;
+    Walker_add_child(thread, name, child->path_len - child->name_start);
+  }
+  return WALK_SKIP;
+}
+
+static int compare_build_paths(const void *a, const void *b, void *builder) {
+  return compare_paths(Builder_path(builder, *(const uint32_t *)a), Builder_path(builder, *(const uint32_t *)b));
+}
+
+typedef struct NameSortContext {
+  const BuildDir *dirs;
+  const char *paths;
+} NameSortContext;
+
+static int compare_build_names(const void *a, const void *b, void *arg) {
+  const NameSortContext *ctx = arg;
+  const BuildDir *da = &ctx->dirs[*(const uint32_t *)a];
+  const BuildDir *db = &ctx->dirs[*(const uint32_t *)b];
+  return compare_lower(ctx->paths + da->path_offset + da->name_start,
+                       ctx->paths + db->path_offset + db->name_start, -1);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+  return (ua > ub) - (ua < ub);
+}
+
+static bool write_all(FILE *file, const void *data, size_t size) {
+  return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+static bool write_padding(FILE *file, uint64_t *offset) {
+  static const char zeros[8] = {0};
+  size_t pad = (8 - *offset % 8) % 8;
+  *offset += pad;
+  return write_all(file, zeros, pad);
+}
+
+static int Builder_write(Builder *builder, const char *index_path) {
+  uint32_t count = builder->count;
+  int status = MALLOC_FAIL;
+  uint32_t *order = malloc((count ? count : 1) * sizeof(uint32_t));
+  uint32_t *ancestors = malloc((count ? count : 1) * sizeof(uint32_t));
+  DirIndexDir *dirs = malloc((count ? count : 1) * sizeof(DirIndexDir));
+  uint32_t *by_name = malloc((count ? count : 1) * sizeof(uint32_t));
+  uint64_t *pairs = NULL;
+  DirIndexTrigram *trigrams = NULL;
+  uint32_t *postings = NULL;
+  FILE *file = NULL;
+  // Other tf instances may be writing theirs at the same time
+  char tmp_path[PATH_MAX + 32];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", index_path, (int)getpid());
+
+  if (order == NULL || ancestors == NULL || dirs == NULL || by_name == NULL) {
+    goto cleanup;
+  }
+
+  // Directory table in subtree order
+  for (uint32_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  qsort_r(order, count, sizeof(uint32_t), compare_build_paths, builder);
+
+  // Paths are written in table order.
+  // Subtree order puts parent before children: ancestors of current
+  // directory are a stack, parent is the nearest one whose path prefixes it
+  uint64_t paths_size = 0;
+  uint32_t ancestors_count = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const char *path = Builder_path(builder, order[i]);
+    while (ancestors_count > 0) {
+      const BuildDir *top = &builder->dirs[order[ancestors[ancestors_count - 1]]];
+      const char *top_path = builder->paths + top->path_offset;
+      size_t prefix_len = top->path_len == 1 && top_path[0] == '/' ? 0 : top->path_len;
+      if (strncmp(path, top_path, prefix_len) == 0 && path[prefix_len] == '/') {
+        break;
+      }
+      ancestors_count--;
+    }
+
+    const BuildDir *src = &builder->dirs[order[i]];
+    DirIndexDir *dir = &dirs[i];
+    dir->mtime_sec = src->mtime_sec;
+    dir->mtime_nsec = src->mtime_nsec;
+    dir->path_offset = paths_size;
+    dir->path_len = src->path_len;
+    dir->name_start = src->name_start;
+    dir->parent = ancestors_count > 0 ? ancestors[ancestors_count - 1] : DIRINDEX_NO_PARENT;
+    ancestors[ancestors_count++] = i;
+    paths_size += src->path_len + 1;
+  }
+  if (paths_size > UINT32_MAX) {
+    status = ERROR;
+    goto cleanup;
+  }
+
+  // Names order, for short prefix queries
+  for (uint32_t i = 0; i < count; i++) {
+    by_name[i] = i;
+  }
+  char *table_paths = malloc(paths_size ? paths_size : 1);
+  if (table_paths == NULL) {
+    goto cleanup;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    memcpy(table_paths + dirs[i].path_offset, Builder_path(builder, order[i]), dirs[i].path_len + 1);
+  }
+  NameSortContext name_ctx = {.dirs = NULL, .paths = table_paths};
+  // Same layout as BuildDir for the fields compare_build_names reads
+  BuildDir *table_dirs = malloc((count ? count : 1) * sizeof(BuildDir));
+  if (table_dirs == NULL) {
+    free(table_paths);
+    goto cleanup;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    table_dirs[i].path_offset = dirs[i].path_offset;
+    table_dirs[i].name_start = dirs[i].name_start;
+  }
+  name_ctx.dirs = table_dirs;
+  qsort_r(by_name, count, sizeof(uint32_t), compare_build_names, &name_ctx);
+  free(table_dirs);
+
+  // Trigrams of lowercase basenames: (trigram, id) pairs sorted and grouped
+  size_t pairs_count = 0, pairs_size = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    size_t name_len = dirs[i].path_len - dirs[i].name_start;
+    pairs_size += name_len >= 3 ? name_len - 2 : 0;
+  }
+  pairs = malloc((pairs_size ? pairs_size : 1) * sizeof(uint64_t));
+  if (pairs == NULL) {
+    free(table_paths);
+    goto cleanup;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const unsigned char *name = (const unsigned char *)table_paths + dirs[i].path_offset + dirs[i].name_start;
+    size_t name_len = dirs[i].path_len - dirs[i].name_start;
+    for (size_t c = 0; c + 3 <= name_len; c++) {
+      pairs[pairs_count++] = (uint64_t)trigram_of(name + c) << 32 | i;
+    }
+  }
+  qsort(pairs, pairs_count, sizeof(uint64_t), compare_u64);
+
+  trigrams = malloc((pairs_count ? pairs_count : 1) * sizeof(DirIndexTrigram));
+  postings = malloc((pairs_count ? pairs_count : 1) * sizeof(uint32_t));
+  if (trigrams == NULL || postings == NULL) {
+    free(table_paths);
+    goto cleanup;
+  }
+  uint32_t trigram_count = 0;
+  uint64_t postings_count = 0;
+  for (size_t i = 0; i < pairs_count; i++) {
+    // Same trigram twice in one name
+    if (i > 0 && pairs[i] == pairs[i - 1]) {
+      continue;
+    }
+    uint32_t trigram = pairs[i] >> 32;
+    if (trigram_count == 0 || trigrams[trigram_count - 1].trigram != trigram) {
+      trigrams[trigram_count++] = (DirIndexTrigram){trigram, postings_count, 0};
+    }
+    postings[postings_count++] = (uint32_t)pairs[i];
+    trigrams[trigram_count - 1].postings_count++;
+  }
+
+  // Write to temporary file and move it over old index
+  file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    free(table_paths);
+    status = ERROR;
+    goto cleanup;
+  }
+  DirIndexHeader header = {0};
+  memcpy(header.magic, DIRINDEX_MAGIC, 4);
+  header.version = DIRINDEX_VERSION;
+  header.dir_count = count;
+  header.trigram_count = trigram_count;
+  header.postings_count = postings_count;
+
+  uint64_t offset = sizeof(header);
+  bool ok = write_all(file, &header, sizeof(header));
+  header.paths_offset = offset;
+  header.paths_size = paths_size;
+  ok = ok && write_all(file, table_paths, paths_size);
+  offset += paths_size;
+  ok = ok && write_padding(file, &offset);
+  header.dirs_offset = offset;
+  ok = ok && write_all(file, dirs, count * sizeof(DirIndexDir));
+  offset += count * sizeof(DirIndexDir);
+  header.by_name_offset = offset;
+  ok = ok && write_all(file, by_name, count * sizeof(uint32_t));
+  offset += count * sizeof(uint32_t);
+  ok = ok && write_padding(file, &offset);
+  header.trigrams_offset = offset;
+  ok = ok && write_all(file, trigrams, trigram_count * sizeof(DirIndexTrigram));
+  offset += trigram_count * sizeof(DirIndexTrigram);
+  header.postings_offset = offset;
+  ok = ok && write_all(file, postings, postings_count * sizeof(uint32_t));
+  // Header again, now with offsets
+  ok = ok && fseek(file, 0, SEEK_SET) == 0 && write_all(file, &header, sizeof(header));
+  free(table_paths);
+
+  if (fclose(file) != 0 || !ok || rename(tmp_path, index_path) < 0) {
+    unlink(tmp_path);
+    file = NULL;
+    status = ERROR;
+    goto cleanup;
+  }
+  file = NULL;
+  status = SUCCESS;
+
+cleanup:
+  if (file != NULL) {
+    fclose(file);
+    unlink(tmp_path);
+  }
+  free(order);
+  free(ancestors);
+  free(dirs);
+  free(by_name);
+  free(pairs);
+  free(trigrams);
+  free(postings);
+  return status;
+}
+
+extern int DirIndex_build(const char *index_path) {
+  DirIndex old;
+  OldChildren old_children = {0};
+  if (DirIndex_open(&old, index_path) == SUCCESS &&
+      OldChildren_build(&old_children, &old) != SUCCESS) {
+    free(old_children.start);
+    free(old_children.ids);
+    old_children.start = NULL;
+    old_children.ids = NULL;
+  }
+
+  WalkOptions options = {
+      .max_depth = -1,
+      .symlinks = WALK_SYMLINKS_SKIP,
+      .exclude = index_exclude,
+      .dirs_only = true,
+  };
+  int thread_count = Walker_thread_count(&options);
+  options.threads = thread_count;
+  Builder builder = {0};
+  BuildWalk walk = {
+      .builders = calloc(thread_count, sizeof(Builder)),
+      .old = &old,
+      .old_children = &old_children,
+  };
+  int status = MALLOC_FAIL;
+  if (walk.builders != NULL && Walker_run(FCD_INDEX_ROOT, &options, DirIndex_visit, &walk) == SUCCESS) {
+    status = SUCCESS;
+    for (int i = 0; i < thread_count && status == SUCCESS; i++) {
+      status = Builder_append(&builder, &walk.builders[i]);
+    }
+    if (status == SUCCESS) {
+      status = Builder_write(&builder, index_path);
+    }
+  }
+
+  for (int i = 0; walk.builders != NULL && i < thread_count; i++) {
+    free(walk.builders[i].dirs);
+    free(walk.builders[i].paths);
+  }
+  free(walk.builders);
+  free(builder.dirs);
+  free(builder.paths);
+  free(old_children.start);
+  free(old_children.ids);
+  DirIndex_close(&old);
+  return status;
+}
+
+static void *DirIndexUpdate_worker(void *arg) {
+  DirIndexUpdate *update = arg;
+  if (DirIndex_build(update->index_path) == SUCCESS) {
+    atomic_store(&update->finished, true);
+  }
+  atomic_store(&update->running, false);
+  return NULL;
+}
+
+extern void DirIndexUpdate_start(DirIndexUpdate *update, const char *index_path, long max_age_sec) {
+  if (atomic_load(&update->running)) {
+    return;
+  }
+  struct stat index_stat;
+  if (stat(index_path, &index_stat) == 0 && time(NULL) - index_stat.st_mtime < max_age_sec) {
+    return;
+  }
+
+  snprintf(update->index_path, sizeof(update->index_path), "%s", index_path);
+  atomic_store(&update->finished, false);
+  atomic_store(&update->running, true);
+  if (pthread_create(&update->thread, NULL, DirIndexUpdate_worker, update) != 0) {
+    atomic_store(&update->running, false);
+    return;
+  }
+  pthread_detach(update->thread);
+}
@@ -0,0 +1,99 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk index of every directory for "fcd".
+//
+// File layout (native endian, mmap'd as is, no parsing at startup):
+//   DirIndexHeader
+//   paths      all paths, NUL terminated
+//   dirs       DirIndexDir[dir_count], sorted by path ('/' sorts first,
+//              so every subtree is one contiguous range)
+//   by_name    uint32[dir_count] dir ids sorted by lowercase basename
+//              (prefix lookup for queries shorter than a trigram)
+//   trigrams   DirIndexTrigram[trigram_count] sorted, of lowercase basenames
+//   postings   uint32 dir ids, ascending per trigram
+#define DIRINDEX_MAGIC "TFDI"
+#define DIRINDEX_VERSION 1
+#define DIRINDEX_NO_PARENT UINT32_MAX
+
+typedef struct DirIndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t dir_count;
+  uint32_t trigram_count;
+  uint64_t paths_offset;
+  uint64_t paths_size;
+  uint64_t dirs_offset;
+  uint64_t by_name_offset;
+  uint64_t trigrams_offset;
+  uint64_t postings_offset;
+  uint64_t postings_count;
+} DirIndexHeader;
+
+typedef struct DirIndexDir {
+  int64_t mtime_sec;
+  uint32_t path_offset;
+  uint32_t parent;
+  uint32_t mtime_nsec;
+  uint16_t path_len;
+  // Basename starts at path + name_start
+  uint16_t name_start;
+} DirIndexDir;
+
+typedef struct DirIndexTrigram {
+  uint32_t trigram;
+  uint32_t postings_start;
+  uint32_t postings_count;
+} DirIndexTrigram;
+
+// Opened (mmap'd) index
+typedef struct DirIndex {
+  void *map;
+  size_t map_size;
+  const DirIndexHeader *header;
+  const char *paths;
+  const DirIndexDir *dirs;
+  const uint32_t *by_name;
+  const DirIndexTrigram *trigrams;
+  const uint32_t *postings;
+} DirIndex;
+
+// Background rebuild of index file
+typedef struct DirIndexUpdate {
+  pthread_t thread;
+  char index_path[PATH_MAX];
+  atomic_bool running;
+  // New index file is in place, reopen it
+  atomic_bool finished;
+} DirIndexUpdate;
+
+extern int DirIndex_open(DirIndex *index, const char *index_path);
+
+extern void DirIndex_close(DirIndex *index);
+
+static inline const char *DirIndex_path(const DirIndex *index, uint32_t id) {
+  return index->paths + index->dirs[id].path_offset;
+}
+
+// Find up to max_results directories matching query (case insensitive,
+// by basename, or by full path when query has '/'), best first.
+// Returns number of ids written to results
+extern unsigned int DirIndex_query(const DirIndex *index, const char *query, uint32_t *results,
+                                   unsigned int max_results);
+
+// Walk filesystem and write new index, reusing listings of directories
+// whose mtime didn't change since old index
+extern int DirIndex_build(const char *index_path);
+
+// Start DirIndex_build in background if index is missing or older than max_age_sec.
+// Thread is detached, a build cut short by exit leaves only a .tmp file behind
+extern void DirIndexUpdate_start(DirIndexUpdate *update, const char *index_path, long max_age_sec);
+
+#endif
@@ -13,4 +13,18 @@ typedef enum FileType {
   DIRECTORY   = 1 
 } FileType;
 
+typedef enum SortMode {
+  SORT_NAME      = 0,
+  // Digit runs compared as numbers: file2 < file10
+  SORT_NATURAL   = 1,
+  // Collation of LC_COLLATE locale
+  SORT_LOCALE    = 2,
+  // Biggest first
+  SORT_SIZE      = 3,
+  // Newest first
+  SORT_MTIME     = 4,
+  SORT_EXTENSION = 5,
+  SORT_MODES_COUNT
+} SortMode;
+
 #endif
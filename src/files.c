@@ -1,98 +1,716 @@
+#define _GNU_SOURCE
 #include "files.h"
+#include "sort.h"
+#include "config.h"
 #include "enums.h"
+#include "text.h"
+#include "perf.h"
+#include "trace.h"
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
 
-int compare_filenames(const void *a, const void *b) {
-  return strcmp(*(char **)a, *(char **)b);
+#define FILES_INITIAL_SIZE 64
+#define NAMES_INITIAL_SIZE 4096
+#define NAME_INDEX_MIN_SLOTS 16
+
+// Listings are filled from loader threads too
+static atomic_uint next_pool_id = 1;
+
+int compare_filenames(const void *a, const void *b, void *names) {
+  return strcmp((char *)names + ((const FileEntry *)a)->name_offset,
+                (char *)names + ((const FileEntry *)b)->name_offset);
 }
 
-extern void FilesArray_free(FilesArray *fa) {
-  if (fa->filenames == NULL) {
-    return;
+// Map readdir d_type to FileType.
+// Symlinks and unknown types have to be resolved with stat
+static int dtype_to_filetype(unsigned char d_type) {
+  switch (d_type) {
+  case DT_DIR:
+    return DIRECTORY;
+  case DT_LNK:
+  case DT_UNKNOWN:
+    return -1;
+  default:
+    return REGULAR;
   }
+}
 
-  for (int i = 0; i < fa->files_count; i++) {
-    free(fa->filenames[i]);
-  }
-  free(fa->filenames);
+extern void FilesArray_free(FilesArray *fa) {
+  free(fa->entries);
+  free(fa->names);
+  free(fa->wide);
+  fa->wide = NULL;
+  fa->wide_used = 0;
+  fa->wide_size = 0;
+  fa->pool_id = 0;
+  fa->sort = (FileSort){SORT_NAME, false};
+  free(fa->info);
+  fa->info = NULL;
+  fa->info_size = 0;
+  free(fa->index);
+  fa->index = NULL;
+  fa->index_mask = 0;
 
   fa->files_count = 0;
   fa->size = 0;
-  fa->filenames = NULL;
+  fa->entries = NULL;
+  fa->names = NULL;
+  fa->names_used = 0;
+  fa->names_size = 0;
+}
+
+// Append name to pool, returns its offset or -1
+static int64_t FilesArray_pool_add(FilesArray *fa, const char *name, size_t name_len) {
+  // Realloc if name pool too small.
+  // Offsets are 32 bit, so pool can't grow past 4GB
+  size_t needed = (size_t)fa->names_used + name_len + 1;
+  if (needed > UINT32_MAX) {
+    return -1;
+  }
+  if (needed > fa->names_size) {
+    size_t new_size = fa->names_size ? fa->names_size : NAMES_INITIAL_SIZE;
+    while (new_size < needed) {
+      new_size *= 2;
+    }
+    if (new_size > UINT32_MAX) {
+      new_size = UINT32_MAX;
+    }
+    char *new_names = realloc(fa->names, new_size);
+    if (new_names == NULL) {
+      return -1;
+    }
+    fa->names = new_names;
+    fa->names_size = new_size;
+  }
+
+  if (fa->names_used == 0) {
+    fa->pool_id = atomic_fetch_add(&next_pool_id, 1);
+  }
+  uint32_t offset = fa->names_used;
+  memcpy(fa->names + offset, name, name_len);
+  fa->names[offset + name_len] = '\0';
+  fa->names_used += name_len + 1;
+  return offset;
+}
+
+static void FilesArray_index_drop(FilesArray *fa) {
+  free(fa->index);
+  fa->index = NULL;
+  fa->index_mask = 0;
+}
+
+extern int FilesArray_push(FilesArray *fa, const char *name, size_t name_len, FileType type) {
+  // Appended entry would be missing from index
+  if (fa->index != NULL) {
+    FilesArray_index_drop(fa);
+  }
+
+  // Realloc if array too small
+  if (fa->files_count >= fa->size) {
+    size_t new_size = fa->size ? fa->size * 2 : FILES_INITIAL_SIZE;
+    FileEntry *new_entries = realloc(fa->entries, new_size * sizeof(FileEntry));
+    if (new_entries == NULL) {
+      return MALLOC_FAIL;
+    }
+    fa->entries = new_entries;
+    fa->size = new_size;
+  }
+
+  int64_t offset = FilesArray_pool_add(fa, name, name_len);
+  if (offset < 0) {
+    return MALLOC_FAIL;
+  }
+
+  FileEntry *file = &fa->entries[fa->files_count];
+  file->name_offset = offset;
+  file->name_len = name_len;
+  file->type = type;
+  file->flags = 0;
+  file->wide_offset = FILE_WIDE_UNSET;
+
+  fa->files_count += 1;
+  return SUCCESS;
+}
+
+extern FileInfo *FilesArray_info(FilesArray *fa, unsigned int index) {
+  if (index >= fa->files_count) {
+    return NULL;
+  }
+  if (index >= fa->info_size) {
+    // Listing may still be growing (loading), cover all of it
+    uint32_t new_size = fa->size > index ? fa->size : index + 1;
+    FileInfo *new_info = realloc(fa->info, new_size * sizeof(FileInfo));
+    if (new_info == NULL) {
+      return NULL;
+    }
+    memset(new_info + fa->info_size, 0, (new_size - fa->info_size) * sizeof(FileInfo));
+    fa->info = new_info;
+    fa->info_size = new_size;
+  }
+  return &fa->info[index];
+}
+
+// Info moved to other entries: requests in flight are matched by
+// position, so they will be dropped and must be made again
+static void FilesArray_info_forget_pending(FilesArray *fa) {
+  for (uint32_t i = 0; i < fa->info_size; i++) {
+    if (fa->info[i].state == FILE_INFO_PENDING) {
+      fa->info[i].state = FILE_INFO_NONE;
+    }
+  }
+}
+
+extern const wchar_t *FilesArray_wide_name(FilesArray *fa, unsigned int index, int *width, size_t *len) {
+  FileEntry *file = &fa->entries[index];
+  if (file->wide_offset == FILE_WIDE_UNSET) {
+    // Wide name is never longer than multibyte one
+    size_t needed = (size_t)fa->wide_used + file->name_len + 1;
+    if (needed > fa->wide_size) {
+      size_t new_size = fa->wide_size ? fa->wide_size : NAMES_INITIAL_SIZE;
+      while (new_size < needed) {
+        new_size *= 2;
+      }
+      wchar_t *new_wide = new_size <= UINT32_MAX ? realloc(fa->wide, new_size * sizeof(wchar_t)) : NULL;
+      if (new_wide == NULL) {
+        *width = 0;
+        *len = 0;
+        return L"";
+      }
+      fa->wide = new_wide;
+      fa->wide_size = new_size;
+    }
+
+    size_t wide_len;
+    int wide_width = wide_decode(fa->wide + fa->wide_used, FilesArray_name(fa, index),
+                                 file->name_len, &wide_len);
+    file->wide_offset = fa->wide_used;
+    file->wide_len = wide_len;
+    file->width = wide_width > UINT16_MAX ? UINT16_MAX : wide_width;
+    fa->wide_used += wide_len + 1;
+  }
+
+  *width = file->width;
+  *len = file->wide_len;
+  return fa->wide + file->wide_offset;
+}
+
+extern int FilesArray_repack(FilesArray *fa, size_t live_bytes) {
+  char *new_names = malloc(live_bytes ? live_bytes : 1);
+  if (new_names == NULL) {
+    return MALLOC_FAIL;
+  }
+  uint32_t offset = 0;
+  for (unsigned int i = 0; i < fa->files_count; i++) {
+    FileEntry *file = &fa->entries[i];
+    memcpy(new_names + offset, fa->names + file->name_offset, file->name_len + 1);
+    file->name_offset = offset;
+    offset += file->name_len + 1;
+  }
+  free(fa->names);
+  fa->names = new_names;
+  fa->names_used = offset;
+  fa->names_size = live_bytes ? live_bytes : 1;
+  fa->pool_id = atomic_fetch_add(&next_pool_id, 1);
+  return SUCCESS;
+}
+
+extern void FilesArray_sort(FilesArray *fa) {
+  // qsort if there is no memory for keys
+  if (FilesArray_sort_by(fa, -1, (FileSort){SORT_NAME, false}) != SUCCESS) {
+    qsort_r(fa->entries, fa->files_count, sizeof(FileEntry), compare_filenames, fa->names);
+    FilesArray_repack(fa, fa->names_used);
+    fa->sort = (FileSort){SORT_NAME, false};
+    FilesArray_index(fa);
+  }
+}
+
+// Hash of name bytes, 8 at a time
+static uint32_t name_hash(const char *name, size_t len) {
+  uint64_t hash = len * 0x9e3779b97f4a7c15ULL;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, name, 8);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+    name += 8;
+    len -= 8;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, name, len);
+  hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+  return hash ^ (hash >> 29);
+}
+
+extern int FilesArray_index(FilesArray *fa) {
+  FilesArray_index_drop(fa);
+  if (fa->files_count == 0) {
+    return SUCCESS;
+  }
+  // At most 2/3 of slots used, probes stay short
+  size_t slots = NAME_INDEX_MIN_SLOTS;
+  while (slots < (size_t)fa->files_count + fa->files_count / 2) {
+    slots *= 2;
+  }
+  if (slots > (size_t)UINT32_MAX + 1) {
+    return MALLOC_FAIL;
+  }
+  fa->index = calloc(slots, sizeof(uint32_t));
+  if (fa->index == NULL) {
+    return MALLOC_FAIL;
+  }
+  fa->index_mask = slots - 1;
+  for (unsigned int i = 0; i < fa->files_count; i++) {
+    const FileEntry *file = &fa->entries[i];
+    uint32_t slot = name_hash(fa->names + file->name_offset, file->name_len) & fa->index_mask;
+    while (fa->index[slot] != 0) {
+      slot = (slot + 1) & fa->index_mask;
+    }
+    fa->index[slot] = i + 1;
+  }
+  return SUCCESS;
+}
+
+extern int FilesArray_find(const FilesArray *fa, const char *name) {
+  if (fa->index == NULL) {
+    for (unsigned int i = 0; i < fa->files_count; i++) {
+      if (strcmp(name, FilesArray_name(fa, i)) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  size_t len = strlen(name);
+  uint32_t slot = name_hash(name, len) & fa->index_mask;
+  for (uint32_t position; (position = fa->index[slot]) != 0; slot = (slot + 1) & fa->index_mask) {
+    const FileEntry *file = &fa->entries[position - 1];
+    if (file->name_len == len && memcmp(fa->names + file->name_offset, name, len) == 0) {
+      return position - 1;
+    }
+  }
+  return -1;
+}
+
+// Entry patch puts into listing: op, position among old entries
+// and old index of entry it moves (recreated one may sort elsewhere), else -1
+typedef struct PatchInsert {
+  unsigned int op;
+  unsigned int pos;
+  int from;
+} PatchInsert;
+
+typedef struct PatchOrder {
+  const FilesArray *ops;
+  FileSort sort;
+  int dir_fd;
+} PatchOrder;
+
+// First old entry that doesn't sort before op, keys of log2(count) entries are made
+static unsigned int FilesArray_position(const FilesArray *fa, const PatchOrder *order, unsigned int op) {
+  const char *name = FilesArray_name(order->ops, op);
+  FileType type = order->ops->entries[op].type;
+  unsigned int low = 0, high = fa->files_count;
+  while (low < high) {
+    unsigned int mid = low + (high - low) / 2;
+    if (FileSort_compare(order->sort, order->dir_fd, FilesArray_name(fa, mid), fa->entries[mid].type, name, type) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Inserts by position, those at the same one in listing order
+static int compare_inserts(const void *a, const void *b, void *order_arg) {
+  const PatchOrder *order = order_arg;
+  const PatchInsert *insert_a = a, *insert_b = b;
+  if (insert_a->pos != insert_b->pos) {
+    return insert_a->pos < insert_b->pos ? -1 : 1;
+  }
+  const FileEntry *op_a = &order->ops->entries[insert_a->op];
+  const FileEntry *op_b = &order->ops->entries[insert_b->op];
+  return FileSort_compare(order->sort, order->dir_fd, FilesArray_name(order->ops, insert_a->op), op_a->type,
+                          FilesArray_name(order->ops, insert_b->op), op_b->type);
+}
+
+// Sort patch operations by name, keeping event order for the same name
+static int compare_patch_ops(const void *a, const void *b, void *ops_arg) {
+  const FilesArray *ops = ops_arg;
+  unsigned int index_a = *(const unsigned int *)a;
+  unsigned int index_b = *(const unsigned int *)b;
+  int cmp = strcmp(FilesArray_name(ops, index_a), FilesArray_name(ops, index_b));
+  if (cmp != 0) {
+    return cmp;
+  }
+  return index_a < index_b ? -1 : 1;
+}
+
+// Rebuild pool when most of it belongs to removed entries
+static int FilesArray_compact(FilesArray *fa, size_t live_bytes) {
+  if (fa->names_used < NAMES_INITIAL_SIZE || fa->names_used < live_bytes * 2) {
+    return SUCCESS;
+  }
+  if (FilesArray_repack(fa, live_bytes) != SUCCESS) {
+    return MALLOC_FAIL;
+  }
+
+  // Wide pool is only a cache, start it over with new offsets
+  for (unsigned int i = 0; i < fa->files_count; i++) {
+    fa->entries[i].wide_offset = FILE_WIDE_UNSET;
+  }
+  fa->wide_used = 0;
+  return SUCCESS;
+}
+
+extern int FilesArray_apply_patch(FilesArray *fa, const FilesArray *ops, int dir_fd, int *track,
+                                  unsigned int track_count) {
+  if (ops->files_count == 0) {
+    return SUCCESS;
+  }
+
+  // Net result per name: only last operation counts
+  unsigned int *order = malloc(ops->files_count * sizeof(unsigned int));
+  PatchInsert *inserts = malloc(ops->files_count * sizeof(PatchInsert));
+  if (order == NULL || inserts == NULL) {
+    free(order);
+    free(inserts);
+    return MALLOC_FAIL;
+  }
+  for (unsigned int i = 0; i < ops->files_count; i++) {
+    order[i] = i;
+  }
+  qsort_r(order, ops->files_count, sizeof(unsigned int), compare_patch_ops, (void *)ops);
+
+  PatchOrder patch_order = {ops, fa->sort, dir_fd};
+  bool numeric = fa->sort.mode == SORT_SIZE || fa->sort.mode == SORT_MTIME;
+  unsigned int inserts_count = 0;
+  unsigned int removed_count = 0;
+  for (unsigned int i = 0; i < ops->files_count; i++) {
+    unsigned int op_index = order[i];
+    const char *name = FilesArray_name(ops, op_index);
+    if (i + 1 < ops->files_count && strcmp(name, FilesArray_name(ops, order[i + 1])) == 0) {
+      continue;
+    }
+
+    const FileEntry *op = &ops->entries[op_index];
+    int pos = FilesArray_find(fa, name);
+    bool exists = pos >= 0 && !(fa->entries[pos].flags & FILE_FLAG_REMOVED);
+
+    if (op->flags & FILE_FLAG_REMOVED) {
+      if (exists) {
+        fa->entries[pos].flags |= FILE_FLAG_REMOVED;
+        removed_count++;
+      }
+      continue;
+    }
+    // Created again: new size and time, maybe other type
+    if (exists && (numeric || (fa->sort.dirs_first && fa->entries[pos].type != op->type))) {
+      fa->entries[pos].flags |= FILE_FLAG_REMOVED;
+      removed_count++;
+    } else if (exists) {
+      fa->entries[pos].type = op->type;
+      // Metadata is not the same
+      if ((uint32_t)pos < fa->info_size) {
+        fa->info[pos].state = FILE_INFO_NONE;
+      }
+      continue;
+    }
+    inserts[inserts_count++] = (PatchInsert){op_index, 0, exists ? pos : -1};
+  }
+  free(order);
+
+  // Only inserted entries get their place searched, listing keeps its order
+  for (unsigned int i = 0; i < inserts_count; i++) {
+    inserts[i].pos = FilesArray_position(fa, &patch_order, inserts[i].op);
+  }
+  qsort_r(inserts, inserts_count, sizeof(PatchInsert), compare_inserts, &patch_order);
+
+  // Merge surviving entries with inserted ones in a single pass
+  unsigned int new_count = fa->files_count - removed_count + inserts_count;
+  FileEntry *merged = malloc((new_count ? new_count : 1) * sizeof(FileEntry));
+  // Metadata moves with entries, inserted ones have none yet
+  FileInfo *merged_info = fa->info ? calloc(new_count ? new_count : 1, sizeof(FileInfo)) : NULL;
+  if (merged == NULL || (fa->info != NULL && merged_info == NULL)) {
+    free(merged);
+    free(merged_info);
+    free(inserts);
+    return MALLOC_FAIL;
+  }
+
+  int status = SUCCESS;
+  // New positions of tracked entries, -1 until passed.
+  // Moved entry is followed to its new place
+  int new_track[track_count ? track_count : 1];
+  int track_insert[track_count ? track_count : 1];
+  for (unsigned int t = 0; t < track_count; t++) {
+    new_track[t] = -1;
+    track_insert[t] = -1;
+    for (unsigned int i = 0; i < inserts_count && track[t] >= 0; i++) {
+      if (inserts[i].from == track[t]) {
+        track_insert[t] = i;
+      }
+    }
+  }
+  size_t live_bytes = 0;
+  unsigned int old_index = 0, insert_index = 0, out = 0;
+  while (old_index < fa->files_count || insert_index < inserts_count) {
+    bool take_insert = insert_index < inserts_count && inserts[insert_index].pos <= old_index;
+
+    if (!take_insert) {
+      FileEntry *file = &fa->entries[old_index];
+      for (unsigned int t = 0; t < track_count; t++) {
+        if ((int)old_index == track[t] && track_insert[t] < 0) {
+          new_track[t] = out;
+        }
+      }
+      old_index++;
+      if (file->flags & FILE_FLAG_REMOVED) {
+        continue;
+      }
+      if (merged_info != NULL && old_index - 1 < fa->info_size) {
+        merged_info[out] = fa->info[old_index - 1];
+      }
+      merged[out++] = *file;
+      live_bytes += file->name_len + 1;
+      continue;
+    }
+
+    for (unsigned int t = 0; t < track_count; t++) {
+      if (track_insert[t] == (int)insert_index) {
+        new_track[t] = out;
+      }
+    }
+    const FileEntry *op = &ops->entries[inserts[insert_index++].op];
+    int64_t offset = FilesArray_pool_add(fa, ops->names + op->name_offset, op->name_len);
+    if (offset < 0) {
+      status = MALLOC_FAIL;
+      continue;
+    }
+    merged[out] = *op;
+    merged[out].name_offset = offset;
+    merged[out].flags = 0;
+    merged[out].wide_offset = FILE_WIDE_UNSET;
+    live_bytes += op->name_len + 1;
+    out++;
+  }
+  free(inserts);
+
+  free(fa->entries);
+  fa->entries = merged;
+  fa->files_count = out;
+  fa->size = new_count ? new_count : 1;
+  if (merged_info != NULL) {
+    free(fa->info);
+    fa->info = merged_info;
+    fa->info_size = fa->size;
+    FilesArray_info_forget_pending(fa);
+  }
+  // Positions moved, lookups scan listing if there is no memory for new index
+  FilesArray_index(fa);
+
+  // Tracked entry removed: stay on the one which took its place
+  for (unsigned int t = 0; t < track_count; t++) {
+    if (track[t] < 0) {
+      continue;
+    }
+    if (new_track[t] >= (int)out) {
+      new_track[t] = out ? out - 1 : 0;
+    }
+    track[t] = new_track[t] >= 0 ? new_track[t] : 0;
+  }
+
+  if (status == SUCCESS) {
+    status = FilesArray_compact(fa, live_bytes);
+  }
+  return status;
+}
+
+extern int FilesArray_copy(FilesArray *dest, const FilesArray *src) {
+  FilesArray_free(dest);
+  if (src->entries == NULL || src->files_count == 0) {
+    return SUCCESS;
+  }
+
+  dest->entries = malloc(src->files_count * sizeof(FileEntry));
+  dest->names = malloc(src->names_used);
+  if (dest->entries == NULL || dest->names == NULL) {
+    FilesArray_free(dest);
+    return MALLOC_FAIL;
+  }
+  memcpy(dest->entries, src->entries, src->files_count * sizeof(FileEntry));
+  memcpy(dest->names, src->names, src->names_used);
+
+  // Already decoded wide names come along
+  if (src->wide_used > 0) {
+    dest->wide = malloc(src->wide_used * sizeof(wchar_t));
+    if (dest->wide == NULL) {
+      FilesArray_free(dest);
+      return MALLOC_FAIL;
+    }
+    wmemcpy(dest->wide, src->wide, src->wide_used);
+    dest->wide_used = src->wide_used;
+    dest->wide_size = src->wide_used;
+  }
+
+  dest->size = src->files_count;
+  dest->files_count = src->files_count;
+  dest->names_used = src->names_used;
+  dest->names_size = src->names_used;
+  dest->pool_id = src->pool_id;
+  dest->sort = src->sort;
+
+  // Same positions, index is valid as it is
+  if (src->index != NULL) {
+    dest->index = malloc(((size_t)src->index_mask + 1) * sizeof(uint32_t));
+    if (dest->index != NULL) {
+      memcpy(dest->index, src->index, ((size_t)src->index_mask + 1) * sizeof(uint32_t));
+      dest->index_mask = src->index_mask;
+    }
+  }
+
+  // Fetched metadata too, requests in flight match both by pool id
+  uint32_t info_size = src->info_size < src->files_count ? src->info_size : src->files_count;
+  if (info_size > 0) {
+    dest->info = malloc(info_size * sizeof(FileInfo));
+    if (dest->info != NULL) {
+      memcpy(dest->info, src->info, info_size * sizeof(FileInfo));
+      dest->info_size = info_size;
+    }
+  }
+  return SUCCESS;
+}
+
+extern size_t FilesArray_memory(const FilesArray *fa) {
+  return fa->size * sizeof(FileEntry) + fa->names_size + (size_t)fa->wide_size * sizeof(wchar_t) +
+         (size_t)fa->info_size * sizeof(FileInfo) + (fa->index ? ((size_t)fa->index_mask + 1) * sizeof(uint32_t) : 0);
+}
+
+extern int FilesArray_load(FilesArray *fa, const FileEntry *entries, unsigned int count, const char *names,
+                           uint32_t names_used, FileSort sort) {
+  memset(fa, 0, sizeof(*fa));
+  for (unsigned int i = 0; i < count; i++) {
+    const FileEntry *file = &entries[i];
+    if ((uint64_t)file->name_offset + file->name_len >= names_used ||
+        names[file->name_offset + file->name_len] != '\0') {
+      return ERROR;
+    }
+  }
+  fa->entries = malloc((count ? count : 1) * sizeof(FileEntry));
+  fa->names = malloc(names_used ? names_used : 1);
+  if (fa->entries == NULL || fa->names == NULL) {
+    FilesArray_free(fa);
+    return MALLOC_FAIL;
+  }
+  memcpy(fa->names, names, names_used);
+  for (unsigned int i = 0; i < count; i++) {
+    fa->entries[i] = entries[i];
+    fa->entries[i].flags = 0;
+    fa->entries[i].wide_offset = FILE_WIDE_UNSET;
+    fa->entries[i].wide_len = 0;
+  }
+  fa->size = count;
+  fa->files_count = count;
+  fa->names_used = names_used;
+  fa->names_size = names_used ? names_used : 1;
+  fa->pool_id = atomic_fetch_add(&next_pool_id, 1);
+  fa->sort = sort;
+  FilesArray_index(fa);
+  return SUCCESS;
+}
+
+extern int FilesArray_read_batch(FilesArray *fa, int dir_fd, char *buffer, size_t buffer_size, bool *eof) {
+  Perf_count(PERF_GETDENTS, 1);
+  ssize_t read_bytes = getdents64(dir_fd, buffer, buffer_size);
+  if (read_bytes < 0) {
+    return ERROR;
+  }
+  *eof = read_bytes == 0;
+
+  // Parse records straight from kernel buffer
+  for (ssize_t pos = 0; pos < read_bytes;) {
+    struct dirent64 *entry = (struct dirent64 *)(buffer + pos);
+    pos += entry->d_reclen;
+
+    const char *name = entry->d_name;
+    // Skip if filename = "." or ".."
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    // Take file type from directory entry itself,
+    // fstatat only if filesystem didn't report it (or it is a symlink)
+    int type = dtype_to_filetype(entry->d_type);
+    if (type < 0) {
+      struct stat file_stat;
+      Perf_count(PERF_STAT, 1);
+      if (fstatat(dir_fd, name, &file_stat, 0) == 0 && S_ISDIR(file_stat.st_mode)) {
+        type = DIRECTORY;
+      } else {
+        type = REGULAR;
+      }
+    }
+
+    int push_res = FilesArray_push(fa, name, strlen(name), type);
+    if (push_res != SUCCESS) {
+      return push_res;
+    }
+  }
+  return SUCCESS;
 }
 
 extern int FilesArray_fill(FilesArray *fa, char *pwd) {
-	if (fa->filenames != NULL) {
-	  FilesArray_free(fa);
+	FilesArray_free(fa);
+	uint64_t start = Perf_start();
+	uint64_t trace_start = Trace_start();
+
+	int dir_fd = open(pwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0) {
+	  return ERROR;
 	}
-  
-	fa->files_count = 0;
-	fa->size = 2;
-	fa->filenames = malloc(fa->size * sizeof(char *));
-	if (fa->filenames == NULL){
+
+	char *buffer = malloc(DIR_READ_BUFFER_SIZE);
+	if (buffer == NULL) {
+	  close(dir_fd);
 	  return MALLOC_FAIL;
 	}
-	memset(fa->filenames, 0, fa->size * sizeof(char *));
-  
-	DIR *dirp;
-	struct dirent *entry;
-	dirp = opendir(pwd);
-	if (dirp == NULL) {
-	  return ERROR;
-	}
-  
+
 	// Reading directory
-	while ((entry = readdir(dirp)) != NULL) {
-	  // Skip if filename = "." or ".."
-	  if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-		continue;
+	bool eof = false;
+	while (!eof) {
+	  int read_res = FilesArray_read_batch(fa, dir_fd, buffer, DIR_READ_BUFFER_SIZE, &eof);
+	  if (read_res != SUCCESS) {
+		free(buffer);
+		close(dir_fd);
+		return read_res;
 	  }
-  
-	  // Realloc if array too small
-	  if (fa->files_count >= fa->size) {
-		size_t old_size = fa->size;
-		fa->size *= 2;
-  
-		char **new_filenames = realloc(fa->filenames, fa->size * sizeof(char *));
-		if (new_filenames == NULL) {
-		  return MALLOC_FAIL;
-		}
-		// Initialize new reallocated empty space,
-		// So it won't point to garbage
-		memset(new_filenames + old_size, 0, (fa->size - old_size) * sizeof(char *));
-  
-		// Update array
-		fa->filenames = new_filenames;
-	  }
-  
-	  fa->filenames[fa->files_count] = strdup(entry->d_name);
-	  if (fa->filenames[fa->files_count] == NULL) {
-		return MALLOC_FAIL;
-	  }
-  
-	  fa->files_count += 1;
 	}
-  
+	free(buffer);
+	close(dir_fd);
+	Perf_done(&perf.fill_ns, start);
+	Trace_end("fill", trace_start, pwd);
+
 	// If after reading directory, last_index = 0
 	// Than directory is empty
 	if (fa->files_count == 0) {
 	  FilesArray_free(fa);
 	}
-  
+
 	// Sort filenames
-	qsort(fa->filenames, fa->files_count, sizeof(char *), compare_filenames);
-  
-	closedir(dirp);
+	FilesArray_sort(fa);
+
 	return SUCCESS;
 }
 
 extern FileType get_filetype(const char *path) {
 	struct stat file_stat;
+  Perf_count(PERF_STAT, 1);
   if (stat(path, &file_stat) < 0) {
     return -1;
   }
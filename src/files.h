@@ -5,25 +5,141 @@
 #include "enums.h"
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <wchar.h>
 
+// FileInfo.state
+#define FILE_INFO_NONE 0
+#define FILE_INFO_PENDING 1
+#define FILE_INFO_DONE 2
+#define FILE_INFO_FAILED 3
+
+// Metadata of entry for details view, fetched on demand (see meta.h)
 typedef struct FileInfo {
-  char *filename;
   off_t filesize;
+  int64_t mtime;
+  uint32_t mode;
+  uint32_t uid;
   bool is_regular;
-  int dirlen;
+  uint8_t state;
 } FileInfo;
 
 
 
+// FileEntry.flags
+#define FILE_FLAG_REMOVED 0x01
+
+// FileEntry.wide_offset of entry that was never displayed
+#define FILE_WIDE_UNSET UINT32_MAX
+
+// Directory entry with its type resolved once, at fill time,
+// so drawing and selecting never have to stat() it again.
+// Name lives in FilesArray.names pool at name_offset (NUL terminated),
+// its decoded wide form (made on first display) in FilesArray.wide
+typedef struct FileEntry {
+  uint32_t name_offset;
+  uint16_t name_len;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t wide_offset;
+  uint16_t wide_len;
+  // Display width in columns
+  uint16_t width;
+} FileEntry;
+
+// Order of listing, zero value is byte order of names
+typedef struct FileSort {
+  uint8_t mode;
+  bool dirs_first;
+} FileSort;
+
+static inline bool FileSort_equal(FileSort a, FileSort b) {
+  return a.mode == b.mode && a.dirs_first == b.dirs_first;
+}
+
+// Listing of one directory.
+// All names are packed into one pool, so filling costs a few reallocs
+// and freeing costs three free() calls, whatever the number of entries.
+//
+// Memory per entry: sizeof(FileEntry) (16 bytes) + name length + 1,
+// plus up to 2x of that as slack from doubling growth.
+// Displayed entries also keep (chars + 1) * sizeof(wchar_t) in wide pool,
+// and complete listings a name index of 6-12 bytes per entry.
+// e.g. 1M entries with 20 byte names: ~45 MB used, ~86 MB worst case
 typedef struct FilesArray {
-  char **filenames;
+  FileEntry *entries;
   size_t size;
   unsigned int files_count;
+  char *names;
+  uint32_t names_used;
+  uint32_t names_size;
+  wchar_t *wide;
+  uint32_t wide_used;
+  uint32_t wide_size;
+  // Changes whenever name offsets may start pointing to other names,
+  // copies share it (so caches keyed by name_offset stay valid for them)
+  unsigned int pool_id;
+  // How entries are ordered now
+  FileSort sort;
+  // Metadata parallel to entries, first info_size ones (NULL until asked for)
+  FileInfo *info;
+  uint32_t info_size;
+  // Open addressing hash of names: index_mask + 1 slots (power of two),
+  // each position + 1 of an entry or 0 if free, linear probing.
+  // NULL while listing is being filled, FilesArray_find scans it then
+  uint32_t *index;
+  uint32_t index_mask;
 } FilesArray;
 
+static inline const char *FilesArray_name(const FilesArray *fa, unsigned int index) {
+  return fa->names + fa->entries[index].name_offset;
+}
+
+// Wide name and its display width, decoded on first call
+extern const wchar_t *FilesArray_wide_name(FilesArray *fa, unsigned int index, int *width, size_t *len);
 
 extern int FilesArray_fill(FilesArray *fa, char *pwd);
 
+// Read one getdents64 batch of dir_fd into fa, unsorted.
+// Sets eof when directory has no more entries
+extern int FilesArray_read_batch(FilesArray *fa, int dir_fd, char *buffer, size_t buffer_size, bool *eof);
+
+extern int FilesArray_push(FilesArray *fa, const char *name, size_t name_len, FileType type);
+
+// Metadata slot of entry, NULL if there is no memory for it
+extern FileInfo *FilesArray_info(FilesArray *fa, unsigned int index);
+
+// Sort by name (see FilesArray_sort_by for other orders)
+extern void FilesArray_sort(FilesArray *fa);
+
+// Rewrite names pool in listing order, live_bytes: sum of (name_len + 1)
+extern int FilesArray_repack(FilesArray *fa, size_t live_bytes);
+
+// (Re)build name index for current order of entries.
+// Called by fill, sort, load and patch, push drops it
+extern int FilesArray_index(FilesArray *fa);
+
+// Index of file with given name, -1 if not found.
+// Constant time with name index, scan of whole listing without
+extern int FilesArray_find(const FilesArray *fa, const char *name);
+
+// Apply create/delete operations (ops entries, FILE_FLAG_REMOVED for deletes,
+// in the order they happened) to listing, keeping its order (fa->sort):
+// only created entries get sort keys, sizes and times read from dir_fd.
+// track: track_count indexes that should follow their entries (e.g highlights)
+extern int FilesArray_apply_patch(FilesArray *fa, const FilesArray *ops, int dir_fd, int *track,
+                                  unsigned int track_count);
+
+extern int FilesArray_copy(FilesArray *dest, const FilesArray *src);
+
+// Bytes allocated for listing (entries, names, wide names, metadata)
+extern size_t FilesArray_memory(const FilesArray *fa);
+
+// Listing from entries and names pool written out earlier (session snapshot),
+// ERROR if an entry points outside of names
+extern int FilesArray_load(FilesArray *fa, const FileEntry *entries, unsigned int count, const char *names,
+                           uint32_t names_used, FileSort sort);
+
 extern void FilesArray_free(FilesArray *fa);
 
 extern FileType get_filetype(const char *path);
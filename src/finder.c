@@ -0,0 +1,212 @@
+#include "finder.h"
+#include "enums.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline unsigned char to_lower(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned char to_upper(unsigned char c) {
+  return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// Position of first lower or upper in name[from, len), -1 if none.
+// readable: bytes from name that may be loaded (rest of pool),
+// lets SSE2 load whole 16 byte blocks past short names
+static inline int find_char(const char *name, int from, int len, long readable,
+                            unsigned char lower, unsigned char upper) {
+#if defined(__SSE2__)
+  __m128i lower_block = _mm_set1_epi8(lower);
+  __m128i upper_block = _mm_set1_epi8(upper);
+  while (from < len && from + 16 <= readable) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(name + from));
+    unsigned int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(block, lower_block), _mm_cmpeq_epi8(block, upper_block)));
+    if (mask != 0) {
+      int pos = from + __builtin_ctz(mask);
+      return pos < len ? pos : -1;
+    }
+    from += 16;
+  }
+#endif
+  for (int i = from; i < len; i++) {
+    unsigned char c = name[i];
+    if (c == lower || c == upper) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static inline bool is_word_start(const char *name, int pos) {
+  if (pos == 0) {
+    return true;
+  }
+  unsigned char prev = name[pos - 1], c = name[pos];
+  return prev == '_' || prev == '-' || prev == '.' || prev == ' ' ||
+         (prev >= 'a' && prev <= 'z' && c >= 'A' && c <= 'Z');
+}
+
+// Score of query char matched at pos, after previous one matched at prev (-1: first char).
+// Prefix, word starts and consecutive chars go up, gaps go down
+static inline int match_score(const char *name, int pos, int prev) {
+  int score = 0;
+  if (pos == 0) {
+    score += 16;
+  } else if (is_word_start(name, pos)) {
+    score += 8;
+  }
+  if (prev >= 0) {
+    int gap = pos - prev - 1;
+    score += gap == 0 ? 6 : -(gap < 8 ? gap : 8);
+  }
+  return score;
+}
+
+extern void Finder_init(Finder *finder, const FilesArray *files) {
+  memset(finder, 0, sizeof(*finder));
+  finder->files = files;
+}
+
+static void Finder_drop_levels(Finder *finder, size_t from) {
+  for (size_t i = from; i < finder->query_len; i++) {
+    free(finder->levels[i].matches);
+    finder->levels[i].matches = NULL;
+    finder->levels[i].count = 0;
+  }
+}
+
+// Matches of query[0..level] from matches of query[0..level - 1]:
+// leftmost match of each char is enough to tell if subsequence exists,
+// so only char query[level] is searched, after where previous one matched
+static int Finder_narrow(Finder *finder, size_t level, unsigned char query_char) {
+  const FilesArray *files = finder->files;
+  const FinderLevel *source = level > 0 ? &finder->levels[level - 1] : NULL;
+  uint32_t source_count = source ? source->count : files->files_count;
+
+  FinderLevel *dest = &finder->levels[level];
+  dest->matches = malloc((source_count ? source_count : 1) * sizeof(FinderMatch));
+  dest->count = 0;
+  if (dest->matches == NULL) {
+    return MALLOC_FAIL;
+  }
+
+  unsigned char lower = to_lower(query_char), upper = to_upper(query_char);
+  for (uint32_t s = 0; s < source_count; s++) {
+    FinderMatch match = source ? source->matches[s] : (FinderMatch){s, 0, 0};
+    const FileEntry *entry = &files->entries[match.index];
+    if (entry->flags & FILE_FLAG_REMOVED) {
+      continue;
+    }
+    const char *name = files->names + entry->name_offset;
+    int pos = find_char(name, match.next, entry->name_len, (long)files->names_size - entry->name_offset,
+                        lower, upper);
+    if (pos < 0) {
+      continue;
+    }
+    match.score += match_score(name, pos, source ? match.next - 1 : -1);
+    match.next = pos + 1;
+    dest->matches[dest->count++] = match;
+  }
+  return SUCCESS;
+}
+
+// Order matches of whole query by key (lower is better),
+// ties stay in listing order: two stable 8 bit counting passes
+static int Finder_rank(Finder *finder) {
+  const FilesArray *files = finder->files;
+  const FinderLevel *level = &finder->levels[finder->query_len - 1];
+  uint32_t count = level->count;
+
+  if (count > finder->ranked_size) {
+    uint32_t *new_ranked = realloc(finder->ranked, count * 2 * sizeof(uint32_t));
+    if (new_ranked != NULL) {
+      finder->ranked = new_ranked;
+    }
+    uint16_t *new_keys = realloc(finder->keys, count * 2 * sizeof(uint16_t));
+    if (new_keys != NULL) {
+      finder->keys = new_keys;
+    }
+    if (new_ranked == NULL || new_keys == NULL) {
+      return MALLOC_FAIL;
+    }
+    finder->ranked_size = count;
+  }
+
+  // First half of arrays is result, second half is scratch
+  uint32_t *ranked = finder->ranked, *ranked_tmp = finder->ranked + count;
+  uint16_t *keys = finder->keys, *keys_tmp = finder->keys + count;
+  for (uint32_t i = 0; i < count; i++) {
+    const FinderMatch *match = &level->matches[i];
+    int name_len = files->entries[match->index].name_len;
+    // Whole name typed, short names first
+    int score = match->score + ((size_t)name_len == finder->query_len ? 32 : 0) - name_len / 8;
+    int key = 32768 - score;
+    ranked[i] = match->index;
+    keys[i] = key < 0 ? 0 : key > UINT16_MAX ? UINT16_MAX : key;
+  }
+
+  for (int shift = 0; shift < 16; shift += 8) {
+    uint32_t offsets[257] = {0};
+    for (uint32_t i = 0; i < count; i++) {
+      offsets[((keys[i] >> shift) & 0xff) + 1]++;
+    }
+    // All keys in one bucket, pass wouldn't move anything
+    if (count > 0 && offsets[((keys[0] >> shift) & 0xff) + 1] == count) {
+      continue;
+    }
+    for (int b = 0; b < 256; b++) {
+      offsets[b + 1] += offsets[b];
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t dest = offsets[(keys[i] >> shift) & 0xff]++;
+      ranked_tmp[dest] = ranked[i];
+      keys_tmp[dest] = keys[i];
+    }
+    memcpy(ranked, ranked_tmp, count * sizeof(uint32_t));
+    memcpy(keys, keys_tmp, count * sizeof(uint16_t));
+  }
+  finder->ranked_count = count;
+  return SUCCESS;
+}
+
+extern int Finder_search(Finder *finder, const char *query) {
+  size_t query_len = strnlen(query, NAME_MAX);
+
+  // Levels of common prefix with previous query are still valid
+  size_t common = 0;
+  while (common < query_len && common < finder->query_len && query[common] == finder->query[common]) {
+    common++;
+  }
+  Finder_drop_levels(finder, common);
+  finder->query_len = common;
+  memcpy(finder->query, query, query_len);
+  finder->query[query_len] = '\0';
+
+  for (size_t level = common; level < query_len; level++) {
+    if (Finder_narrow(finder, level, query[level]) != SUCCESS) {
+      free(finder->levels[level].matches);
+      finder->levels[level].matches = NULL;
+      return MALLOC_FAIL;
+    }
+    finder->query_len = level + 1;
+  }
+
+  if (query_len == 0) {
+    finder->ranked_count = 0;
+    return SUCCESS;
+  }
+  return Finder_rank(finder);
+}
+
+extern void Finder_free(Finder *finder) {
+  Finder_drop_levels(finder, 0);
+  free(finder->ranked);
+  free(finder->keys);
+  memset(finder, 0, sizeof(*finder));
+}
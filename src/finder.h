@@ -0,0 +1,54 @@
+#ifndef FINDER_H
+#define FINDER_H
+
+#include "files.h"
+#include <linux/limits.h>
+#include <stdint.h>
+
+// Name matching query prefix, with where its match ended
+// (next char is searched from there) and score so far
+typedef struct FinderMatch {
+  uint32_t index;
+  uint16_t next;
+  int16_t score;
+} FinderMatch;
+
+// Matches of query prefix of one length, in listing order
+typedef struct FinderLevel {
+  FinderMatch *matches;
+  uint32_t count;
+} FinderLevel;
+
+// Incremental fuzzy filter over a listing ("ff").
+// Name matches when it contains query chars in order (ASCII case ignored).
+// Every typed char only searches matches of the query before it,
+// deleting a char goes back to the kept matches of the shorter query
+typedef struct Finder {
+  const FilesArray *files;
+  char query[NAME_MAX + 1];
+  size_t query_len;
+  // levels[i]: matches of first i + 1 query chars
+  FinderLevel levels[NAME_MAX];
+  // Matches of whole query, best first
+  uint32_t *ranked;
+  uint32_t ranked_count;
+  uint32_t ranked_size;
+  uint16_t *keys;
+} Finder;
+
+extern void Finder_init(Finder *finder, const FilesArray *files);
+
+extern int Finder_search(Finder *finder, const char *query);
+
+static inline uint32_t Finder_count(const Finder *finder) {
+  return finder->query_len == 0 ? finder->files->files_count : finder->ranked_count;
+}
+
+// Listing index of result
+static inline uint32_t Finder_result(const Finder *finder, uint32_t index) {
+  return finder->query_len == 0 ? index : finder->ranked[index];
+}
+
+extern void Finder_free(Finder *finder);
+
+#endif
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include "frecency.h"
+#include "config.h"
+#include "enums.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOUR_SEC 3600
+#define DAY_SEC (24 * HOUR_SEC)
+#define WEEK_SEC (7 * DAY_SEC)
+
+static inline unsigned char lower(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int compare_path(const char *a, size_t a_len, const char *b, size_t b_len) {
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+static double frecency_score(double rank, int64_t last_visit, int64_t now) {
+  int64_t age = now - last_visit;
+  if (age < HOUR_SEC) {
+    return rank * 4;
+  }
+  if (age < DAY_SEC) {
+    return rank * 2;
+  }
+  if (age < WEEK_SEC) {
+    return rank / 2;
+  }
+  return rank / 4;
+}
+
+// ---- Table ----
+
+static void Frecency_unmap(Frecency *frecency) {
+  if (frecency->map != NULL) {
+    munmap(frecency->map, frecency->map_size);
+  }
+  frecency->map = NULL;
+  frecency->map_size = 0;
+  frecency->header = NULL;
+  frecency->paths = NULL;
+  frecency->entries = NULL;
+}
+
+// Missing or broken table is the same as an empty one
+static void Frecency_map(Frecency *frecency) {
+  Frecency_unmap(frecency);
+  int fd = open(frecency->table_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0 || (size_t)file_stat.st_size < sizeof(FrecencyHeader)) {
+    close(fd);
+    return;
+  }
+  void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return;
+  }
+  const FrecencyHeader *header = map;
+  uint64_t size = file_stat.st_size;
+  bool valid = memcmp(header->magic, FRECENCY_MAGIC, 4) == 0 && header->version == FRECENCY_VERSION &&
+               header->paths_offset <= header->entries_offset && header->entries_offset % 8 == 0 &&
+               header->entries_offset <= size &&
+               (uint64_t)header->count <= (size - header->entries_offset) / sizeof(FrecencyEntry);
+  // Every path inside paths region and NUL terminated, results use them as strings
+  const char *paths = (const char *)map + header->paths_offset;
+  const FrecencyEntry *entries = (const FrecencyEntry *)((const char *)map + header->entries_offset);
+  uint64_t paths_size = header->entries_offset - header->paths_offset;
+  for (uint32_t i = 0; valid && i < header->count; i++) {
+    const FrecencyEntry *entry = &entries[i];
+    valid = entry->path_len > 0 && entry->path_offset < paths_size &&
+            entry->path_len < paths_size - entry->path_offset &&
+            paths[entry->path_offset + entry->path_len] == '\0';
+  }
+  if (!valid) {
+    munmap(map, file_stat.st_size);
+    return;
+  }
+  frecency->map = map;
+  frecency->map_size = file_stat.st_size;
+  frecency->header = header;
+  frecency->paths = paths;
+  frecency->entries = entries;
+}
+
+static unsigned int Frecency_count(const Frecency *frecency) {
+  return frecency->header ? frecency->header->count : 0;
+}
+
+// ---- Log ----
+
+static void Frecency_clear_visits(Frecency *frecency) {
+  for (unsigned int i = 0; i < frecency->visits_count; i++) {
+    free(frecency->visits[i].path);
+  }
+  frecency->visits_count = 0;
+  frecency->log_records = 0;
+}
+
+static int Frecency_add_visit(Frecency *frecency, const char *path, size_t path_len, int64_t time) {
+  // Binary search in visits sorted by path
+  unsigned int low = 0, high = frecency->visits_count;
+  while (low < high) {
+    unsigned int mid = low + (high - low) / 2;
+    FrecencyVisit *visit = &frecency->visits[mid];
+    if (compare_path(visit->path, visit->path_len, path, path_len) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  FrecencyVisit *visit = &frecency->visits[low];
+  if (low < frecency->visits_count && compare_path(visit->path, visit->path_len, path, path_len) == 0) {
+    visit->visits++;
+    visit->last_visit = time > visit->last_visit ? time : visit->last_visit;
+    return SUCCESS;
+  }
+
+  if (frecency->visits_count == frecency->visits_size) {
+    unsigned int new_size = frecency->visits_size ? frecency->visits_size * 2 : 64;
+    FrecencyVisit *new_visits = realloc(frecency->visits, new_size * sizeof(FrecencyVisit));
+    if (new_visits == NULL) {
+      return MALLOC_FAIL;
+    }
+    frecency->visits = new_visits;
+    frecency->visits_size = new_size;
+  }
+  char *path_copy = malloc(path_len + 1);
+  if (path_copy == NULL) {
+    return MALLOC_FAIL;
+  }
+  memcpy(path_copy, path, path_len);
+  path_copy[path_len] = '\0';
+
+  visit = &frecency->visits[low];
+  memmove(visit + 1, visit, (frecency->visits_count - low) * sizeof(FrecencyVisit));
+  *visit = (FrecencyVisit){path_copy, path_len, 1, time};
+  frecency->visits_count++;
+  return SUCCESS;
+}
+
+// Load all visits of log file (it is the source of truth for them,
+// other tf instances append to it too)
+static void Frecency_read_log(Frecency *frecency) {
+  Frecency_clear_visits(frecency);
+  struct stat log_stat;
+  if (fstat(frecency->log_fd, &log_stat) < 0 || log_stat.st_size == 0) {
+    return;
+  }
+  char *log = malloc(log_stat.st_size);
+  if (log == NULL) {
+    return;
+  }
+  ssize_t log_size = pread(frecency->log_fd, log, log_stat.st_size, 0);
+  for (ssize_t pos = 0; pos + (ssize_t)sizeof(FrecencyLogRecord) <= log_size;) {
+    FrecencyLogRecord record;
+    memcpy(&record, log + pos, sizeof(record));
+    pos += sizeof(record);
+    // Torn record at the end (crash while appending)
+    if (record.path_len == 0 || record.path_len >= PATH_MAX || pos + record.path_len > log_size) {
+      break;
+    }
+    Frecency_add_visit(frecency, log + pos, record.path_len, record.time);
+    frecency->log_records++;
+    pos += record.path_len;
+  }
+  free(log);
+}
+
+// ---- Public ----
+
+extern int Frecency_open(Frecency *frecency, const char *data_dir) {
+  memset(frecency, 0, sizeof(*frecency));
+  snprintf(frecency->table_path, PATH_MAX, "%s/frecency", data_dir);
+  snprintf(frecency->log_path, PATH_MAX, "%s/frecency.log", data_dir);
+  frecency->log_fd = open(frecency->log_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (frecency->log_fd < 0) {
+    return ERROR;
+  }
+  Frecency_map(frecency);
+  Frecency_read_log(frecency);
+  return SUCCESS;
+}
+
+extern int Frecency_add(Frecency *frecency, const char *path) {
+  if (frecency->log_fd < 0) {
+    return ERROR;
+  }
+  size_t path_len = strlen(path);
+  if (path_len == 0 || path_len >= PATH_MAX) {
+    return ERROR;
+  }
+
+  // One append, record and path together, so concurrent writers don't mix
+  char record[sizeof(FrecencyLogRecord) + PATH_MAX];
+  FrecencyLogRecord header = {.time = time(NULL), .path_len = path_len};
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), path, path_len);
+  // Shared lock: appends of several instances go together, but not while
+  // one of them compacts (between its read of log and truncating it)
+  if (flock(frecency->log_fd, LOCK_SH) < 0) {
+    return ERROR;
+  }
+  ssize_t written = write(frecency->log_fd, record, sizeof(header) + path_len);
+  flock(frecency->log_fd, LOCK_UN);
+  if (written < 0) {
+    return ERROR;
+  }
+
+  int status = Frecency_add_visit(frecency, path, path_len, header.time);
+  frecency->log_records++;
+  if (frecency->log_records >= FRECENCY_LOG_MAX) {
+    status = Frecency_compact(frecency);
+  }
+  return status;
+}
+
+// Terms of query in order in path, last one in its last component
+static bool Frecency_match(const char *path, size_t path_len, const char *query) {
+  const char *last_component = memrchr(path, '/', path_len);
+  last_component = last_component ? last_component + 1 : path;
+
+  size_t pos = 0;
+  const char *term = query;
+  while (true) {
+    while (*term == ' ') {
+      term++;
+    }
+    if (*term == '\0') {
+      return true;
+    }
+    size_t term_len = strcspn(term, " ");
+    bool is_last = term[term_len] == '\0' || term[term_len + strspn(term + term_len, " ")] == '\0';
+
+    bool found = false;
+    for (; pos + term_len <= path_len; pos++) {
+      size_t i = 0;
+      while (i < term_len && lower(path[pos + i]) == lower(term[i])) {
+        i++;
+      }
+      if (i == term_len && (!is_last || path + pos >= last_component)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+    pos += term_len;
+    term += term_len;
+  }
+}
+
+static int compare_results(const void *a, const void *b) {
+  const FrecencyResult *ra = a, *rb = b;
+  if (ra->score != rb->score) {
+    return ra->score > rb->score ? -1 : 1;
+  }
+  return strcmp(ra->path, rb->path);
+}
+
+extern unsigned int Frecency_query(Frecency *frecency, const char *query, FrecencyResult *results,
+                                   unsigned int max_results) {
+  unsigned int table_count = Frecency_count(frecency);
+  size_t all_size = table_count + frecency->visits_count;
+  FrecencyResult *all = malloc((all_size ? all_size : 1) * sizeof(FrecencyResult));
+  if (all == NULL) {
+    return 0;
+  }
+  int64_t now = time(NULL);
+  unsigned int count = 0;
+
+  // Table and visits are both sorted by path: merge them
+  unsigned int t = 0, v = 0;
+  while (t < table_count || v < frecency->visits_count) {
+    const FrecencyEntry *entry = t < table_count ? &frecency->entries[t] : NULL;
+    const FrecencyVisit *visit = v < frecency->visits_count ? &frecency->visits[v] : NULL;
+    const char *entry_path = entry ? frecency->paths + entry->path_offset : NULL;
+    int cmp = !entry ? 1 : !visit ? -1 : compare_path(entry_path, entry->path_len, visit->path, visit->path_len);
+
+    const char *path;
+    size_t path_len;
+    double rank = 0;
+    int64_t last_visit = 0;
+    if (cmp <= 0) {
+      path = entry_path;
+      path_len = entry->path_len;
+      rank += entry->rank;
+      last_visit = entry->last_visit;
+      t++;
+    }
+    if (cmp >= 0) {
+      path = visit->path;
+      path_len = visit->path_len;
+      rank += visit->visits;
+      last_visit = visit->last_visit > last_visit ? visit->last_visit : last_visit;
+      v++;
+    }
+    if (Frecency_match(path, path_len, query)) {
+      all[count++] = (FrecencyResult){path, frecency_score(rank, last_visit, now)};
+    }
+  }
+
+  qsort(all, count, sizeof(FrecencyResult), compare_results);
+  unsigned int results_count = count < max_results ? count : max_results;
+  memcpy(results, all, results_count * sizeof(FrecencyResult));
+  free(all);
+  return results_count;
+}
+
+extern int Frecency_compact(Frecency *frecency) {
+  if (frecency->log_fd < 0 || flock(frecency->log_fd, LOCK_EX) < 0) {
+    return ERROR;
+  }
+  // Another instance may have compacted or appended meanwhile
+  Frecency_map(frecency);
+  Frecency_read_log(frecency);
+
+  unsigned int table_count = Frecency_count(frecency);
+  size_t max_count = table_count + frecency->visits_count;
+  FrecencyEntry *entries = malloc((max_count ? max_count : 1) * sizeof(FrecencyEntry));
+  if (entries == NULL) {
+    flock(frecency->log_fd, LOCK_UN);
+    return MALLOC_FAIL;
+  }
+
+  // Merge, keeping pointers to paths until they are written
+  const char **paths = malloc((max_count ? max_count : 1) * sizeof(char *));
+  if (paths == NULL) {
+    free(entries);
+    flock(frecency->log_fd, LOCK_UN);
+    return MALLOC_FAIL;
+  }
+  unsigned int count = 0, t = 0, v = 0;
+  double total_rank = 0;
+  while (t < table_count || v < frecency->visits_count) {
+    const FrecencyEntry *entry = t < table_count ? &frecency->entries[t] : NULL;
+    const FrecencyVisit *visit = v < frecency->visits_count ? &frecency->visits[v] : NULL;
+    int cmp = !entry ? 1 : !visit ? -1 : compare_path(frecency->paths + entry->path_offset, entry->path_len,
+                                                     visit->path, visit->path_len);
+    FrecencyEntry *merged = &entries[count];
+    memset(merged, 0, sizeof(*merged));
+    if (cmp <= 0) {
+      paths[count] = frecency->paths + entry->path_offset;
+      merged->path_len = entry->path_len;
+      merged->rank = entry->rank;
+      merged->last_visit = entry->last_visit;
+      t++;
+    }
+    if (cmp >= 0) {
+      paths[count] = visit->path;
+      merged->path_len = visit->path_len;
+      merged->rank += visit->visits;
+      merged->last_visit = visit->last_visit > merged->last_visit ? visit->last_visit : merged->last_visit;
+      v++;
+    }
+    total_rank += merged->rank;
+    count++;
+  }
+
+  // Aging: old ranks fade, directories not visited for long drop out
+  double factor = total_rank > FRECENCY_RANK_TOTAL_MAX ? 0.9 * FRECENCY_RANK_TOTAL_MAX / total_rank : 1;
+  uint64_t paths_size = 0;
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    entries[i].rank *= factor;
+    if (entries[i].rank < 1 && factor < 1) {
+      continue;
+    }
+    entries[kept] = entries[i];
+    paths[kept] = paths[i];
+    entries[kept].path_offset = paths_size;
+    paths_size += entries[kept].path_len + 1;
+    kept++;
+  }
+
+  FrecencyHeader header = {.version = FRECENCY_VERSION, .count = kept};
+  memcpy(header.magic, FRECENCY_MAGIC, 4);
+  header.paths_offset = sizeof(header);
+  header.entries_offset = (header.paths_offset + paths_size + 7) & ~(uint64_t)7;
+
+  char tmp_path[PATH_MAX + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", frecency->table_path);
+  FILE *file = fopen(tmp_path, "wb");
+  bool ok = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1;
+  for (unsigned int i = 0; ok && i < kept; i++) {
+    ok = fwrite(paths[i], 1, entries[i].path_len + 1, file) == entries[i].path_len + 1;
+  }
+  static const char zeros[8] = {0};
+  size_t padding = header.entries_offset - header.paths_offset - paths_size;
+  ok = ok && (padding == 0 || fwrite(zeros, 1, padding, file) == padding);
+  ok = ok && (kept == 0 || fwrite(entries, sizeof(FrecencyEntry), kept, file) == kept);
+  if (file != NULL && fclose(file) != 0) {
+    ok = false;
+  }
+  free(entries);
+  free(paths);
+
+  int status = ERROR;
+  // Log is emptied only once its visits are in new table
+  if (ok && rename(tmp_path, frecency->table_path) == 0) {
+    if (ftruncate(frecency->log_fd, 0) == 0) {
+      Frecency_clear_visits(frecency);
+    }
+    status = SUCCESS;
+  } else {
+    unlink(tmp_path);
+  }
+  Frecency_map(frecency);
+  flock(frecency->log_fd, LOCK_UN);
+  return status;
+}
+
+extern void Frecency_close(Frecency *frecency) {
+  if (frecency->log_fd >= 0 && frecency->log_records > 0) {
+    Frecency_compact(frecency);
+  }
+  if (frecency->log_fd >= 0) {
+    close(frecency->log_fd);
+  }
+  Frecency_clear_visits(frecency);
+  free(frecency->visits);
+  Frecency_unmap(frecency);
+  frecency->log_fd = -1;
+  frecency->visits = NULL;
+  frecency->visits_size = 0;
+}
@@ -0,0 +1,88 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Visited directories ranked by frequency and recency, for jumping.
+//
+// Two files in data dir:
+//   frecency      sorted table, mmap'd as is (no parsing at startup):
+//                 FrecencyHeader, paths, FrecencyEntry[count] sorted by path
+//   frecency.log  binary visit records appended since last compaction
+//                 (one write() per visit)
+// Log is merged into table when it grows past FRECENCY_LOG_MAX and on exit
+#define FRECENCY_MAGIC "TFFR"
+#define FRECENCY_VERSION 1
+
+typedef struct FrecencyHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+  uint64_t paths_offset;
+  uint64_t entries_offset;
+} FrecencyHeader;
+
+typedef struct FrecencyEntry {
+  int64_t last_visit;
+  double rank;
+  uint64_t path_offset;
+  uint32_t path_len;
+  uint32_t reserved;
+} FrecencyEntry;
+
+typedef struct FrecencyLogRecord {
+  int64_t time;
+  uint32_t path_len;
+  // path follows, not NUL terminated
+} FrecencyLogRecord;
+
+// Visits from log, sorted by path
+typedef struct FrecencyVisit {
+  char *path;
+  uint32_t path_len;
+  uint32_t visits;
+  int64_t last_visit;
+} FrecencyVisit;
+
+typedef struct Frecency {
+  char table_path[PATH_MAX];
+  char log_path[PATH_MAX];
+  int log_fd;
+  void *map;
+  size_t map_size;
+  const FrecencyHeader *header;
+  const char *paths;
+  const FrecencyEntry *entries;
+  FrecencyVisit *visits;
+  unsigned int visits_count;
+  unsigned int visits_size;
+  // Records in log file
+  unsigned int log_records;
+} Frecency;
+
+typedef struct FrecencyResult {
+  const char *path;
+  double score;
+} FrecencyResult;
+
+extern int Frecency_open(Frecency *frecency, const char *data_dir);
+
+// Record visit of directory (absolute path)
+extern int Frecency_add(Frecency *frecency, const char *path);
+
+// Directories matching query best first: space separated terms must appear
+// in path in order (ASCII case ignored), last one in its last component.
+// Result paths are valid until next Frecency_add
+extern unsigned int Frecency_query(Frecency *frecency, const char *query, FrecencyResult *results,
+                                   unsigned int max_results);
+
+// Merge log into table
+extern int Frecency_compact(Frecency *frecency);
+
+// Compacts pending visits
+extern void Frecency_close(Frecency *frecency);
+
+#endif
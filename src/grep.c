@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include "grep.h"
+#include "enums.h"
+#include "walker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Rough frequency of byte in source code and text, higher is more common
+static int byte_rank(unsigned char c) {
+  if (c == ' ' || c == '\t' || c == '\n') {
+    return 255;
+  }
+  if (c != '\0' && strchr("etaoinsrlcdu", c) != NULL) {
+    return 200;
+  }
+  if (c >= 'a' && c <= 'z') {
+    return 150;
+  }
+  if (c != '\0' && strchr("_()*;,.=-{}/\"", c) != NULL) {
+    return 120;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return 100;
+  }
+  if (c >= '0' && c <= '9') {
+    return 90;
+  }
+  return c < 0x80 ? 60 : 30;
+}
+
+// Next occurrence of literal pattern in [pos, end), NULL if none.
+// memchr (vectorized in libc) skips to candidates by the rarest
+// pattern byte, so common first bytes don't stop it every few bytes
+static const char *Grep_find_literal(const Grep *grep, const char *pos, const char *end) {
+  size_t len = grep->pattern_len;
+  size_t rare = grep->rare_offset;
+  unsigned char rare_byte = grep->pattern[rare];
+  const char *scan = pos + rare;
+  while (scan < end) {
+    const char *candidate = memchr(scan, rare_byte, end - scan);
+    if (candidate == NULL) {
+      return NULL;
+    }
+    const char *start = candidate - rare;
+    if (start + len > end) {
+      return NULL;
+    }
+    if (memcmp(start, grep->pattern, len) == 0) {
+      return start;
+    }
+    scan = candidate + 1;
+  }
+  return NULL;
+}
+
+// pos is always at start of a line
+static const char *Grep_find_regex(const Grep *grep, const char *pos, const char *end) {
+  regmatch_t match = {.rm_so = 0, .rm_eo = end - pos};
+  if (regexec(&grep->regex, pos, 1, &match, REG_STARTEND) != 0) {
+    return NULL;
+  }
+  return pos + match.rm_so;
+}
+
+static unsigned int count_lines(const char *pos, const char *end) {
+  unsigned int count = 0;
+  while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+    count++;
+    pos++;
+  }
+  return count;
+}
+
+static void Grep_flush(Grep *grep, GrepThread *thread) {
+  GrepBatch *batch = thread->batch;
+  if (batch == NULL || batch->count == 0) {
+    return;
+  }
+  thread->batch = NULL;
+  batch->next = NULL;
+  pthread_mutex_lock(&grep->lock);
+  if (grep->found_tail != NULL) {
+    grep->found_tail->next = batch;
+  } else {
+    grep->found_head = batch;
+  }
+  grep->found_tail = batch;
+  pthread_mutex_unlock(&grep->lock);
+}
+
+// Add "path:line: content" of hit to thread batch
+static void Grep_add_hit(Grep *grep, GrepThread *thread, const char *path, size_t path_len, unsigned int line,
+                         const char *text, const char *text_end) {
+  while (text < text_end && (*text == ' ' || *text == '\t')) {
+    text++;
+  }
+  size_t text_len = text_end - text;
+  if (text_len > GREP_LINE_MAX) {
+    text_len = GREP_LINE_MAX;
+  }
+  if (path_len > UINT16_MAX) {
+    return;
+  }
+  size_t need = path_len + 16 + text_len + 1;
+  GrepBatch *batch = thread->batch;
+  if (batch != NULL && (batch->count == GREP_BATCH_HITS || batch->used + need > sizeof(batch->text))) {
+    Grep_flush(grep, thread);
+    batch = NULL;
+  }
+  if (batch == NULL) {
+    if (need > sizeof(batch->text) || (batch = malloc(sizeof(GrepBatch))) == NULL) {
+      return;
+    }
+    batch->count = 0;
+    batch->used = 0;
+    thread->batch = batch;
+  }
+
+  char *dest = batch->text + batch->used;
+  int prefix_len = snprintf(dest, need, "%.*s:%u: ", (int)path_len, path, line);
+  memcpy(dest + prefix_len, text, text_len);
+  // Tabs and line ends inside would break the row
+  for (size_t i = 0; i < text_len; i++) {
+    if (dest[prefix_len + i] == '\t' || dest[prefix_len + i] == '\r') {
+      dest[prefix_len + i] = ' ';
+    }
+  }
+  dest[prefix_len + text_len] = '\0';
+  batch->hits[batch->count] = (GrepHit){.path_len = path_len, .line = line};
+  batch->text_len[batch->count] = prefix_len + text_len;
+  batch->used += prefix_len + text_len + 1;
+  batch->count++;
+}
+
+// Hits in complete lines of [start, end), *line is line number at start
+static void Grep_search(Grep *grep, GrepThread *thread, const char *path, size_t path_len, const char *start,
+                        const char *end, unsigned int *line) {
+  const char *pos = start;
+  const char *counted = start;
+  while (pos < end) {
+    const char *match = grep->use_regex ? Grep_find_regex(grep, pos, end) : Grep_find_literal(grep, pos, end);
+    if (match == NULL) {
+      break;
+    }
+    const char *line_start = memrchr(pos, '\n', match - pos);
+    line_start = line_start != NULL ? line_start + 1 : pos;
+    const char *line_end = memchr(match, '\n', end - match);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    *line += count_lines(counted, line_start);
+    counted = line_start;
+    Grep_add_hit(grep, thread, path, path_len, *line, line_start, line_end);
+    pos = line_end + 1;
+  }
+  *line += count_lines(counted, end);
+}
+
+static void Grep_file(Grep *grep, GrepThread *thread, const WalkEntry *entry) {
+  int fd = open(entry->path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  const char *path = entry->path + (grep->root_len == 1 ? 1 : grep->root_len + 1);
+  size_t path_len = entry->path_len - (path - entry->path);
+  char *buffer = thread->buffer;
+  size_t carry = 0;
+  unsigned int line = 1;
+  bool first = true;
+  while (!atomic_load(&grep->cancel)) {
+    ssize_t read_bytes = read(fd, buffer + carry, GREP_READ_SIZE - carry);
+    if (read_bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read_bytes < 0 || (read_bytes == 0 && carry == 0)) {
+      break;
+    }
+    size_t len = carry + read_bytes;
+    atomic_fetch_add(&grep->bytes_searched, read_bytes);
+    if (first && memchr(buffer, '\0', len) != NULL) {
+      break;
+    }
+    first = false;
+
+    // Last incomplete line waits for next read, unless this is the end
+    // or line doesn't fit (searched in pieces then)
+    size_t complete = len;
+    if (read_bytes > 0) {
+      const char *last_newline = memrchr(buffer, '\n', len);
+      if (last_newline != NULL) {
+        complete = last_newline + 1 - buffer;
+      } else if (len < GREP_READ_SIZE) {
+        carry = len;
+        continue;
+      }
+    }
+    Grep_search(grep, thread, path, path_len, buffer, buffer + complete, &line);
+    carry = len - complete;
+    memmove(buffer, buffer + complete, carry);
+    if (read_bytes == 0) {
+      break;
+    }
+  }
+  close(fd);
+  atomic_fetch_add(&grep->files_searched, 1);
+  // Hits of finished file show up right away
+  Grep_flush(grep, thread);
+}
+
+static WalkAction Grep_visit(void *ctx, WalkThread *walk_thread, const WalkEntry *entry) {
+  Grep *grep = ctx;
+  if (atomic_load(&grep->cancel)) {
+    return WALK_SKIP;
+  }
+  if (entry->type != DIRECTORY) {
+    Grep_file(grep, &grep->threads[walk_thread->index], entry);
+  }
+  return WALK_CONTINUE;
+}
+
+static void *Grep_worker(void *arg) {
+  Grep *grep = arg;
+  const char *exclude[] = {GREP_EXCLUDE, NULL};
+  WalkOptions options = {
+      .threads = grep->threads_count,
+      .max_depth = -1,
+      .one_filesystem = true,
+      .symlinks = WALK_SYMLINKS_SKIP,
+      .exclude = exclude,
+  };
+  Walker_run(grep->root, &options, Grep_visit, grep);
+  for (int i = 0; i < grep->threads_count; i++) {
+    Grep_flush(grep, &grep->threads[i]);
+  }
+  atomic_store(&grep->running, false);
+  return NULL;
+}
+
+extern void Grep_init(Grep *grep) {
+  memset(grep, 0, sizeof(*grep));
+  pthread_mutex_init(&grep->lock, NULL);
+}
+
+static void Grep_drop_found(Grep *grep) {
+  while (grep->found_head != NULL) {
+    GrepBatch *batch = grep->found_head;
+    grep->found_head = batch->next;
+    free(batch);
+  }
+  grep->found_tail = NULL;
+}
+
+// Free what search used, its thread must not be running
+static void Grep_release(Grep *grep) {
+  for (int i = 0; grep->threads != NULL && i < grep->threads_count; i++) {
+    free(grep->threads[i].buffer);
+    free(grep->threads[i].batch);
+  }
+  free(grep->threads);
+  grep->threads = NULL;
+  grep->threads_count = 0;
+  if (grep->use_regex) {
+    regfree(&grep->regex);
+    grep->use_regex = false;
+  }
+}
+
+extern void Grep_stop(Grep *grep) {
+  if (!grep->started) {
+    return;
+  }
+  atomic_store(&grep->cancel, true);
+  pthread_join(grep->thread, NULL);
+  grep->started = false;
+  Grep_release(grep);
+}
+
+extern int Grep_start(Grep *grep, const char *root, const char *query) {
+  Grep_stop(grep);
+  Grep_drop_found(grep);
+  FilesArray_free(&grep->results);
+  atomic_store(&grep->cancel, false);
+  atomic_store(&grep->files_searched, 0);
+  atomic_store(&grep->bytes_searched, 0);
+
+  bool use_regex = query[0] == '/';
+  const char *pattern = use_regex ? query + 1 : query;
+  if (pattern[0] == '\0') {
+    return SUCCESS;
+  }
+  if (use_regex && regcomp(&grep->regex, pattern, REG_EXTENDED | REG_NEWLINE) != 0) {
+    return ERROR;
+  }
+  grep->use_regex = use_regex;
+  snprintf(grep->root, sizeof(grep->root), "%s", root);
+  grep->root_len = strlen(grep->root);
+  snprintf(grep->pattern, sizeof(grep->pattern), "%s", pattern);
+  grep->pattern_len = strlen(grep->pattern);
+  grep->rare_offset = 0;
+  for (size_t i = 1; i < grep->pattern_len; i++) {
+    if (byte_rank(grep->pattern[i]) < byte_rank(grep->pattern[grep->rare_offset])) {
+      grep->rare_offset = i;
+    }
+  }
+
+  WalkOptions options = {.threads = GREP_THREADS};
+  grep->threads_count = Walker_thread_count(&options);
+  grep->threads = calloc(grep->threads_count, sizeof(GrepThread));
+  bool allocated = grep->threads != NULL;
+  for (int i = 0; allocated && i < grep->threads_count; i++) {
+    allocated = (grep->threads[i].buffer = malloc(GREP_READ_SIZE)) != NULL;
+  }
+  if (!allocated) {
+    Grep_release(grep);
+    return MALLOC_FAIL;
+  }
+
+  atomic_store(&grep->running, true);
+  if (pthread_create(&grep->thread, NULL, Grep_worker, grep) != 0) {
+    atomic_store(&grep->running, false);
+    Grep_release(grep);
+    return ERROR;
+  }
+  grep->started = true;
+  return SUCCESS;
+}
+
+extern bool Grep_poll(Grep *grep) {
+  pthread_mutex_lock(&grep->lock);
+  GrepBatch *batch = grep->found_head;
+  grep->found_head = NULL;
+  grep->found_tail = NULL;
+  pthread_mutex_unlock(&grep->lock);
+
+  bool added = batch != NULL;
+  while (batch != NULL) {
+    const char *text = batch->text;
+    for (unsigned int i = 0; i < batch->count; i++) {
+      unsigned int count = grep->results.files_count;
+      if (count >= GREP_RESULTS_MAX) {
+        // Enough to look at, rest of search is useless
+        atomic_store(&grep->cancel, true);
+        break;
+      }
+      if (count >= grep->hits_size) {
+        size_t new_size = grep->hits_size ? grep->hits_size * 2 : 256;
+        GrepHit *new_hits = realloc(grep->hits, new_size * sizeof(GrepHit));
+        if (new_hits == NULL) {
+          break;
+        }
+        grep->hits = new_hits;
+        grep->hits_size = new_size;
+      }
+      if (FilesArray_push(&grep->results, text, batch->text_len[i], REGULAR) != SUCCESS) {
+        break;
+      }
+      grep->hits[count] = batch->hits[i];
+      text += batch->text_len[i] + 1;
+    }
+    GrepBatch *next = batch->next;
+    free(batch);
+    batch = next;
+  }
+  return added;
+}
+
+extern void Grep_result_path(const Grep *grep, unsigned int index, char *dest, size_t dest_size) {
+  snprintf(dest, dest_size, "%.*s", (int)grep->hits[index].path_len, Grep_result(grep, index));
+}
+
+extern void Grep_free(Grep *grep) {
+  Grep_stop(grep);
+  Grep_drop_found(grep);
+  FilesArray_free(&grep->results);
+  free(grep->hits);
+  grep->hits = NULL;
+  grep->hits_size = 0;
+  pthread_mutex_destroy(&grep->lock);
+}
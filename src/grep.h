@@ -0,0 +1,100 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include "config.h"
+#include "files.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GREP_BATCH_HITS 64
+#define GREP_BATCH_BYTES (8 * 1024)
+
+// Where result line is: path (relative to root) is the first path_len
+// bytes of its text "path:line: content"
+typedef struct GrepHit {
+  uint16_t path_len;
+  uint32_t line;
+} GrepHit;
+
+// Hits found by one walker thread, handed to main thread at once
+typedef struct GrepBatch {
+  struct GrepBatch *next;
+  unsigned int count;
+  size_t used;
+  GrepHit hits[GREP_BATCH_HITS];
+  uint16_t text_len[GREP_BATCH_HITS];
+  // count texts, each ends with NUL
+  char text[GREP_BATCH_BYTES];
+} GrepBatch;
+
+// Per walker thread read buffer and hits not handed over yet
+typedef struct GrepThread {
+  char *buffer;
+  GrepBatch *batch;
+} GrepThread;
+
+// Content search of files under root, run in background on walker threads
+// (each thread reads and searches the files it finds, GREP_READ_SIZE reads).
+// Literal patterns are found with memchr of their rarest byte, then compared;
+// pattern starting with '/' is POSIX extended regex. Files with NUL in the
+// first read are binary and skipped. One hit per line.
+// Hits stream into results (FilesArray of "path:line: content") on Grep_poll
+typedef struct Grep {
+  char root[PATH_MAX];
+  size_t root_len;
+  char pattern[PATH_MAX];
+  size_t pattern_len;
+  size_t rare_offset;
+  bool use_regex;
+  regex_t regex;
+  pthread_t thread;
+  bool started;
+  atomic_bool cancel;
+  atomic_bool running;
+  GrepThread *threads;
+  int threads_count;
+  pthread_mutex_t lock;
+  // Found, not yet in results (guarded by lock)
+  GrepBatch *found_head, *found_tail;
+  atomic_ulong files_searched;
+  atomic_ulong bytes_searched;
+  // Main thread only
+  FilesArray results;
+  GrepHit *hits;
+  size_t hits_size;
+} Grep;
+
+extern void Grep_init(Grep *grep);
+
+// Stop previous search, drop its results and search for query under root.
+// Empty query (or invalid regex) searches nothing
+extern int Grep_start(Grep *grep, const char *root, const char *query);
+
+// Take hits found since last call into results, true if there were any
+extern bool Grep_poll(Grep *grep);
+
+static inline bool Grep_running(Grep *grep) {
+  return atomic_load(&grep->running);
+}
+
+static inline unsigned int Grep_count(const Grep *grep) {
+  return grep->results.files_count;
+}
+
+static inline const char *Grep_result(const Grep *grep, unsigned int index) {
+  return FilesArray_name(&grep->results, index);
+}
+
+// Path of result relative to root into dest
+extern void Grep_result_path(const Grep *grep, unsigned int index, char *dest, size_t dest_size);
+
+// Cancel search and wait for it, results stay
+extern void Grep_stop(Grep *grep);
+
+extern void Grep_free(Grep *grep);
+
+#endif
@@ -0,0 +1,754 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include "enums.h"
+#include "trace.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct JobRun {
+  JobQueue *jobs;
+  const Job *job;
+  // JOB_BUFFER_SIZE, page aligned
+  char *buffer;
+} JobRun;
+
+static atomic_uint part_counter;
+
+static bool JobRun_cancelled(const JobRun *run) {
+  return atomic_load(&run->jobs->generation) != run->job->generation;
+}
+
+static double elapsed_sec(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// Open directory name in dir_fd for reading entries, NULL on error
+static DIR *open_dir_at(int dir_fd, const char *name) {
+  int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  DIR *dir = fdopendir(fd);
+  if (dir == NULL) {
+    close(fd);
+  }
+  return dir;
+}
+
+static inline bool is_dot_entry(const char *name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// Bytes under name, for progress total
+static uint64_t scan_tree(const JobRun *run, int dir_fd, const char *name) {
+  struct stat st;
+  if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+    return 0;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return S_ISREG(st.st_mode) ? st.st_size : 0;
+  }
+  DIR *dir = open_dir_at(dir_fd, name);
+  if (dir == NULL) {
+    return 0;
+  }
+  uint64_t bytes = 0;
+  struct dirent *entry;
+  while (!JobRun_cancelled(run) && (entry = readdir(dir)) != NULL) {
+    if (!is_dot_entry(entry->d_name)) {
+      bytes += scan_tree(run, dirfd(dir), entry->d_name);
+    }
+  }
+  closedir(dir);
+  return bytes;
+}
+
+// Remove name in dir_fd with everything under it, returns 0 or -errno
+static int remove_tree(int dir_fd, const char *name) {
+  if (unlinkat(dir_fd, name, 0) == 0) {
+    return 0;
+  }
+  if (errno != EISDIR && errno != EPERM) {
+    return errno == ENOENT ? 0 : -errno;
+  }
+  DIR *dir = open_dir_at(dir_fd, name);
+  if (dir == NULL) {
+    return -errno;
+  }
+  int res = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!is_dot_entry(entry->d_name)) {
+      int entry_res = remove_tree(dirfd(dir), entry->d_name);
+      res = res < 0 ? res : entry_res;
+    }
+  }
+  closedir(dir);
+  if (unlinkat(dir_fd, name, AT_REMOVEDIR) < 0 && res == 0) {
+    res = -errno;
+  }
+  return res;
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    data += written;
+    size -= written;
+  }
+  return 0;
+}
+
+// Copy rest of in_fd to out_fd (both at their current offsets)
+static int copy_data(JobRun *run, int in_fd, int out_fd, uint64_t size) {
+  // In kernel, no copy through user space (server side copy, reflink on some filesystems)
+  bool copied_any = false;
+  for (;;) {
+    if (JobRun_cancelled(run)) {
+      return -ECANCELED;
+    }
+    ssize_t copied = copy_file_range(in_fd, NULL, out_fd, NULL, JOB_COPY_CHUNK, 0);
+    if (copied == 0) {
+      return 0;
+    }
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Not supported for these files, try other ways
+      if (!copied_any && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                          errno == EOPNOTSUPP || errno == EBADF || errno == EPERM)) {
+        break;
+      }
+      return -errno;
+    }
+    copied_any = true;
+    atomic_fetch_add(&run->jobs->bytes_done, copied);
+  }
+
+  // Whole file clone (shares extents, no data copied)
+  if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+    atomic_fetch_add(&run->jobs->bytes_done, size);
+    return 0;
+  }
+
+  if (run->buffer == NULL) {
+    return -ENOMEM;
+  }
+  for (;;) {
+    if (JobRun_cancelled(run)) {
+      return -ECANCELED;
+    }
+    ssize_t read_bytes = read(in_fd, run->buffer, JOB_BUFFER_SIZE);
+    if (read_bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    if (read_bytes == 0) {
+      return 0;
+    }
+    int write_res = write_all(out_fd, run->buffer, read_bytes);
+    if (write_res < 0) {
+      return write_res;
+    }
+    atomic_fetch_add(&run->jobs->bytes_done, read_bytes);
+  }
+}
+
+static void copy_attributes(int fd, const struct stat *st) {
+  struct timespec times[2] = {st->st_atim, st->st_mtim};
+  fchmod(fd, st->st_mode & 07777);
+  futimens(fd, times);
+}
+
+// Copy src_name in src_dir to dest_name in dest_dir (which must not exist),
+// directories recursively. Returns 0 or -errno
+static int copy_tree(JobRun *run, int src_dir, const char *src_name, int dest_dir, const char *dest_name) {
+  if (JobRun_cancelled(run)) {
+    return -ECANCELED;
+  }
+  struct stat st;
+  if (fstatat(src_dir, src_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+    return -errno;
+  }
+
+  if (S_ISLNK(st.st_mode)) {
+    char target[PATH_MAX];
+    ssize_t len = readlinkat(src_dir, src_name, target, sizeof(target) - 1);
+    if (len < 0) {
+      return -errno;
+    }
+    target[len] = '\0';
+    atomic_fetch_add(&run->jobs->files_done, 1);
+    return symlinkat(target, dest_dir, dest_name) < 0 ? -errno : 0;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    int in_fd = openat(src_dir, src_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in_fd < 0) {
+      return -errno;
+    }
+    int out_fd = openat(dest_dir, dest_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out_fd < 0) {
+      int res = -errno;
+      close(in_fd);
+      return res;
+    }
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int res = copy_data(run, in_fd, out_fd, st.st_size);
+    if (res == 0) {
+      copy_attributes(out_fd, &st);
+    }
+    if (close(out_fd) < 0 && res == 0) {
+      res = -errno;
+    }
+    close(in_fd);
+    atomic_fetch_add(&run->jobs->files_done, 1);
+    return res;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    // Devices, sockets, fifos
+    return -EOPNOTSUPP;
+  }
+  if (mkdirat(dest_dir, dest_name, 0700) < 0) {
+    return -errno;
+  }
+  int dest_fd = openat(dest_dir, dest_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  DIR *dir = open_dir_at(src_dir, src_name);
+  if (dest_fd < 0 || dir == NULL) {
+    int res = -errno;
+    if (dest_fd >= 0) {
+      close(dest_fd);
+    }
+    if (dir != NULL) {
+      closedir(dir);
+    }
+    return res;
+  }
+  int res = 0;
+  struct dirent *entry;
+  while (res == 0 && (entry = readdir(dir)) != NULL) {
+    if (!is_dot_entry(entry->d_name)) {
+      res = copy_tree(run, dirfd(dir), entry->d_name, dest_fd, entry->d_name);
+    }
+  }
+  closedir(dir);
+  if (res == 0) {
+    copy_attributes(dest_fd, &st);
+  }
+  close(dest_fd);
+  atomic_fetch_add(&run->jobs->files_done, 1);
+  return res;
+}
+
+// Rename that never replaces existing name
+static int rename_noreplace(int src_dir, const char *src_name, int dest_dir, const char *dest_name) {
+  if (renameat2(src_dir, src_name, dest_dir, dest_name, RENAME_NOREPLACE) == 0) {
+    return 0;
+  }
+  if (errno != EINVAL && errno != ENOSYS) {
+    return -errno;
+  }
+  // Filesystem without RENAME_NOREPLACE
+  struct stat st;
+  if (fstatat(dest_dir, dest_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    return -EEXIST;
+  }
+  return renameat(src_dir, src_name, dest_dir, dest_name) < 0 ? -errno : 0;
+}
+
+static void unlink_names(JobQueue *jobs, UnlinkBatch *batch) {
+  int error = 0;
+  const char *name = batch->names;
+  for (unsigned int i = 0; i < batch->count; i++) {
+    if (atomic_load(&jobs->generation) != batch->generation) {
+      break;
+    }
+    if (unlinkat(batch->dir->fd, name, 0) == 0) {
+      atomic_fetch_add(&jobs->files_done, 1);
+    } else if (errno != ENOENT) {
+      error = errno;
+    }
+    name += strlen(name) + 1;
+  }
+  pthread_mutex_lock(&jobs->unlink_lock);
+  if (error != 0) {
+    batch->dir->error = error;
+  }
+  if (--batch->dir->pending == 0) {
+    pthread_cond_broadcast(&jobs->unlink_done);
+  }
+  pthread_mutex_unlock(&jobs->unlink_lock);
+}
+
+static void *JobQueue_unlink_worker(void *arg) {
+  JobQueue *jobs = arg;
+  pthread_mutex_lock(&jobs->unlink_lock);
+  for (;;) {
+    while (!jobs->unlink_stop && jobs->unlink_head == NULL) {
+      pthread_cond_wait(&jobs->unlink_cond, &jobs->unlink_lock);
+    }
+    if (jobs->unlink_head == NULL) {
+      break;
+    }
+    UnlinkBatch *batch = jobs->unlink_head;
+    jobs->unlink_head = batch->next;
+    if (jobs->unlink_head == NULL) {
+      jobs->unlink_tail = NULL;
+    }
+    pthread_mutex_unlock(&jobs->unlink_lock);
+    unlink_names(jobs, batch);
+    free(batch);
+    pthread_mutex_lock(&jobs->unlink_lock);
+  }
+  pthread_mutex_unlock(&jobs->unlink_lock);
+  return NULL;
+}
+
+// Hand batch to unlink workers (or unlink here without them)
+static void submit_batch(JobQueue *jobs, UnlinkBatch *batch) {
+  pthread_mutex_lock(&jobs->unlink_lock);
+  batch->dir->pending++;
+  if (jobs->unlink_threads_count == 0) {
+    pthread_mutex_unlock(&jobs->unlink_lock);
+    unlink_names(jobs, batch);
+    free(batch);
+    return;
+  }
+  batch->next = NULL;
+  if (jobs->unlink_tail != NULL) {
+    jobs->unlink_tail->next = batch;
+  } else {
+    jobs->unlink_head = batch;
+  }
+  jobs->unlink_tail = batch;
+  pthread_cond_signal(&jobs->unlink_cond);
+  pthread_mutex_unlock(&jobs->unlink_lock);
+}
+
+// Remove name in parent_fd with everything under it. Files of each
+// directory go to unlink workers in batches while its subdirectories
+// are walked here, directory itself is removed when they are done
+static int delete_tree(JobRun *run, int parent_fd, const char *name) {
+  JobQueue *jobs = run->jobs;
+  if (JobRun_cancelled(run)) {
+    return -ECANCELED;
+  }
+  if (unlinkat(parent_fd, name, 0) == 0) {
+    atomic_fetch_add(&jobs->files_done, 1);
+    return 0;
+  }
+  if (errno != EISDIR && errno != EPERM) {
+    return errno == ENOENT ? 0 : -errno;
+  }
+  DIR *dir = open_dir_at(parent_fd, name);
+  if (dir == NULL) {
+    return -errno;
+  }
+
+  UnlinkDir unlink_dir = {.fd = dirfd(dir)};
+  int res = 0;
+  // Entries removed while directory is read may make readdir skip some,
+  // another pass picks them up
+  for (int pass = 0; pass < 2 && res == 0; pass++) {
+    rewinddir(dir);
+    UnlinkBatch *batch = NULL;
+    struct dirent *entry;
+    while (res == 0 && (entry = readdir(dir)) != NULL) {
+      if (is_dot_entry(entry->d_name)) {
+        continue;
+      }
+      bool is_dir = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        struct stat st;
+        is_dir = fstatat(unlink_dir.fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+      }
+      if (is_dir) {
+        res = delete_tree(run, unlink_dir.fd, entry->d_name);
+        continue;
+      }
+
+      size_t len = strlen(entry->d_name) + 1;
+      if (batch != NULL && (batch->count == JOB_UNLINK_BATCH || batch->used + len > sizeof(batch->names))) {
+        submit_batch(jobs, batch);
+        batch = NULL;
+      }
+      if (batch == NULL) {
+        batch = malloc(sizeof(UnlinkBatch));
+        if (batch == NULL) {
+          res = -ENOMEM;
+          break;
+        }
+        *batch = (UnlinkBatch){.dir = &unlink_dir, .generation = run->job->generation};
+      }
+      memcpy(batch->names + batch->used, entry->d_name, len);
+      batch->used += len;
+      batch->count++;
+    }
+    if (batch != NULL) {
+      submit_batch(jobs, batch);
+    }
+
+    // Batches point to unlink_dir, wait for them even when failing
+    pthread_mutex_lock(&jobs->unlink_lock);
+    while (unlink_dir.pending > 0) {
+      pthread_cond_wait(&jobs->unlink_done, &jobs->unlink_lock);
+    }
+    pthread_mutex_unlock(&jobs->unlink_lock);
+
+    if (res == 0 && JobRun_cancelled(run)) {
+      res = -ECANCELED;
+    }
+    if (res == 0 && unlinkat(parent_fd, name, AT_REMOVEDIR) == 0) {
+      atomic_fetch_add(&jobs->files_done, 1);
+      break;
+    }
+    if (res == 0 && (errno != ENOTEMPTY || unlink_dir.error != 0 || pass == 1)) {
+      res = -(unlink_dir.error != 0 ? unlink_dir.error : errno);
+    }
+  }
+  closedir(dir);
+  return res;
+}
+
+static int Job_copy(JobRun *run, int src_dir, int dest_dir) {
+  const char *name = run->job->name;
+  struct stat st;
+  if (fstatat(dest_dir, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    return -EEXIST;
+  }
+  atomic_fetch_add(&run->jobs->bytes_total, scan_tree(run, src_dir, name));
+
+  // Built under hidden name, appears complete or not at all
+  char part_name[NAME_MAX + 1];
+  snprintf(part_name, sizeof(part_name), ".tf-part-%d-%u", (int)getpid(), atomic_fetch_add(&part_counter, 1));
+  int res = copy_tree(run, src_dir, name, dest_dir, part_name);
+  if (res == 0) {
+    res = rename_noreplace(dest_dir, part_name, dest_dir, name);
+  }
+  if (res < 0) {
+    remove_tree(dest_dir, part_name);
+  }
+  return res;
+}
+
+static int Job_move(JobRun *run, int src_dir, int dest_dir) {
+  const char *name = run->job->name;
+  int res = rename_noreplace(src_dir, name, dest_dir, name);
+  if (res != -EXDEV) {
+    atomic_fetch_add(&run->jobs->files_done, res == 0);
+    return res;
+  }
+  // Other filesystem
+  res = Job_copy(run, src_dir, dest_dir);
+  return res == 0 ? delete_tree(run, src_dir, name) : res;
+}
+
+static int Job_run(JobRun *run) {
+  const Job *job = run->job;
+  if (job->type == JOB_DELETE) {
+    int src_dir = open(job->src_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (src_dir < 0) {
+      return -errno;
+    }
+    int res = delete_tree(run, src_dir, job->name);
+    close(src_dir);
+    return res;
+  }
+
+  // Copying directory into itself would never end
+  size_t src_len = strlen(job->src_dir);
+  size_t name_len = strlen(job->name);
+  bool src_is_root = src_len == 1;
+  const char *inside = job->dest_dir + (src_is_root ? 0 : src_len);
+  if (strncmp(job->dest_dir, job->src_dir, src_len) == 0 && inside[0] == '/' &&
+      strncmp(inside + 1, job->name, name_len) == 0 &&
+      (inside[1 + name_len] == '\0' || inside[1 + name_len] == '/')) {
+    return -EINVAL;
+  }
+
+  int src_dir = open(job->src_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (src_dir < 0) {
+    return -errno;
+  }
+  int dest_dir = open(job->dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dest_dir < 0) {
+    int res = -errno;
+    close(src_dir);
+    return res;
+  }
+  int res = job->type == JOB_MOVE ? Job_move(run, src_dir, dest_dir) : Job_copy(run, src_dir, dest_dir);
+  close(dest_dir);
+  close(src_dir);
+  return res;
+}
+
+static const char *JobType_name(JobType type) {
+  return type == JOB_DELETE ? "delete" : type == JOB_MOVE ? "move" : "copy";
+}
+
+static void JobQueue_wake(JobQueue *jobs) {
+  uint64_t one = 1;
+  if (write(jobs->wake_fd, &one, sizeof(one)) < 0) {
+    // Counter full, main thread is woken anyway
+  }
+}
+
+static void *JobQueue_worker(void *arg) {
+  JobQueue *jobs = arg;
+  void *buffer = NULL;
+  if (posix_memalign(&buffer, 4096, JOB_BUFFER_SIZE) != 0) {
+    // Only read/write fallback needs it
+    buffer = NULL;
+  }
+
+  pthread_mutex_lock(&jobs->lock);
+  for (;;) {
+    while (!jobs->stop && jobs->head == NULL) {
+      pthread_cond_wait(&jobs->cond, &jobs->lock);
+    }
+    if (jobs->stop) {
+      break;
+    }
+    Job *job = jobs->head;
+    jobs->head = job->next;
+    if (jobs->head == NULL) {
+      jobs->tail = NULL;
+    }
+    jobs->running++;
+    jobs->type = job->type;
+    pthread_mutex_unlock(&jobs->lock);
+
+    JobRun run = {jobs, job, buffer};
+    uint64_t trace_start = Trace_start();
+    int res = JobRun_cancelled(&run) ? -ECANCELED : Job_run(&run);
+    Trace_end(JobType_name(job->type), trace_start, job->name);
+
+    pthread_mutex_lock(&jobs->lock);
+    jobs->running--;
+    jobs->jobs_done++;
+    if (res == -ECANCELED) {
+      snprintf(jobs->error, sizeof(jobs->error), "cancelled");
+    } else if (res < 0) {
+      snprintf(jobs->error, sizeof(jobs->error), "%s %s: %s", JobType_name(job->type), job->name,
+               strerror(-res));
+    }
+    // Its entry was dropped from listings right away
+    if (res < 0 && job->type == JOB_DELETE) {
+      job->next = jobs->failed;
+      jobs->failed = job;
+    } else {
+      free(job);
+    }
+    JobQueue_wake(jobs);
+  }
+  pthread_mutex_unlock(&jobs->lock);
+  free(buffer);
+  return NULL;
+}
+
+extern int JobQueue_init(JobQueue *jobs) {
+  memset(jobs, 0, sizeof(*jobs));
+  jobs->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (jobs->wake_fd < 0) {
+    return ERROR;
+  }
+  pthread_mutex_init(&jobs->lock, NULL);
+  pthread_cond_init(&jobs->cond, NULL);
+  pthread_mutex_init(&jobs->unlink_lock, NULL);
+  pthread_cond_init(&jobs->unlink_cond, NULL);
+  pthread_cond_init(&jobs->unlink_done, NULL);
+  // Without them delete jobs unlink by themselves
+  for (int i = 0; i < JOB_UNLINK_THREADS; i++) {
+    if (pthread_create(&jobs->unlink_threads[i], NULL, JobQueue_unlink_worker, jobs) != 0) {
+      break;
+    }
+    jobs->unlink_threads_count++;
+  }
+  for (int i = 0; i < JOB_THREADS; i++) {
+    if (pthread_create(&jobs->threads[i], NULL, JobQueue_worker, jobs) != 0) {
+      break;
+    }
+    jobs->threads_count++;
+  }
+  if (jobs->threads_count == 0) {
+    JobQueue_free(jobs);
+    return ERROR;
+  }
+  return SUCCESS;
+}
+
+extern int JobQueue_add(JobQueue *jobs, JobType type, const char *src_dir, const char *name,
+                        const char *dest_dir) {
+  if (jobs->threads_count == 0) {
+    return ERROR;
+  }
+  Job *job = calloc(1, sizeof(Job));
+  if (job == NULL) {
+    return MALLOC_FAIL;
+  }
+  job->type = type;
+  snprintf(job->src_dir, sizeof(job->src_dir), "%s", src_dir);
+  snprintf(job->name, sizeof(job->name), "%s", name);
+  snprintf(job->dest_dir, sizeof(job->dest_dir), "%s", dest_dir != NULL ? dest_dir : "");
+
+  pthread_mutex_lock(&jobs->lock);
+  // New batch, progress starts over
+  if (jobs->head == NULL && jobs->running == 0) {
+    jobs->jobs_done = 0;
+    jobs->jobs_total = 0;
+    atomic_store(&jobs->bytes_done, 0);
+    atomic_store(&jobs->bytes_total, 0);
+    atomic_store(&jobs->files_done, 0);
+    clock_gettime(CLOCK_MONOTONIC, &jobs->started);
+  }
+  jobs->error[0] = '\0';
+  job->generation = atomic_load(&jobs->generation);
+  if (jobs->tail != NULL) {
+    jobs->tail->next = job;
+  } else {
+    jobs->head = job;
+  }
+  jobs->tail = job;
+  jobs->jobs_total++;
+  pthread_cond_signal(&jobs->cond);
+  pthread_mutex_unlock(&jobs->lock);
+  return SUCCESS;
+}
+
+extern bool JobQueue_active(JobQueue *jobs) {
+  if (jobs->threads_count == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&jobs->lock);
+  bool active = jobs->head != NULL || jobs->running > 0;
+  pthread_mutex_unlock(&jobs->lock);
+  return active;
+}
+
+extern bool JobQueue_progress(JobQueue *jobs, JobProgress *progress) {
+  if (jobs->threads_count == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&jobs->lock);
+  progress->running = jobs->head != NULL || jobs->running > 0;
+  progress->jobs_done = jobs->jobs_done;
+  progress->jobs_total = jobs->jobs_total;
+  progress->type = jobs->head != NULL && jobs->running == 0 ? jobs->head->type : jobs->type;
+  double elapsed = elapsed_sec(&jobs->started);
+  pthread_mutex_unlock(&jobs->lock);
+
+  progress->bytes_done = atomic_load(&jobs->bytes_done);
+  progress->bytes_total = atomic_load(&jobs->bytes_total);
+  progress->files_done = atomic_load(&jobs->files_done);
+  progress->rate = elapsed > 0 ? progress->bytes_done / elapsed : 0;
+  progress->eta = -1;
+  if (progress->rate > 0 && progress->bytes_total >= progress->bytes_done) {
+    progress->eta = (progress->bytes_total - progress->bytes_done) / progress->rate;
+  }
+  return progress->running;
+}
+
+extern void JobQueue_error(JobQueue *jobs, char *dest, size_t dest_size) {
+  dest[0] = '\0';
+  if (jobs->threads_count == 0) {
+    return;
+  }
+  pthread_mutex_lock(&jobs->lock);
+  snprintf(dest, dest_size, "%s", jobs->error);
+  pthread_mutex_unlock(&jobs->lock);
+}
+
+extern Job *JobQueue_take_failed(JobQueue *jobs) {
+  if (jobs->threads_count == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&jobs->lock);
+  Job *failed = jobs->failed;
+  jobs->failed = NULL;
+  pthread_mutex_unlock(&jobs->lock);
+  return failed;
+}
+
+extern void JobQueue_cancel(JobQueue *jobs) {
+  if (jobs->threads_count == 0) {
+    return;
+  }
+  pthread_mutex_lock(&jobs->lock);
+  while (jobs->head != NULL) {
+    Job *job = jobs->head;
+    jobs->head = job->next;
+    free(job);
+    jobs->jobs_total--;
+  }
+  jobs->tail = NULL;
+  // Running jobs see it and clean up after themselves
+  atomic_fetch_add(&jobs->generation, 1);
+  snprintf(jobs->error, sizeof(jobs->error), "cancelled");
+  pthread_mutex_unlock(&jobs->lock);
+}
+
+extern void JobQueue_clear_wake(JobQueue *jobs) {
+  uint64_t value;
+  if (jobs->wake_fd >= 0 && read(jobs->wake_fd, &value, sizeof(value)) < 0) {
+    // Nothing signalled
+  }
+}
+
+extern void JobQueue_free(JobQueue *jobs) {
+  if (jobs->wake_fd < 0) {
+    return;
+  }
+  if (jobs->threads_count > 0) {
+    JobQueue_cancel(jobs);
+    pthread_mutex_lock(&jobs->lock);
+    jobs->stop = true;
+    pthread_cond_broadcast(&jobs->cond);
+    pthread_mutex_unlock(&jobs->lock);
+    for (unsigned int i = 0; i < jobs->threads_count; i++) {
+      pthread_join(jobs->threads[i], NULL);
+    }
+    jobs->threads_count = 0;
+  }
+  // After job workers, running deletes wait for their batches
+  pthread_mutex_lock(&jobs->unlink_lock);
+  jobs->unlink_stop = true;
+  pthread_cond_broadcast(&jobs->unlink_cond);
+  pthread_mutex_unlock(&jobs->unlink_lock);
+  for (unsigned int i = 0; i < jobs->unlink_threads_count; i++) {
+    pthread_join(jobs->unlink_threads[i], NULL);
+  }
+  jobs->unlink_threads_count = 0;
+  while (jobs->failed != NULL) {
+    Job *job = jobs->failed;
+    jobs->failed = job->next;
+    free(job);
+  }
+  pthread_mutex_destroy(&jobs->unlink_lock);
+  pthread_cond_destroy(&jobs->unlink_cond);
+  pthread_cond_destroy(&jobs->unlink_done);
+  pthread_mutex_destroy(&jobs->lock);
+  pthread_cond_destroy(&jobs->cond);
+  close(jobs->wake_fd);
+  jobs->wake_fd = -1;
+}
@@ -0,0 +1,133 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "config.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum JobType {
+  JOB_COPY,
+  JOB_MOVE,
+  JOB_DELETE,
+} JobType;
+
+typedef struct Job {
+  struct Job *next;
+  JobType type;
+  // Cancelled when queue generation moves past it
+  unsigned int generation;
+  char src_dir[PATH_MAX];
+  char name[NAME_MAX + 1];
+  char dest_dir[PATH_MAX];
+} Job;
+
+// Directory being emptied by delete job
+typedef struct UnlinkDir {
+  int fd;
+  // Batches still in unlink workers, guarded by unlink_lock
+  unsigned int pending;
+  int error;
+} UnlinkDir;
+
+// Names of one directory for unlink worker
+typedef struct UnlinkBatch {
+  struct UnlinkBatch *next;
+  UnlinkDir *dir;
+  unsigned int generation;
+  unsigned int count;
+  size_t used;
+  // count names, each ends with NUL
+  char names[JOB_UNLINK_BATCH * 32];
+} UnlinkBatch;
+
+// Totals of jobs since queue was last idle
+typedef struct JobProgress {
+  unsigned int jobs_done;
+  unsigned int jobs_total;
+  uint64_t bytes_done;
+  uint64_t bytes_total;
+  uint64_t files_done;
+  // Bytes per second so far, seconds left (-1 unknown)
+  double rate;
+  long eta;
+  JobType type;
+  bool running;
+} JobProgress;
+
+// File operations queue, run by JOB_THREADS workers.
+// Copy: copy_file_range, else FICLONE, else read/write with aligned buffer.
+// Copied tree is built under temporary name in destination and renamed
+// into place at the end, so it appears at once (and never replaces anything).
+// Move: rename (atomic) if on the same filesystem, else copy and delete.
+// Delete: job worker walks tree depth first with fd relative calls and
+// hands batches of names to JOB_UNLINK_THREADS unlink workers, directory
+// is removed once its batches are done.
+// Main thread is woken through wake_fd when a job finishes
+typedef struct JobQueue {
+  pthread_t threads[JOB_THREADS];
+  unsigned int threads_count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Guarded by lock
+  Job *head, *tail;
+  // Deletes that failed or were cancelled, entry may still be there
+  Job *failed;
+  unsigned int jobs_done;
+  unsigned int jobs_total;
+  unsigned int running;
+  JobType type;
+  char error[PATH_MAX + 64];
+  bool stop;
+  atomic_uint generation;
+  atomic_uint_fast64_t bytes_done;
+  atomic_uint_fast64_t bytes_total;
+  atomic_uint_fast64_t files_done;
+  struct timespec started;
+  int wake_fd;
+  pthread_t unlink_threads[JOB_UNLINK_THREADS];
+  unsigned int unlink_threads_count;
+  pthread_mutex_t unlink_lock;
+  // Batch queued / batch of some directory done
+  pthread_cond_t unlink_cond;
+  pthread_cond_t unlink_done;
+  UnlinkBatch *unlink_head, *unlink_tail;
+  bool unlink_stop;
+} JobQueue;
+
+extern int JobQueue_init(JobQueue *jobs);
+
+static inline int JobQueue_fd(const JobQueue *jobs) {
+  return jobs->wake_fd;
+}
+
+// Queue copy/move of src_dir/name into dest_dir, or its delete (dest_dir unused)
+extern int JobQueue_add(JobQueue *jobs, JobType type, const char *src_dir, const char *name,
+                        const char *dest_dir);
+
+// Something is queued or running
+extern bool JobQueue_active(JobQueue *jobs);
+
+// False if nothing is queued or running
+extern bool JobQueue_progress(JobQueue *jobs, JobProgress *progress);
+
+// Last error, "" if none. Cleared when new job is added
+extern void JobQueue_error(JobQueue *jobs, char *dest, size_t dest_size);
+
+// Deletes that did not remove their entry since last call (list through next),
+// caller frees them
+extern Job *JobQueue_take_failed(JobQueue *jobs);
+
+// Drop queued jobs and stop running ones (their partial copies are removed)
+extern void JobQueue_cancel(JobQueue *jobs);
+
+// Clear wake fd
+extern void JobQueue_clear_wake(JobQueue *jobs);
+
+// Cancels everything and waits for workers
+extern void JobQueue_free(JobQueue *jobs);
+
+#endif
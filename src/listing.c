@@ -0,0 +1,80 @@
+#include "listing.h"
+#include "enums.h"
+#include "sort.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern Listing *Listing_new(void) {
+  Listing *listing = calloc(1, sizeof(Listing));
+  if (listing != NULL) {
+    listing->refs = 1;
+  }
+  return listing;
+}
+
+extern Listing *Listing_wrap(FilesArray *files) {
+  Listing *listing = Listing_new();
+  if (listing == NULL) {
+    FilesArray_free(files);
+    return NULL;
+  }
+  listing->files = *files;
+  memset(files, 0, sizeof(*files));
+  return listing;
+}
+
+extern void Listing_unref(Listing **listing) {
+  if (*listing == NULL) {
+    return;
+  }
+  if (--(*listing)->refs == 0) {
+    FilesArray_free(&(*listing)->files);
+    free(*listing);
+  }
+  *listing = NULL;
+}
+
+extern FilesArray *Listing_mutable(Listing **listing) {
+  if (!Listing_shared(*listing)) {
+    return &(*listing)->files;
+  }
+  Listing *copy = Listing_new();
+  if (copy == NULL) {
+    return NULL;
+  }
+  if (FilesArray_copy(&copy->files, &(*listing)->files) != SUCCESS) {
+    Listing_unref(&copy);
+    return NULL;
+  }
+  Listing_unref(listing);
+  *listing = copy;
+  return &copy->files;
+}
+
+extern int Listing_sort(Listing *listing, const char *dir, FileSort sort) {
+  int dir_fd = -1;
+  if (sort.mode == SORT_SIZE || sort.mode == SORT_MTIME) {
+    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  int sort_res = FilesArray_sort_by(&listing->files, dir_fd, sort);
+  if (dir_fd >= 0) {
+    close(dir_fd);
+  }
+  return sort_res;
+}
+
+extern int Listing_apply_patch(Listing *listing, const char *dir, const FilesArray *ops, int *track,
+                               unsigned int track_count) {
+  int dir_fd = -1;
+  FileSort sort = listing->files.sort;
+  if (sort.mode == SORT_SIZE || sort.mode == SORT_MTIME) {
+    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  int patch_res = FilesArray_apply_patch(&listing->files, ops, dir_fd, track, track_count);
+  if (dir_fd >= 0) {
+    close(dir_fd);
+  }
+  return patch_res;
+}
@@ -0,0 +1,48 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include "files.h"
+
+// Directory listing shared by windows showing the same directory and by
+// listing cache. Splitting a window or a cache hit only takes a reference.
+// Changes of the directory itself (inotify patches) are applied in place,
+// so all holders see them; anything one holder wants differently (sort
+// order) goes through Listing_mutable, which copies a shared listing first.
+// Decoded names and metadata are caches and are filled in place too.
+// Main thread only, references are not atomic
+typedef struct Listing {
+  unsigned int refs;
+  FilesArray files;
+} Listing;
+
+// Empty listing with one reference, NULL if there is no memory
+extern Listing *Listing_new(void);
+
+// Listing owning files (moved in), NULL if there is no memory (files are freed)
+extern Listing *Listing_wrap(FilesArray *files);
+
+static inline Listing *Listing_ref(Listing *listing) {
+  if (listing != NULL) {
+    listing->refs++;
+  }
+  return listing;
+}
+
+// Drop reference, last one frees listing. Sets *listing to NULL
+extern void Listing_unref(Listing **listing);
+
+static inline bool Listing_shared(const Listing *listing) {
+  return listing->refs > 1;
+}
+
+// Make *listing only ours (copy if shared), NULL if there is no memory
+extern FilesArray *Listing_mutable(Listing **listing);
+
+// Sort in place for all holders, sizes and times are read from dir
+extern int Listing_sort(Listing *listing, const char *dir, FileSort sort);
+
+// Apply changes of dir in place, in its current order (see FilesArray_apply_patch)
+extern int Listing_apply_patch(Listing *listing, const char *dir, const FilesArray *ops, int *track,
+                               unsigned int track_count);
+
+#endif
@@ -0,0 +1,170 @@
+#include "loader.h"
+#include "config.h"
+#include "enums.h"
+#include "perf.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static int wake_fd = -1;
+static pthread_once_t wake_fd_once = PTHREAD_ONCE_INIT;
+
+static void wake_fd_init(void) {
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+extern int DirLoader_wake_fd(void) {
+  pthread_once(&wake_fd_once, wake_fd_init);
+  return wake_fd;
+}
+
+static void DirLoader_wake(void) {
+  uint64_t one = 1;
+  if (write(DirLoader_wake_fd(), &one, sizeof(one)) < 0) {
+    // Counter is already non zero, main loop will wake anyway
+  }
+}
+
+extern void DirLoader_clear_wake(void) {
+  uint64_t value;
+  if (read(DirLoader_wake_fd(), &value, sizeof(value)) < 0) {
+    // Nothing pending
+  }
+}
+
+static void DirLoader_destroy(DirLoader *loader) {
+  FilesArray_free(&loader->chunk);
+  FilesArray_free(&loader->result);
+  pthread_mutex_destroy(&loader->lock);
+  free(loader);
+}
+
+static void *DirLoader_worker(void *arg) {
+  DirLoader *loader = arg;
+  FilesArray full = {0};
+  char *buffer = NULL;
+  int status = SUCCESS;
+  uint64_t start = Perf_start();
+  uint64_t trace_start = Trace_start();
+
+  int dir_fd = open(loader->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    status = ERROR;
+  } else if ((buffer = malloc(DIR_READ_BUFFER_SIZE)) == NULL) {
+    status = MALLOC_FAIL;
+  }
+
+  bool eof = false;
+  while (status == SUCCESS && !eof && !atomic_load(&loader->cancel)) {
+    unsigned int batch_start = full.files_count;
+    status = FilesArray_read_batch(&full, dir_fd, buffer, DIR_READ_BUFFER_SIZE, &eof);
+    if (status != SUCCESS || full.files_count == batch_start) {
+      continue;
+    }
+
+    // Hand batch to main thread as unsorted chunk
+    pthread_mutex_lock(&loader->lock);
+    for (unsigned int i = batch_start; i < full.files_count && status == SUCCESS; i++) {
+      status = FilesArray_push(&loader->chunk, FilesArray_name(&full, i),
+                               full.entries[i].name_len, full.entries[i].type);
+    }
+    loader->loaded = full.files_count;
+    pthread_mutex_unlock(&loader->lock);
+    DirLoader_wake();
+  }
+  free(buffer);
+  if (dir_fd >= 0) {
+    close(dir_fd);
+  }
+  Perf_done(&perf.fill_ns, start);
+  Trace_end("fill", trace_start, loader->path);
+
+  if (status == SUCCESS && !atomic_load(&loader->cancel)) {
+    FilesArray_sort(&full);
+  }
+
+  pthread_mutex_lock(&loader->lock);
+  loader->result = full;
+  loader->status = status;
+  loader->done = true;
+  bool abandoned = loader->abandoned;
+  pthread_mutex_unlock(&loader->lock);
+
+  // Nobody waits for result anymore
+  if (abandoned) {
+    DirLoader_destroy(loader);
+    return NULL;
+  }
+  DirLoader_wake();
+  return NULL;
+}
+
+extern DirLoader *DirLoader_start(const char *path) {
+  DirLoader *loader = calloc(1, sizeof(DirLoader));
+  if (loader == NULL) {
+    return NULL;
+  }
+  snprintf(loader->path, sizeof(loader->path), "%s", path);
+  pthread_mutex_init(&loader->lock, NULL);
+  atomic_init(&loader->cancel, false);
+  DirLoader_wake_fd();
+
+  if (pthread_create(&loader->thread, NULL, DirLoader_worker, loader) != 0) {
+    DirLoader_destroy(loader);
+    return NULL;
+  }
+  pthread_detach(loader->thread);
+  return loader;
+}
+
+extern bool DirLoader_take(DirLoader *loader, FilesArray *dest, FilesArray *result, int *status) {
+  pthread_mutex_lock(&loader->lock);
+  for (unsigned int i = 0; i < loader->chunk.files_count; i++) {
+    if (FilesArray_push(dest, FilesArray_name(&loader->chunk, i),
+                        loader->chunk.entries[i].name_len,
+                        loader->chunk.entries[i].type) != SUCCESS) {
+      break;
+    }
+  }
+  // Keep chunk buffers for next batch
+  loader->chunk.files_count = 0;
+  loader->chunk.names_used = 0;
+
+  bool done = loader->done;
+  if (done) {
+    *result = loader->result;
+    *status = loader->status;
+    memset(&loader->result, 0, sizeof(loader->result));
+  }
+  pthread_mutex_unlock(&loader->lock);
+  return done;
+}
+
+extern void DirLoader_cancel(DirLoader *loader) {
+  if (loader == NULL) {
+    return;
+  }
+  atomic_store(&loader->cancel, true);
+
+  pthread_mutex_lock(&loader->lock);
+  bool done = loader->done;
+  loader->abandoned = true;
+  pthread_mutex_unlock(&loader->lock);
+
+  // Worker already finished, so nobody else will free it
+  if (done) {
+    DirLoader_destroy(loader);
+  }
+}
+
+extern void DirLoader_free(DirLoader *loader) {
+  if (loader == NULL) {
+    return;
+  }
+  DirLoader_destroy(loader);
+}
@@ -0,0 +1,47 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "files.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Background directory reader.
+// Worker thread reads directory in getdents64 batches, hands every batch
+// to the main thread as unsorted chunk, and at the end the full sorted listing.
+// Main thread is woken through DirLoader_wake_fd()
+typedef struct DirLoader {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  char path[PATH_MAX];
+  // Entries read since last DirLoader_take (guarded by lock)
+  FilesArray chunk;
+  // Full sorted listing, valid when done (guarded by lock)
+  FilesArray result;
+  unsigned int loaded;
+  int status;
+  bool done;
+  // Window left directory before load finished, worker frees loader itself
+  bool abandoned;
+  atomic_bool cancel;
+} DirLoader;
+
+// eventfd that becomes readable when any loader has new data
+extern int DirLoader_wake_fd(void);
+
+extern void DirLoader_clear_wake(void);
+
+extern DirLoader *DirLoader_start(const char *path);
+
+// Move new entries into dest (appended, unsorted).
+// Returns true when load is finished and *result holds sorted listing
+extern bool DirLoader_take(DirLoader *loader, FilesArray *dest, FilesArray *result, int *status);
+
+// Stop loading. Loader must not be used after this call
+extern void DirLoader_cancel(DirLoader *loader);
+
+// Free finished loader
+extern void DirLoader_free(DirLoader *loader);
+
+#endif
@@ -2,11 +2,19 @@
 #include "config.h"
 #include "enums.h"
 #include "files.h"
+#include "finder.h"
+#include "grep.h"
+#include "perf.h"
+#include "trace.h"
+#include "picker.h"
+#include "text.h"
 #include "window.h"
+#include "watch.h"
 #include <ctype.h>
 #include <limits.h>
 #include <locale.h>
 #include <ncursesw/ncurses.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -27,6 +35,9 @@ void init_ncurses() {
   start_color();
   init_pair(1, COLOR_YELLOW, -1);
   init_pair(2, COLOR_RED, -1);
+  // stdscr is never drawn on, flush it once
+  // so getch() won't repaint it over windows
+  refresh();
 }
 
 void *malloc_wrap(App *app, size_t size) {
@@ -42,110 +53,387 @@ void chdir_wrap(App *app, const char *path) {
     App_exit(app, "Failed to change directory");
   }
 }
-// Char pointer array find element
-int charp_arr_find_element(char *target, char **arr) {
-  int search_index = 0;
-  while (arr[search_index] != NULL) {
-    if (strcmp(target, arr[search_index]) == 0) {
-      return search_index;
-    }
-    search_index++;
+// getch() for reading rest of a command (e.g jump count),
+// main loop itself reads input without blocking
+int getch_blocking() {
+  timeout(-1);
+  int user_input = getch();
+  nodelay(stdscr, true);
+  return user_input;
+}
+
+// Sleep until user input or background work is ready:
+// directory loading, changes in watched directories
+void wait_events(App *app) {
+  struct pollfd fds[6] = {
+      {.fd = STDIN_FILENO, .events = POLLIN},
+      {.fd = DirLoader_wake_fd(), .events = POLLIN},
+      {.fd = app->winmgr.watch_fd, .events = POLLIN},
+      // Reaped in poll_background
+      {.fd = MetaEngine_fd(&app->winmgr.meta), .events = POLLIN},
+      {.fd = JobQueue_fd(&app->winmgr.jobs), .events = POLLIN},
+      // Taken in poll_background
+      {.fd = Previewer_fd(&app->winmgr.previewer), .events = POLLIN},
+  };
+  // Pending directory changes are applied once per frame
+  int timeout_ms = WindowManager_patch_timeout(&app->winmgr);
+  // Progress of running jobs is redrawn periodically
+  if (JobQueue_active(&app->winmgr.jobs) && (timeout_ms < 0 || timeout_ms > JOB_PROGRESS_MS)) {
+    timeout_ms = JOB_PROGRESS_MS;
+  }
+  if (poll(fds, 6, timeout_ms) <= 0) {
+    return;
+  }
+  if (fds[1].revents & POLLIN) {
+    DirLoader_clear_wake();
+  }
+  if (fds[3].revents & POLLIN) {
+    MetaEngine_clear_wake(&app->winmgr.meta);
   }
-  return -1;
+  if (fds[4].revents & POLLIN) {
+    JobQueue_clear_wake(&app->winmgr.jobs);
+  }
+  if (fds[2].revents & POLLIN) {
+    WindowManager_read_events(&app->winmgr);
+  }
+}
+
+void poll_background(App *app) {
+  uint64_t trace_start = Trace_start();
+  // Restored listings still match their directories
+  Window_revalidate(app->winmgr.first_window);
+  Window_revalidate(app->winmgr.second_window);
+  Window_poll_load(app->winmgr.first_window);
+  Window_poll_load(app->winmgr.second_window);
+  WindowManager_update_watches(&app->winmgr);
+  // Entries of failed deletes come back
+  for (Job *job = JobQueue_take_failed(&app->winmgr.jobs); job != NULL;) {
+    Job *next = job->next;
+    WindowManager_patch_entry(&app->winmgr, job->src_dir, job->name, false);
+    free(job);
+    job = next;
+  }
+  WindowManager_apply_patches(&app->winmgr);
+  WindowManager_poll_meta(&app->winmgr);
+  Window_request_info(app->winmgr.first_window);
+  Window_request_info(app->winmgr.second_window);
+  WindowManager_update_preview(&app->winmgr);
+  Trace_end("background", trace_start, NULL);
 }
 
-void draw_debug(App *app) {
+// Distinct listings of windows and cache, their memory
+static size_t listings_memory(WindowManager *wm, unsigned int *count) {
+  const Listing *seen[LISTING_CACHE_SIZE + 2];
+  unsigned int seen_count = 0;
+  size_t memory = 0;
+  const Listing *listings[LISTING_CACHE_SIZE + 2];
+  unsigned int listings_count = 0;
+  listings[listings_count++] = wm->first_window ? wm->first_window->listing : NULL;
+  listings[listings_count++] = wm->second_window ? wm->second_window->listing : NULL;
+  for (unsigned int i = 0; i < wm->cache.count; i++) {
+    listings[listings_count++] = wm->cache.entries[i].listing;
+  }
+  for (unsigned int i = 0; i < listings_count; i++) {
+    bool known = listings[i] == NULL;
+    for (unsigned int j = 0; j < seen_count && !known; j++) {
+      known = seen[j] == listings[i];
+    }
+    if (!known) {
+      seen[seen_count++] = listings[i];
+      memory += FilesArray_memory(&listings[i]->files);
+    }
+  }
+  *count = seen_count;
+  return memory;
+}
 
-  Window *first_window = app->winmgr.first_window;
-  Window *second_window = app->winmgr.second_window;
+static int hit_rate(unsigned long hits, unsigned long misses) {
+  return hits + misses ? (int)(hits * 100 / (hits + misses)) : 0;
+}
 
+// Counters of last frame over top right corner of screen ("-debug")
+void draw_perf_overlay(App *app) {
+  WindowManager *wm = &app->winmgr;
   int terminal_size_y, terminal_size_x;
   getmaxyx(stdscr, terminal_size_y, terminal_size_x);
-
-  mvwprintw(stdscr, 0, 0, "Terminal size: {\n X: %d;\n Y: %d;\n}",
-            terminal_size_x, terminal_size_y);
-  // mvwprintw(stdscr, 3, 0, "Splitted window size: {\n X: %d;\n Y: %d;\n}",
-  //           getmaxx(second_window->curses_win),
-  //           getmaxy(second_window->curses_win));
-  //
-  // draw_window(app, app->winmgr.first_window);
-  int first_win_sizeX, first_win_sizeY;
-  getmaxyx(first_window->curses_win, first_win_sizeY, first_win_sizeX);
-  first_win_sizeY -= STATUSLINE_HEIGHT;
-  mvwprintw(stdscr, 4, 0, "Window size: {\n X: %d;\n Y: %d;\n}",
-            first_win_sizeX, first_win_sizeY);
-
-  refresh();
+  int size_y = 10, size_x = PERF_OVERLAY_WIDTH;
+  int start_x = terminal_size_x - size_x - 1;
+  if (start_x < 0 || terminal_size_y < size_y + 1) {
+    return;
+  }
+  if (app->perf_overlay == NULL) {
+    app->perf_overlay = newwin(size_y, size_x, 1, start_x);
+    if (app->perf_overlay == NULL) {
+      return;
+    }
+  } else if (getbegx(app->perf_overlay) != start_x) {
+    mvwin(app->perf_overlay, 1, start_x);
+  }
+  WINDOW *win = app->perf_overlay;
+  werase(win);
+  box(win, 0, 0);
+
+  char output[8], output_total[8], memory[8];
+  format_size(output, sizeof(output), perf.last_frame[PERF_TERM_BYTES]);
+  format_size(output_total, sizeof(output_total), atomic_load(&perf.counters[PERF_TERM_BYTES]));
+  unsigned int listings;
+  format_size(memory, sizeof(memory), listings_memory(wm, &listings));
+  mvwprintw(win, 1, 2, "frame  %.2f ms  p99 %.2f ms", Perf_frame_last() / 1e6, Perf_frame_p99() / 1e6);
+  mvwprintw(win, 2, 2, "chdir  read %.2f ms  sort %.2f ms", atomic_load(&perf.fill_ns) / 1e6,
+            atomic_load(&perf.sort_ns) / 1e6);
+  mvwprintw(win, 3, 2, "stat   %lu/frame  %lu total", perf.last_frame[PERF_STAT],
+            atomic_load(&perf.counters[PERF_STAT]));
+  mvwprintw(win, 4, 2, "dents  %lu/frame  %lu total", perf.last_frame[PERF_GETDENTS],
+            atomic_load(&perf.counters[PERF_GETDENTS]));
+  mvwprintw(win, 5, 2, "output %s/frame  %s total", output, output_total);
+  mvwprintw(win, 6, 2, "memory %s in %u listings", memory, listings);
+  mvwprintw(win, 7, 2, "hits   listing %d%%  preview %d%%", hit_rate(wm->cache.hits, wm->cache.misses),
+            hit_rate(wm->previewer.hits, wm->previewer.misses));
+  mvwprintw(win, 8, 2, "term   %dx%d", terminal_size_x, terminal_size_y);
+  // Windows under it may have been redrawn, overlay goes on top again
+  touchwin(win);
+  wnoutrefresh(win);
 }
 
 void draw(App *app) {
-  refresh();
-  // If debug mode is on
+  uint64_t trace_start = Trace_start();
+  // Windows redraw only changed rows,
+  // all of them go to terminal in one update
+  Window_draw(&app->winmgr, app->winmgr.first_window);
+  Window_draw(&app->winmgr, app->winmgr.second_window);
+  WindowManager_draw_preview(&app->winmgr);
   if (app->state.debug) {
-    draw_debug(app);
-    return;
+    draw_perf_overlay(app);
   }
+  Perf_output_begin();
+  doupdate();
+  Perf_output_end();
+  Trace_end("draw", trace_start, NULL);
+}
 
-  Window_draw(app->winmgr, app->winmgr.first_window);
-  Window_draw(app->winmgr, app->winmgr.second_window);
+// fcd results for picker
+typedef struct FcdSearch {
+  App *app;
+  char query[PATH_MAX];
+  uint32_t results[FCD_RESULTS_MAX];
+  unsigned int count;
+} FcdSearch;
+
+static void fcd_search(void *ctx, const char *query) {
+  FcdSearch *search = ctx;
+  // Search again with kept query (fcd_poll)
+  if (query != search->query) {
+    snprintf(search->query, sizeof(search->query), "%s", query);
+  }
+  search->count = DirIndex_query(&search->app->dir_index, query, search->results, FCD_RESULTS_MAX);
 }
 
-void move_highlight(Window *window, int jump_counter, bool move_down) {
-  if (!window->files.filenames) {
-    return;
+// Index rebuilt in background, search again in new one
+static bool fcd_poll(void *ctx) {
+  FcdSearch *search = ctx;
+  App *app = search->app;
+  if (!atomic_exchange(&app->dir_index_update.finished, false)) {
+    return false;
   }
+  DirIndex_close(&app->dir_index);
+  DirIndex_open(&app->dir_index, app->data_paths.dir_index);
+  fcd_search(search, search->query);
+  return true;
+}
 
-  int files_count = window->files.files_count;
-  int window_height = getmaxy(window->curses_win) - STATUSLINE_HEIGHT;
+static unsigned int fcd_count(void *ctx) {
+  return ((FcdSearch *)ctx)->count;
+}
 
-  if (move_down) {
-    if (window->highlight + 1 >= window->files.files_count) {
-      return;
-    }
-    // If try to jump to unexisting file position
-    if (jump_counter >= files_count ||
-        window->highlight + jump_counter + 1 > files_count) {
-      // Set highlight to last file index
-      window->highlight = files_count - 1; //-1 because we want last index
-    } else {
-      // if: jump_number != 0, add it
-      // else: add 1
-      window->highlight += jump_counter;
-    }
+static const char *fcd_item(void *ctx, unsigned int index) {
+  FcdSearch *search = ctx;
+  return DirIndex_path(&search->app->dir_index, search->results[index]);
+}
+
+void fcd(App *app) {
+  // Finished update may be waiting from before
+  fcd_poll(&(FcdSearch){.app = app});
+  DirIndexUpdate_start(&app->dir_index_update, app->data_paths.dir_index, FCD_INDEX_MAX_AGE_SEC);
+
+  FcdSearch search = {.app = app};
+  PickerSource source = {
+      .prompt = "cd ",
+      .ctx = &search,
+      .search = fcd_search,
+      .poll = fcd_poll,
+      .count = fcd_count,
+      .item = fcd_item,
+  };
+  unsigned int selected;
+  if (Picker_run(&app->winmgr, &source, &selected)) {
+    Window_chdir(fcd_item(&search, selected), app->winmgr.active_window);
+  }
+}
+
+static void ff_search(void *ctx, const char *query) {
+  Finder_search(ctx, query);
+}
 
-    // Scroll
-    int last_visible_file_idx = window_height + window->scroll;
+static unsigned int ff_count(void *ctx) {
+  return Finder_count(ctx);
+}
 
-    if (window->highlight + 1 >= last_visible_file_idx) {
+static const char *ff_item(void *ctx, unsigned int index) {
+  Finder *finder = ctx;
+  return FilesArray_name(finder->files, Finder_result(finder, index));
+}
 
-      if (window->highlight > files_count - window_height) {
-        window->scroll = files_count - window_height + 1;
-      } else {
-        window->scroll += jump_counter ? jump_counter : 1;
-      }
+// Fuzzy search in active window listing, highlight chosen file
+void ff(App *app) {
+  Window *win = app->winmgr.active_window;
+  Finder finder;
+  Finder_init(&finder, &win->listing->files);
+
+  PickerSource source = {
+      .prompt = "find ",
+      .ctx = &finder,
+      .search = ff_search,
+      .count = ff_count,
+      .item = ff_item,
+  };
+  unsigned int selected;
+  if (Picker_run(&app->winmgr, &source, &selected)) {
+    Window_select(win, Finder_result(&finder, selected));
+  }
+  Finder_free(&finder);
+}
+
+typedef struct FgContext {
+  Grep grep;
+  const char *root;
+} FgContext;
+
+static void fg_search(void *ctx, const char *query) {
+  FgContext *fg = ctx;
+  Grep_start(&fg->grep, fg->root, query);
+}
+
+// Hits stream in while picker is open
+static bool fg_poll(void *ctx) {
+  return Grep_poll(&((FgContext *)ctx)->grep);
+}
+
+static unsigned int fg_count(void *ctx) {
+  return Grep_count(&((FgContext *)ctx)->grep);
+}
+
+static const char *fg_item(void *ctx, unsigned int index) {
+  return Grep_result(&((FgContext *)ctx)->grep, index);
+}
+
+// Search content of files under active window directory,
+// go to directory of chosen file and highlight it
+void fg(App *app) {
+  Window *win = app->winmgr.active_window;
+  FgContext context = {.root = win->pwd};
+  Grep *grep = &context.grep;
+  Grep_init(grep);
+
+  PickerSource source = {
+      .prompt = "grep ",
+      .ctx = &context,
+      .search = fg_search,
+      .poll = fg_poll,
+      .count = fg_count,
+      .item = fg_item,
+  };
+  unsigned int selected;
+  if (Picker_run(&app->winmgr, &source, &selected)) {
+    char path[PATH_MAX];
+    char relative[PATH_MAX];
+    Grep_result_path(grep, selected, relative, sizeof(relative));
+    snprintf(path, sizeof(path), "%s/%s", strcmp(context.root, "/") == 0 ? "" : context.root, relative);
+    char *slash = strrchr(path, '/');
+    *slash = '\0';
+    if (Window_chdir(path[0] != '\0' ? path : "/", win) == SUCCESS) {
+      Window_select_name(win, slash + 1);
     }
-    return;
   }
+  Grep_free(grep);
+}
+
+// Frecency results for picker
+typedef struct JumpSearch {
+  Frecency *frecency;
+  FrecencyResult results[FRECENCY_RESULTS_MAX];
+  unsigned int count;
+} JumpSearch;
 
-  // Move up
-  if (window->highlight - 1 < 0) {
+static void jump_search(void *ctx, const char *query) {
+  JumpSearch *search = ctx;
+  search->count = Frecency_query(search->frecency, query, search->results, FRECENCY_RESULTS_MAX);
+}
+
+static unsigned int jump_count(void *ctx) {
+  return ((JumpSearch *)ctx)->count;
+}
+
+static const char *jump_item(void *ctx, unsigned int index) {
+  return ((JumpSearch *)ctx)->results[index].path;
+}
+
+void jump(App *app) {
+  JumpSearch search = {.frecency = &app->winmgr.frecency};
+  PickerSource source = {
+      .prompt = "jump ",
+      .ctx = &search,
+      .search = jump_search,
+      .count = jump_count,
+      .item = jump_item,
+  };
+  unsigned int selected;
+  if (Picker_run(&app->winmgr, &source, &selected)) {
+    // Copy, chdir records visit and may move results
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", jump_item(&search, selected));
+    Window_chdir(path, app->winmgr.active_window);
+  }
+}
+
+// Copy/move highlighted file of active window into directory of the other one
+void queue_job(App *app, JobType type) {
+  WindowManager *wm = &app->winmgr;
+  if (wm->window_counter < 2) {
     return;
   }
+  Window *src = wm->active_window;
+  Window *dest = src == wm->first_window ? wm->second_window : wm->first_window;
+  FilesArray *files = &src->listing->files;
+  if (files->files_count == 0 || src->highlight >= (int)files->files_count) {
+    return;
+  }
+  if (JobQueue_add(&wm->jobs, type, src->pwd, FilesArray_name(files, src->highlight), dest->pwd) ==
+      MALLOC_FAIL) {
+    App_exit(app, MALLOC_FAIL_MSG);
+  }
+}
 
-  if (jump_counter >= files_count || window->highlight - jump_counter < 0) {
-    window->highlight = 0;
-  } else {
-    window->highlight -= jump_counter ? jump_counter : 1;
+// Delete highlighted file of active window in background, its entry is
+// dropped from listing right away (put back if delete fails)
+void delete_file(App *app) {
+  Window *win = app->winmgr.active_window;
+  FilesArray *files = &win->listing->files;
+  if (files->files_count == 0 || win->highlight >= (int)files->files_count) {
+    return;
   }
-  // Scroll
-  if (window->highlight + 1 <= window->scroll) {
-    if (window->scroll - jump_counter < 0) {
-      window->scroll = 0;
-    } else {
-      window->scroll -= jump_counter ? jump_counter : 1;
-    }
+  const char *name = FilesArray_name(files, win->highlight);
+  char question[NAME_MAX + 16];
+  snprintf(question, sizeof(question), "Delete %s?", name);
+  if (!Window_confirm(win, question)) {
+    return;
+  }
+  int add_res = JobQueue_add(&app->winmgr.jobs, JOB_DELETE, win->pwd, name, NULL);
+  if (add_res == MALLOC_FAIL) {
+    App_exit(app, MALLOC_FAIL_MSG);
+  }
+  if (add_res == SUCCESS) {
+    WindowManager_patch_entry(&app->winmgr, win->pwd, name, true);
   }
-  return;
 }
 
 void input_handler(App *app, int user_input) {
@@ -159,15 +447,21 @@ void input_handler(App *app, int user_input) {
     }
 
     jump_counter = jump_counter * 10 + (user_input - '0');
-    user_input = getch();
+    user_input = getch_blocking();
   }
 
   switch (user_input) {
   // Create window
   case KEY_CREATE_WINDOW:
+    // Second window takes place of preview
+    if (app->winmgr.preview.open) {
+      WindowManager_toggle_preview(&app->winmgr);
+    }
     if (app->winmgr.window_counter == 1) {
       Window *win = malloc_wrap(app, sizeof(Window));
-      Window_create(win, &app->winmgr, NULL);
+      if (Window_create(win, &app->winmgr, NULL) == MALLOC_FAIL) {
+        free(win);
+      }
     }
     return;
 
@@ -192,21 +486,42 @@ void input_handler(App *app, int user_input) {
     }
     return;
 
+  case KEY_PREVIEW:
+    WindowManager_toggle_preview(&app->winmgr);
+    return;
+  case KEY_FILE_INFO:
+    app->winmgr.active_window->details = !app->winmgr.active_window->details;
+    return;
+  case KEY_SORT: {
+    Window *win = app->winmgr.active_window;
+    FileSort sort = win->sort;
+    sort.mode = (sort.mode + 1) % SORT_MODES_COUNT;
+    win->sort = sort;
+    Window_sort(win, sort);
+    return;
+  }
+  case KEY_SORT_DIRS_FIRST: {
+    Window *win = app->winmgr.active_window;
+    win->sort.dirs_first = !win->sort.dirs_first;
+    Window_sort(win, win->sort);
+    return;
+  }
+
   // Movement
   case KEY_DOWN:
   case KEY_NAVDOWN:
-    move_highlight(app->winmgr.active_window, jump_counter ? jump_counter : 1, true);
+    Window_move_highlight(app->winmgr.active_window, jump_counter ? jump_counter : 1, true);
     return;
 
   case KEY_UP:
   case KEY_NAVUP:
-    move_highlight(app->winmgr.active_window, jump_counter ? jump_counter : 1, false);
+    Window_move_highlight(app->winmgr.active_window, jump_counter ? jump_counter : 1, false);
     return;
 	case KEY_GOTO_FILE:
-		if (app->winmgr.active_window->files.files_count >= jump_counter) {
+		if (app->winmgr.active_window->listing->files.files_count >= jump_counter) {
 			app->winmgr.active_window->highlight = 0;
 			app->winmgr.active_window->scroll = 0;
-			move_highlight(app->winmgr.active_window, jump_counter, true);
+			Window_move_highlight(app->winmgr.active_window, jump_counter, true);
 		}
 		return;
   // CD ..
@@ -222,11 +537,8 @@ void input_handler(App *app, int user_input) {
 			if (!previous_pwd_dirname) {
 				return;
 			}
-      // Find previous directory name in current one
-			int found_file_index = charp_arr_find_element(previous_pwd_dirname + 1,app->winmgr.active_window->files.filenames);
-      if (found_file_index >= 0) {
-				move_highlight(app->winmgr.active_window, found_file_index, true);
-			}
+      // Highlight directory we came from
+      Window_select_name(app->winmgr.active_window, previous_pwd_dirname + 1);
     } else if (wchdir_res == MALLOC_FAIL) {
       App_exit(app, MALLOC_FAIL_MSG);
     }
@@ -240,22 +552,19 @@ void input_handler(App *app, int user_input) {
   case KEY_RIGHT:
   case KEY_SELECT_FILE:
   case KEY_SELECT_FILE1:
-    if (!app->winmgr.active_window->files.filenames) {
+    // File type is already known from listing,
+    // Window_chdir resolves filename relative to window pwd
+    int highlight = app->winmgr.active_window->highlight;
+    FilesArray *files = &app->winmgr.active_window->listing->files;
+    // Patch may leave entries allocated with none in them
+    if (files->files_count == 0 || highlight >= (int)files->files_count) {
       return;
     }
-    // Determine file type
-    int highlight = app->winmgr.active_window->highlight;
-    char *filename = app->winmgr.active_window->files.filenames[highlight];
-    char *win_pwd = app->winmgr.active_window->pwd;
-    char filepath[PATH_MAX];
-    strcpy(filepath, win_pwd);
-    strcat(filepath, "/");
-    strcpy(filepath, filename);
-
-    FileType filetype = get_filetype(filepath);
-    if (filetype == DIRECTORY) {
-      Window_chdir(filepath, app->winmgr.active_window);
-    } else { // TODO
+
+    if (files->entries[highlight].type == DIRECTORY) {
+      Window_chdir(FilesArray_name(files, highlight), app->winmgr.active_window);
+    } else if (!app->winmgr.preview.open) {
+      WindowManager_toggle_preview(&app->winmgr);
     }
 
     return;
@@ -263,6 +572,33 @@ void input_handler(App *app, int user_input) {
   case KEY_CLOSE_WINDOW:
     Window_close(&app->winmgr);
     return;
+  case KEY_COPY_FILE:
+    queue_job(app, JOB_COPY);
+    return;
+  case KEY_MOVE_FILE:
+    queue_job(app, JOB_MOVE);
+    return;
+  case KEY_DELETE_FILE:
+    delete_file(app);
+    return;
+  case KEY_CANCEL_JOBS:
+    JobQueue_cancel(&app->winmgr.jobs);
+    return;
+  case KEY_JUMP:
+    jump(app);
+    return;
+  // Find shortcuts: "ff", "fcd"
+  case KEY_FIND_FILE: {
+    int next_input = getch_blocking();
+    if (next_input == KEY_FIND_FILE) {
+      ff(app);
+    } else if (next_input == KEY_FIND_GREP) {
+      fg(app);
+    } else if (next_input == KEY_FIND_CD && getch_blocking() == KEY_FIND_CD1) {
+      fcd(app);
+    }
+    return;
+  }
   case KEY_RESIZE:
     Window_update_size(&app->winmgr);
     return;
@@ -271,22 +607,94 @@ void input_handler(App *app, int user_input) {
   }
 }
 
+// One row down (1) or up (-1) for plain motion keys, else 0
+static int motion_step(int user_input) {
+  switch (user_input) {
+  case KEY_DOWN:
+  case KEY_NAVDOWN:
+    return 1;
+  case KEY_UP:
+  case KEY_NAVUP:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+// Moved a row at a time, one jump of N scrolls differently than N single moves
+static void move_folded(App *app, int steps) {
+  if (steps != 0) {
+    uint64_t trace_start = Trace_start();
+    int count = steps > 0 ? steps : -steps;
+    for (int i = 0; i < count; i++) {
+      Window_move_highlight(app->winmgr.active_window, 1, steps > 0);
+    }
+    Trace_end("motion", trace_start, NULL);
+  }
+}
+
+// Handle key and whatever was typed after it, before next frame is drawn.
+// Runs of motions in one direction become one move, so a held key (or
+// typeahead over slow link) doesn't draw every position in between.
+// Returns true when user quits
+bool handle_input(App *app, int user_input) {
+  int steps = 0;
+  for (int keys = 1;; keys++) {
+    int step = motion_step(user_input);
+    // Direction changed, earlier run is moved first
+    if ((step > 0 && steps < 0) || (step < 0 && steps > 0) || step == 0) {
+      move_folded(app, steps);
+      steps = 0;
+    }
+    if (step != 0) {
+      steps += step;
+    } else if (user_input == 'q') {
+      return true;
+    } else {
+      uint64_t trace_start = Trace_start();
+      input_handler(app, user_input);
+      Trace_end("input", trace_start, keyname(user_input));
+      // Several chdirs may run before next frame, drop watch of each left directory now
+      WindowManager_update_watches(&app->winmgr);
+    }
+    // Rest waits for next frame
+    if (keys == INPUT_DRAIN_MAX || (user_input = getch()) == ERR) {
+      break;
+    }
+  }
+  move_folded(app, steps);
+  return false;
+}
+
 int main(int argc, char **argv) {
   setlocale(LC_CTYPE, "");
+  // For locale sort mode
+  setlocale(LC_COLLATE, "");
 
   App app = {0};
   init_ncurses();
   App_init(&app, argc, argv);
 
   // Main loop
-
-  int user_input;
-  while (user_input != 'q') {
+  // Input is read without blocking, loop sleeps in wait_events instead,
+  // so directories loading in background can update the screen
+  nodelay(stdscr, true);
+
+  bool quit = false;
+  while (!quit) {
+    Perf_frame_begin();
+    poll_background(&app);
     draw(&app);
+    Perf_frame_end();
 
-    user_input = getch();
-    input_handler(&app, user_input);
+    int user_input = getch();
+    if (user_input == ERR) {
+      wait_events(&app);
+      continue;
+    }
+    quit = handle_input(&app, user_input);
   }
 
+  App_save_session(&app);
   App_exit(&app, NULL);
 }
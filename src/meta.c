@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include "meta.h"
+#include "enums.h"
+#include "perf.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define META_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_SIZE | STATX_MTIME)
+
+// No liburing, rings are set up with plain syscalls
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void MetaRing_free(MetaRing *ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+  if (ring->sq_map != NULL) {
+    munmap(ring->sq_map, ring->sq_map_size);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static bool MetaRing_supports_statx(int fd) {
+  size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  if (probe == NULL) {
+    return false;
+  }
+  bool supported = io_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+                   probe->last_op >= IORING_OP_STATX &&
+                   (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return supported;
+}
+
+static int MetaRing_init(MetaRing *ring, int wake_fd) {
+  memset(ring, 0, sizeof(*ring));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // Completion ring twice as big, can't overflow with queue depth in flight
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = META_QUEUE_DEPTH * 2;
+  ring->fd = io_uring_setup(META_QUEUE_DEPTH, &params);
+  if (ring->fd < 0) {
+    ring->fd = -1;
+    return ERROR;
+  }
+  if (!MetaRing_supports_statx(ring->fd)) {
+    MetaRing_free(ring);
+    return ERROR;
+  }
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_map && ring->cq_map_size > ring->sq_map_size) {
+    ring->sq_map_size = ring->cq_map_size;
+  }
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    MetaRing_free(ring);
+    return ERROR;
+  }
+  if (single_map) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      MetaRing_free(ring);
+      return ERROR;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    MetaRing_free(ring);
+    return ERROR;
+  }
+
+  char *sq = ring->sq_map, *cq = ring->cq_map;
+  ring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+  ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+  ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+  ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+  ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+  ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  // Completions signal the same eventfd as threads do
+  if (io_uring_register(ring->fd, IORING_REGISTER_EVENTFD, &wake_fd, 1) < 0) {
+    MetaRing_free(ring);
+    return ERROR;
+  }
+  return SUCCESS;
+}
+
+static void MetaRing_prepare(MetaRing *ring, MetaRequest *request, uint32_t slot) {
+  uint32_t tail = *ring->sq_tail;
+  uint32_t index = tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = request->dir_fd;
+  sqe->addr = (uint64_t)(uintptr_t)request->name;
+  sqe->len = META_STATX_MASK;
+  sqe->off = (uint64_t)(uintptr_t)&request->stx;
+  sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+  sqe->user_data = slot;
+  ring->sq_array[index] = index;
+  // Entry must be visible before kernel sees new tail
+  atomic_store_explicit((_Atomic uint32_t *)ring->sq_tail, tail + 1, memory_order_release);
+  ring->unsubmitted++;
+}
+
+static void *MetaEngine_worker(void *arg) {
+  MetaEngine *engine = arg;
+  pthread_mutex_lock(&engine->lock);
+  while (true) {
+    while (!engine->stop && engine->queue_count == 0) {
+      pthread_cond_wait(&engine->cond, &engine->lock);
+    }
+    if (engine->stop) {
+      break;
+    }
+    uint32_t slot = engine->queue[engine->queue_head];
+    engine->queue_head = (engine->queue_head + 1) % META_QUEUE_DEPTH;
+    engine->queue_count--;
+    pthread_mutex_unlock(&engine->lock);
+
+    MetaRequest *request = &engine->requests[slot];
+    request->result = statx(request->dir_fd, request->name, AT_SYMLINK_NOFOLLOW, META_STATX_MASK,
+                            &request->stx) == 0 ? 0 : -errno;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->done[engine->done_count++] = slot;
+    // Wake main thread once per batch of results
+    if (engine->done_count == 1 || engine->queue_count == 0) {
+      uint64_t one = 1;
+      if (write(engine->wake_fd, &one, sizeof(one)) < 0) {
+        // Counter full, main thread is woken anyway
+      }
+    }
+  }
+  pthread_mutex_unlock(&engine->lock);
+  return NULL;
+}
+
+extern int MetaEngine_init(MetaEngine *engine) {
+  memset(engine, 0, sizeof(*engine));
+  engine->ring.fd = -1;
+  engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (engine->wake_fd < 0) {
+    return ERROR;
+  }
+  for (uint32_t i = 0; i < META_QUEUE_DEPTH; i++) {
+    engine->free_slots[i] = META_QUEUE_DEPTH - 1 - i;
+  }
+  engine->free_count = META_QUEUE_DEPTH;
+
+  if (MetaRing_init(&engine->ring, engine->wake_fd) == SUCCESS) {
+    engine->uring = true;
+    return SUCCESS;
+  }
+
+  pthread_mutex_init(&engine->lock, NULL);
+  pthread_cond_init(&engine->cond, NULL);
+  for (int i = 0; i < META_THREADS; i++) {
+    if (pthread_create(&engine->threads[i], NULL, MetaEngine_worker, engine) != 0) {
+      break;
+    }
+    engine->threads_count++;
+  }
+  if (engine->threads_count == 0) {
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->cond);
+    close(engine->wake_fd);
+    engine->wake_fd = -1;
+    return ERROR;
+  }
+  return SUCCESS;
+}
+
+extern bool MetaEngine_submit(MetaEngine *engine, int dir_fd, unsigned int pool_id, uint32_t index,
+                              const char *name) {
+  if (engine->free_count == 0 || engine->wake_fd < 0) {
+    return false;
+  }
+  uint32_t slot = engine->free_slots[--engine->free_count];
+  MetaRequest *request = &engine->requests[slot];
+  request->pool_id = pool_id;
+  request->index = index;
+  request->dir_fd = dir_fd;
+  snprintf(request->name, sizeof(request->name), "%s", name);
+  engine->submitted++;
+  Perf_count(PERF_STAT, 1);
+
+  if (engine->uring) {
+    MetaRing_prepare(&engine->ring, request, slot);
+    return true;
+  }
+  pthread_mutex_lock(&engine->lock);
+  engine->queue[(engine->queue_head + engine->queue_count) % META_QUEUE_DEPTH] = slot;
+  engine->queue_count++;
+  pthread_mutex_unlock(&engine->lock);
+  return true;
+}
+
+extern void MetaEngine_flush(MetaEngine *engine) {
+  if (engine->uring) {
+    if (engine->ring.unsubmitted == 0) {
+      return;
+    }
+    // One syscall for whole batch
+    int submitted = io_uring_enter(engine->ring.fd, engine->ring.unsubmitted, 0, 0);
+    if (submitted > 0) {
+      engine->ring.unsubmitted -= submitted;
+      engine->batches++;
+    }
+    return;
+  }
+  if (engine->threads_count > 0) {
+    pthread_mutex_lock(&engine->lock);
+    if (engine->queue_count > 0) {
+      pthread_cond_broadcast(&engine->cond);
+      engine->batches++;
+    }
+    pthread_mutex_unlock(&engine->lock);
+  }
+}
+
+static void MetaEngine_finish(MetaEngine *engine, uint32_t slot, MetaDone done, void *ctx) {
+  done(ctx, &engine->requests[slot]);
+  engine->free_slots[engine->free_count++] = slot;
+}
+
+extern void MetaEngine_clear_wake(MetaEngine *engine) {
+  uint64_t value;
+  if (engine->wake_fd >= 0 && read(engine->wake_fd, &value, sizeof(value)) < 0) {
+    // Nothing signalled
+  }
+}
+
+extern unsigned int MetaEngine_reap(MetaEngine *engine, MetaDone done, void *ctx) {
+  if (engine->wake_fd < 0) {
+    return 0;
+  }
+  uint64_t value;
+  if (read(engine->wake_fd, &value, sizeof(value)) < 0) {
+    // Nothing signalled, there may still be completions from before
+  }
+
+  unsigned int reaped = 0;
+  if (engine->uring) {
+    MetaRing *ring = &engine->ring;
+    uint32_t head = *ring->cq_head;
+    uint32_t tail = atomic_load_explicit((_Atomic uint32_t *)ring->cq_tail, memory_order_acquire);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+      uint32_t slot = cqe->user_data;
+      engine->requests[slot].result = cqe->res;
+      MetaEngine_finish(engine, slot, done, ctx);
+      reaped++;
+    }
+    atomic_store_explicit((_Atomic uint32_t *)ring->cq_head, head, memory_order_release);
+  } else {
+    uint32_t slots[META_QUEUE_DEPTH];
+    pthread_mutex_lock(&engine->lock);
+    reaped = engine->done_count;
+    memcpy(slots, engine->done, reaped * sizeof(uint32_t));
+    engine->done_count = 0;
+    pthread_mutex_unlock(&engine->lock);
+    for (unsigned int i = 0; i < reaped; i++) {
+      MetaEngine_finish(engine, slots[i], done, ctx);
+    }
+  }
+
+  if (engine->free_count == META_QUEUE_DEPTH) {
+    for (unsigned int i = 0; i < engine->closing_count; i++) {
+      close(engine->closing[i]);
+    }
+    engine->closing_count = 0;
+  }
+  return reaped;
+}
+
+extern void MetaEngine_close_dir(MetaEngine *engine, int dir_fd) {
+  if (dir_fd < 0) {
+    return;
+  }
+  if (engine->free_count == META_QUEUE_DEPTH || engine->closing_count == META_QUEUE_DEPTH) {
+    close(dir_fd);
+    return;
+  }
+  engine->closing[engine->closing_count++] = dir_fd;
+}
+
+typedef struct UserName {
+  uint32_t uid;
+  bool used;
+  char name[32];
+} UserName;
+
+extern const char *MetaEngine_user_name(uint32_t uid) {
+  // Few owners per directory, lookups go through NSS (files, network)
+  static UserName names[16];
+  UserName *slot = &names[uid % 16];
+  if (!slot->used || slot->uid != uid) {
+    struct passwd *pw = getpwuid(uid);
+    if (pw != NULL) {
+      snprintf(slot->name, sizeof(slot->name), "%s", pw->pw_name);
+    } else {
+      snprintf(slot->name, sizeof(slot->name), "%u", uid);
+    }
+    slot->uid = uid;
+    slot->used = true;
+  }
+  return slot->name;
+}
+
+static void MetaEngine_ignore(void *ctx, const MetaRequest *request) {
+  (void)ctx;
+  (void)request;
+}
+
+extern void MetaEngine_free(MetaEngine *engine) {
+  if (engine->wake_fd < 0) {
+    return;
+  }
+  if (engine->uring) {
+    // Kernel writes into requests until they complete
+    MetaEngine_flush(engine);
+    while (engine->free_count + engine->ring.unsubmitted < META_QUEUE_DEPTH) {
+      unsigned int in_flight = META_QUEUE_DEPTH - engine->free_count - engine->ring.unsubmitted;
+      if (io_uring_enter(engine->ring.fd, 0, in_flight, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        break;
+      }
+      MetaEngine_reap(engine, MetaEngine_ignore, NULL);
+    }
+    MetaRing_free(&engine->ring);
+  } else {
+    pthread_mutex_lock(&engine->lock);
+    engine->stop = true;
+    pthread_cond_broadcast(&engine->cond);
+    pthread_mutex_unlock(&engine->lock);
+    for (unsigned int i = 0; i < engine->threads_count; i++) {
+      pthread_join(engine->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->cond);
+  }
+  for (unsigned int i = 0; i < engine->closing_count; i++) {
+    close(engine->closing[i]);
+  }
+  close(engine->wake_fd);
+  engine->wake_fd = -1;
+}
@@ -0,0 +1,101 @@
+#ifndef META_H
+#define META_H
+
+#include "config.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/stat.h>
+
+// One statx of name relative to dir_fd, result is matched back to
+// listing by pool_id and index (and name, entries may have moved)
+typedef struct MetaRequest {
+  unsigned int pool_id;
+  uint32_t index;
+  int dir_fd;
+  int result;
+  struct statx stx;
+  char name[NAME_MAX + 1];
+} MetaRequest;
+
+typedef struct MetaRing {
+  int fd;
+  void *sq_map, *cq_map;
+  size_t sq_map_size, cq_map_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  uint32_t *sq_head, *sq_tail, *sq_array;
+  uint32_t sq_mask;
+  uint32_t *cq_head, *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  // Prepared, not yet submitted
+  unsigned int unsubmitted;
+} MetaRing;
+
+// Metadata fetcher for details view.
+// Requests are submitted in batches through io_uring (IORING_OP_STATX,
+// one io_uring_enter per batch), or handed to META_THREADS threads
+// when kernel doesn't support it. Finished requests are reaped on main
+// thread, wake_fd becomes readable when there are any
+typedef struct MetaEngine {
+  bool uring;
+  MetaRing ring;
+  pthread_t threads[META_THREADS];
+  unsigned int threads_count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Queued and finished slot indices (ring buffers, guarded by lock)
+  uint32_t queue[META_QUEUE_DEPTH];
+  uint32_t queue_head, queue_count;
+  uint32_t done[META_QUEUE_DEPTH];
+  uint32_t done_count;
+  bool stop;
+  int wake_fd;
+  MetaRequest requests[META_QUEUE_DEPTH];
+  uint32_t free_slots[META_QUEUE_DEPTH];
+  uint32_t free_count;
+  // Directory fds closed once nothing in flight can use them
+  int closing[META_QUEUE_DEPTH];
+  unsigned int closing_count;
+  uint64_t submitted;
+  uint64_t batches;
+} MetaEngine;
+
+typedef void (*MetaDone)(void *ctx, const MetaRequest *request);
+
+extern int MetaEngine_init(MetaEngine *engine);
+
+// Readable when finished requests are waiting for MetaEngine_reap
+static inline int MetaEngine_fd(const MetaEngine *engine) {
+  return engine->wake_fd;
+}
+
+static inline bool MetaEngine_full(const MetaEngine *engine) {
+  return engine->free_count == 0;
+}
+
+// Queue statx of name in dir_fd. Returns false when queue is full.
+// Nothing is sent until MetaEngine_flush
+extern bool MetaEngine_submit(MetaEngine *engine, int dir_fd, unsigned int pool_id, uint32_t index,
+                              const char *name);
+
+extern void MetaEngine_flush(MetaEngine *engine);
+
+// Pass finished requests to done, returns how many
+extern unsigned int MetaEngine_reap(MetaEngine *engine, MetaDone done, void *ctx);
+
+// Reset wake fd once poll() saw it (signal may come after last reap)
+extern void MetaEngine_clear_wake(MetaEngine *engine);
+
+// Close directory fd of requests once none of them is in flight
+extern void MetaEngine_close_dir(MetaEngine *engine, int dir_fd);
+
+// Owner name of uid (cached), number if it has no name
+extern const char *MetaEngine_user_name(uint32_t uid);
+
+// Waits for requests in flight
+extern void MetaEngine_free(MetaEngine *engine);
+
+#endif
@@ -0,0 +1,84 @@
+#include "perf.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+Perf perf = {.io_fd = -1};
+
+extern uint64_t perf_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+extern void Perf_enable(void) {
+  perf.enabled = true;
+  perf.io_fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+}
+
+// Bytes written by calling thread so far, 0 if unknown
+static unsigned long perf_written(void) {
+  char buffer[512];
+  ssize_t len = perf.io_fd >= 0 ? pread(perf.io_fd, buffer, sizeof(buffer) - 1, 0) : -1;
+  if (len <= 0) {
+    return 0;
+  }
+  buffer[len] = '\0';
+  const char *wchar = strstr(buffer, "wchar:");
+  return wchar ? strtoul(wchar + 6, NULL, 10) : 0;
+}
+
+extern void Perf_output_begin(void) {
+  if (perf.enabled) {
+    perf.output_start = perf_written();
+  }
+}
+
+extern void Perf_output_end(void) {
+  if (perf.enabled) {
+    unsigned long written = perf_written();
+    Perf_count(PERF_TERM_BYTES, written > perf.output_start ? written - perf.output_start : 0);
+  }
+}
+
+extern void Perf_frame_begin(void) {
+  if (!perf.enabled) {
+    return;
+  }
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    perf.frame_counters[i] = atomic_load_explicit(&perf.counters[i], memory_order_relaxed);
+  }
+  perf.frame_start_ns = perf_clock_ns();
+}
+
+extern void Perf_frame_end(void) {
+  if (!perf.enabled) {
+    return;
+  }
+  perf.frames[perf.frames_next] = perf_clock_ns() - perf.frame_start_ns;
+  perf.frames_next = (perf.frames_next + 1) % PERF_FRAMES;
+  if (perf.frames_count < PERF_FRAMES) {
+    perf.frames_count++;
+  }
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    perf.last_frame[i] = atomic_load_explicit(&perf.counters[i], memory_order_relaxed) - perf.frame_counters[i];
+  }
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+extern uint64_t Perf_frame_p99(void) {
+  if (perf.frames_count == 0) {
+    return 0;
+  }
+  uint64_t sorted[PERF_FRAMES];
+  memcpy(sorted, perf.frames, perf.frames_count * sizeof(uint64_t));
+  qsort(sorted, perf.frames_count, sizeof(uint64_t), compare_u64);
+  return sorted[(perf.frames_count * 99 - 1) / 100];
+}
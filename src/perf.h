@@ -0,0 +1,81 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "config.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum PerfCounter {
+  // stat family calls of listing paths (statx through meta engine too)
+  PERF_STAT,
+  PERF_GETDENTS,
+  PERF_TERM_BYTES,
+  PERF_COUNTERS
+} PerfCounter;
+
+// Instrumentation for debug overlay ("-debug").
+// Disabled, every record is one branch on perf.enabled (no clock reads,
+// no atomics). Enabled, counters are relaxed atomic adds, so loader
+// threads count too. Frame fields are main thread only
+typedef struct Perf {
+  bool enabled;
+  atomic_ulong counters[PERF_COUNTERS];
+  // Counters when current frame started, and what last frame added
+  unsigned long frame_counters[PERF_COUNTERS];
+  unsigned long last_frame[PERF_COUNTERS];
+  uint64_t frame_start_ns;
+  // Durations of last PERF_FRAMES frames, ns
+  uint64_t frames[PERF_FRAMES];
+  unsigned int frames_count;
+  unsigned int frames_next;
+  // Latest directory read and sort
+  atomic_ulong fill_ns;
+  atomic_ulong sort_ns;
+  // /proc/thread-self/io of main thread, its write() bytes around doupdate
+  // are what terminal got
+  int io_fd;
+  unsigned long output_start;
+} Perf;
+
+extern Perf perf;
+
+extern uint64_t perf_clock_ns(void);
+
+// Start recording (main thread, before other threads count)
+extern void Perf_enable(void);
+
+static inline void Perf_count(PerfCounter counter, unsigned long n) {
+  if (perf.enabled) {
+    atomic_fetch_add_explicit(&perf.counters[counter], n, memory_order_relaxed);
+  }
+}
+
+// Start of timed section, 0 when disabled
+static inline uint64_t Perf_start(void) {
+  return perf.enabled ? perf_clock_ns() : 0;
+}
+
+// Store time since start into *dest
+static inline void Perf_done(atomic_ulong *dest, uint64_t start) {
+  if (start != 0) {
+    atomic_store_explicit(dest, perf_clock_ns() - start, memory_order_relaxed);
+  }
+}
+
+extern void Perf_frame_begin(void);
+
+// Around terminal update: bytes written in between count as PERF_TERM_BYTES
+extern void Perf_output_begin(void);
+extern void Perf_output_end(void);
+
+extern void Perf_frame_end(void);
+
+// Frame time at or below which 99% of last frames are, ns
+extern uint64_t Perf_frame_p99(void);
+
+static inline uint64_t Perf_frame_last(void) {
+  return perf.frames_count ? perf.frames[(perf.frames_next + PERF_FRAMES - 1) % PERF_FRAMES] : 0;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "picker.h"
+#include "config.h"
+#include <string.h>
+
+#define PICKER_KEY_ESCAPE 27
+#define PICKER_KEY_CTRL_N 14
+#define PICKER_KEY_CTRL_P 16
+#define PICKER_KEY_CTRL_U 21
+
+static void Picker_draw(Window *win, PickerSource *source, const char *query,
+                        unsigned int highlight, unsigned int scroll) {
+  int size_y, size_x;
+  getmaxyx(win->curses_win, size_y, size_x);
+  int win_limit = size_y - STATUSLINE_HEIGHT;
+  unsigned int count = source->count(source->ctx);
+
+  werase(win->curses_win);
+  box(win->curses_win, 0, 0);
+
+  wchar_t line[size_x];
+  for (int y = 1; y < win_limit; y++) {
+    unsigned int i = scroll + y - 1;
+    if (i >= count) {
+      break;
+    }
+    trim_text(false, line, source->item(source->ctx, i), size_x - 3);
+    if (i == highlight) {
+      wattron(win->curses_win, A_REVERSE);
+    }
+    mvwaddwstr(win->curses_win, y, 1, line);
+    wattroff(win->curses_win, A_REVERSE);
+  }
+
+  // Query on status line, results count at its end
+  int status_line_y = size_y - STATUSLINE_HEIGHT;
+  mvwhline(win->curses_win, status_line_y, 1, '-', size_x - 2);
+  char counter[32];
+  snprintf(counter, sizeof(counter), " %u", count);
+  int counter_len = strlen(counter);
+  char prompt[PATH_MAX + 64];
+  snprintf(prompt, sizeof(prompt), "%s%s", source->prompt, query);
+  int prompt_columns = size_x - 3 - counter_len;
+  if (prompt_columns > 0) {
+    trim_text(true, line, prompt, prompt_columns);
+    mvwaddwstr(win->curses_win, status_line_y + 1, 1, line);
+    mvwaddstr(win->curses_win, status_line_y + 1, size_x - 1 - counter_len, counter);
+  }
+  wrefresh(win->curses_win);
+}
+
+extern bool Picker_run(WindowManager *wm, PickerSource *source, unsigned int *selected) {
+  Window *win = wm->active_window;
+  char query[PATH_MAX] = "";
+  size_t query_len = 0;
+  unsigned int highlight = 0, scroll = 0;
+  bool chosen = false;
+
+  set_escdelay(25);
+  // Sources with background work are polled between keys
+  timeout(source->poll ? PICKER_POLL_MS : -1);
+  source->search(source->ctx, query);
+
+  bool dirty = true;
+  while (true) {
+    unsigned int count = source->count(source->ctx);
+    int rows = getmaxy(win->curses_win) - STATUSLINE_HEIGHT - 1;
+    if (highlight >= count) {
+      highlight = count ? count - 1 : 0;
+    }
+    if (highlight < scroll) {
+      scroll = highlight;
+    } else if (rows > 0 && highlight >= scroll + rows) {
+      scroll = highlight - rows + 1;
+    }
+    if (dirty) {
+      Picker_draw(win, source, query, highlight, scroll);
+      dirty = false;
+    }
+
+    int user_input = getch();
+    if (user_input == ERR) {
+      dirty = source->poll && source->poll(source->ctx);
+      continue;
+    }
+    dirty = true;
+
+    if (user_input == PICKER_KEY_ESCAPE) {
+      break;
+    }
+    if (user_input == KEY_SELECT_FILE1 || user_input == KEY_ENTER) {
+      if (count > 0) {
+        *selected = highlight;
+        chosen = true;
+      }
+      break;
+    }
+    switch (user_input) {
+    case KEY_DOWN:
+    case PICKER_KEY_CTRL_N:
+      if (highlight + 1 < count) {
+        highlight++;
+      }
+      continue;
+    case KEY_UP:
+    case PICKER_KEY_CTRL_P:
+      if (highlight > 0) {
+        highlight--;
+      }
+      continue;
+    case KEY_RESIZE:
+      // Curses windows are recreated
+      Window_update_size(wm);
+      win = wm->active_window;
+      continue;
+    case KEY_BACKSPACE:
+    case 127:
+    case '\b':
+      if (query_len == 0) {
+        continue;
+      }
+      // Drop whole UTF-8 sequence
+      do {
+        query_len--;
+      } while (query_len > 0 && ((unsigned char)query[query_len] & 0xC0) == 0x80);
+      break;
+    case PICKER_KEY_CTRL_U:
+      query_len = 0;
+      break;
+    default:
+      if (user_input < ' ' || user_input > 0xFF || query_len + 1 >= sizeof(query)) {
+        continue;
+      }
+      query[query_len++] = user_input;
+      break;
+    }
+    query[query_len] = '\0';
+    highlight = 0;
+    scroll = 0;
+    source->search(source->ctx, query);
+  }
+
+  nodelay(stdscr, true);
+  Window_clear(wm->active_window);
+  return chosen;
+}
@@ -0,0 +1,24 @@
+#ifndef PICKER_H
+#define PICKER_H
+
+#include "window.h"
+#include <stdbool.h>
+
+// Results list with query typed on status line, drawn over a window.
+// Source keeps results itself, picker only asks for rows it draws
+typedef struct PickerSource {
+  const char *prompt;
+  void *ctx;
+  // Query changed, recompute results
+  void (*search)(void *ctx, const char *query);
+  // Called while idle, true if results changed (e.g background work). May be NULL
+  bool (*poll)(void *ctx);
+  unsigned int (*count)(void *ctx);
+  const char *(*item)(void *ctx, unsigned int index);
+} PickerSource;
+
+// Run picker over active window until Enter or Esc.
+// Returns true and index of chosen result on Enter
+extern bool Picker_run(WindowManager *wm, PickerSource *source, unsigned int *selected);
+
+#endif
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include "preview.h"
+#include "enums.h"
+#include "perf.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WORD_HIGH_BITS 0x8080808080808080ULL
+#define WORD_LOW_BITS 0x0101010101010101ULL
+
+extern bool preview_is_binary(const char *data, size_t len) {
+  const unsigned char *pos = (const unsigned char *)data;
+  const unsigned char *end = pos + len;
+  while (pos < end) {
+    // 8 bytes at a time while they are ASCII without NUL
+    if (end - pos >= 8) {
+      uint64_t word;
+      memcpy(&word, pos, sizeof(word));
+      uint64_t has_zero = (word - WORD_LOW_BITS) & ~word & WORD_HIGH_BITS;
+      if (((word & WORD_HIGH_BITS) | has_zero) == 0) {
+        pos += 8;
+        continue;
+      }
+    }
+
+    unsigned char byte = *pos;
+    if (byte == 0) {
+      return true;
+    }
+    if (byte < 0x80) {
+      pos++;
+      continue;
+    }
+    int extra;
+    uint32_t min;
+    if ((byte & 0xe0) == 0xc0) {
+      extra = 1;
+      min = 0x80;
+    } else if ((byte & 0xf0) == 0xe0) {
+      extra = 2;
+      min = 0x800;
+    } else if ((byte & 0xf8) == 0xf0) {
+      extra = 3;
+      min = 0x10000;
+    } else {
+      return true;
+    }
+    if (end - pos <= extra) {
+      // Cut by read budget
+      return false;
+    }
+    uint32_t code = byte & (0x3f >> extra);
+    for (int i = 1; i <= extra; i++) {
+      if ((pos[i] & 0xc0) != 0x80) {
+        return true;
+      }
+      code = (code << 6) | (pos[i] & 0x3f);
+    }
+    if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) {
+      return true;
+    }
+    pos += extra + 1;
+  }
+  return false;
+}
+
+static void PreviewKey_from_stat(PreviewKey *key, const struct stat *st) {
+  key->dev = st->st_dev;
+  key->ino = st->st_ino;
+  key->mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  key->size = st->st_size;
+}
+
+static bool PreviewKey_equal(const PreviewKey *a, const PreviewKey *b) {
+  return a->dev == b->dev && a->ino == b->ino && a->mtime == b->mtime && a->size == b->size;
+}
+
+// Read head of path into entry (worker thread)
+static void preview_read(PreviewEntry *entry, const char *path) {
+  memset(entry, 0, sizeof(*entry));
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+
+  // Nonblocking, so fifos don't hang worker
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0) {
+    entry->error = errno;
+    if (stat(path, &st) == 0) {
+      PreviewKey_from_stat(&entry->key, &st);
+    }
+    return;
+  }
+  if (fstat(fd, &st) < 0) {
+    entry->error = errno;
+    close(fd);
+    return;
+  }
+  PreviewKey_from_stat(&entry->key, &st);
+  if (!S_ISREG(st.st_mode)) {
+    entry->error = EISDIR;
+    close(fd);
+    return;
+  }
+
+  // Some files report size 0 and still have content (procfs)
+  size_t want = st.st_size > 0 && st.st_size < PREVIEW_MAX_BYTES ? (size_t)st.st_size : PREVIEW_MAX_BYTES;
+  entry->data = malloc(want);
+  if (entry->data == NULL) {
+    entry->error = ENOMEM;
+    close(fd);
+    return;
+  }
+  while (entry->len < want) {
+    ssize_t read_bytes = pread(fd, entry->data + entry->len, want - entry->len, entry->len);
+    if (read_bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      entry->error = errno;
+      break;
+    }
+    if (read_bytes == 0) {
+      break;
+    }
+    entry->len += read_bytes;
+  }
+  close(fd);
+  entry->binary = preview_is_binary(entry->data, entry->len);
+}
+
+static void *Previewer_worker(void *arg) {
+  Previewer *previewer = arg;
+  unsigned int slot = 0;
+  pthread_mutex_lock(&previewer->lock);
+  // Slot in reading, so main thread doesn't ask for the same file again
+  for (; slot < PREVIEW_THREADS && !pthread_equal(previewer->threads[slot], pthread_self()); slot++) {
+  }
+  for (;;) {
+    while (!previewer->stop && previewer->queue_count == 0) {
+      pthread_cond_wait(&previewer->cond, &previewer->lock);
+    }
+    if (previewer->stop) {
+      break;
+    }
+    char path[PATH_MAX];
+    memcpy(path, previewer->queue[0], sizeof(path));
+    previewer->queue_count--;
+    memmove(previewer->queue[0], previewer->queue[1], previewer->queue_count * sizeof(previewer->queue[0]));
+    if (slot < PREVIEW_THREADS) {
+      memcpy(previewer->reading[slot], path, sizeof(path));
+    }
+    pthread_mutex_unlock(&previewer->lock);
+
+    PreviewEntry entry;
+    uint64_t trace_start = Trace_start();
+    preview_read(&entry, path);
+    Trace_end("preview", trace_start, path);
+
+    pthread_mutex_lock(&previewer->lock);
+    if (slot < PREVIEW_THREADS) {
+      previewer->reading[slot][0] = '\0';
+    }
+    if (previewer->done_count < PREVIEW_THREADS * 2) {
+      previewer->done[previewer->done_count++] = entry;
+    } else {
+      // Main thread is behind, file is read again when wanted
+      free(entry.data);
+    }
+    uint64_t one = 1;
+    if (write(previewer->wake_fd, &one, sizeof(one)) < 0) {
+      // Counter full, main thread is woken anyway
+    }
+  }
+  pthread_mutex_unlock(&previewer->lock);
+  return NULL;
+}
+
+extern int Previewer_init(Previewer *previewer) {
+  memset(previewer, 0, sizeof(*previewer));
+  previewer->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (previewer->wake_fd < 0) {
+    return ERROR;
+  }
+  pthread_mutex_init(&previewer->lock, NULL);
+  pthread_cond_init(&previewer->cond, NULL);
+  // Workers find their reading slot by thread id, created under lock
+  pthread_mutex_lock(&previewer->lock);
+  for (int i = 0; i < PREVIEW_THREADS; i++) {
+    if (pthread_create(&previewer->threads[i], NULL, Previewer_worker, previewer) != 0) {
+      break;
+    }
+    previewer->threads_count++;
+  }
+  pthread_mutex_unlock(&previewer->lock);
+  if (previewer->threads_count == 0) {
+    Previewer_free(previewer);
+    return ERROR;
+  }
+  return SUCCESS;
+}
+
+static PreviewEntry *Previewer_find(Previewer *previewer, const char *path) {
+  for (unsigned int i = 0; i < previewer->cache_count; i++) {
+    if (strcmp(previewer->cache[i].path, path) == 0) {
+      return &previewer->cache[i];
+    }
+  }
+  return NULL;
+}
+
+extern const PreviewEntry *Previewer_get(Previewer *previewer, const char *path) {
+  PreviewEntry *entry = Previewer_find(previewer, path);
+  struct stat st;
+  if (entry != NULL) {
+    Perf_count(PERF_STAT, 1);
+  }
+  if (entry == NULL) {
+    previewer->misses++;
+    return NULL;
+  }
+  if (stat(path, &st) < 0) {
+    // Still failing the same way (dangling symlink, file gone): read failed too
+    if (entry->error != 0 && entry->error == errno) {
+      previewer->hits++;
+      entry->last_used = ++previewer->tick;
+      return entry;
+    }
+    previewer->misses++;
+    return NULL;
+  }
+  PreviewKey key;
+  PreviewKey_from_stat(&key, &st);
+  if (!PreviewKey_equal(&key, &entry->key)) {
+    previewer->misses++;
+    return NULL;
+  }
+  previewer->hits++;
+  entry->last_used = ++previewer->tick;
+  return entry;
+}
+
+extern void Previewer_request(Previewer *previewer, const char *const *paths, unsigned int count) {
+  if (previewer->threads_count == 0) {
+    return;
+  }
+  pthread_mutex_lock(&previewer->lock);
+  previewer->queue_count = 0;
+  for (unsigned int i = 0; i < count && previewer->queue_count < PREVIEW_PREFETCH_ROWS + 1; i++) {
+    // First one is asked for only when it is not cached (or changed)
+    if (i > 0 && Previewer_find(previewer, paths[i]) != NULL) {
+      continue;
+    }
+    bool reading = false;
+    for (unsigned int t = 0; t < PREVIEW_THREADS; t++) {
+      reading = reading || strcmp(previewer->reading[t], paths[i]) == 0;
+    }
+    if (!reading) {
+      snprintf(previewer->queue[previewer->queue_count++], PATH_MAX, "%s", paths[i]);
+    }
+  }
+  if (previewer->queue_count > 0) {
+    pthread_cond_broadcast(&previewer->cond);
+  }
+  pthread_mutex_unlock(&previewer->lock);
+}
+
+extern void Previewer_want(Previewer *previewer, const char *path) {
+  if (previewer->threads_count == 0) {
+    return;
+  }
+  // Failed last time, asked again only when highlight comes back to it
+  // (reading it on every redraw would never end)
+  const PreviewEntry *cached = Previewer_find(previewer, path);
+  if (cached != NULL && cached->error != 0) {
+    return;
+  }
+  pthread_mutex_lock(&previewer->lock);
+  bool pending = false;
+  for (unsigned int t = 0; t < PREVIEW_THREADS; t++) {
+    pending = pending || strcmp(previewer->reading[t], path) == 0;
+  }
+  for (unsigned int i = 0; i < previewer->queue_count; i++) {
+    pending = pending || strcmp(previewer->queue[i], path) == 0;
+  }
+  if (!pending) {
+    if (previewer->queue_count < PREVIEW_PREFETCH_ROWS + 1) {
+      previewer->queue_count++;
+    }
+    memmove(previewer->queue[1], previewer->queue[0], (previewer->queue_count - 1) * sizeof(previewer->queue[0]));
+    snprintf(previewer->queue[0], PATH_MAX, "%s", path);
+    pthread_cond_broadcast(&previewer->cond);
+  }
+  pthread_mutex_unlock(&previewer->lock);
+}
+
+static void Previewer_put(Previewer *previewer, const PreviewEntry *entry) {
+  PreviewEntry *slot = Previewer_find(previewer, entry->path);
+  if (slot == NULL && previewer->cache_count < PREVIEW_CACHE_SIZE) {
+    slot = &previewer->cache[previewer->cache_count++];
+  } else if (slot == NULL) {
+    // Least recently used
+    slot = &previewer->cache[0];
+    for (unsigned int i = 1; i < previewer->cache_count; i++) {
+      if (previewer->cache[i].last_used < slot->last_used) {
+        slot = &previewer->cache[i];
+      }
+    }
+  }
+  free(slot->data);
+  *slot = *entry;
+  slot->last_used = ++previewer->tick;
+}
+
+extern bool Previewer_poll(Previewer *previewer) {
+  if (previewer->threads_count == 0) {
+    return false;
+  }
+  uint64_t value;
+  if (read(previewer->wake_fd, &value, sizeof(value)) < 0) {
+    // Nothing signalled
+  }
+  PreviewEntry done[PREVIEW_THREADS * 2];
+  pthread_mutex_lock(&previewer->lock);
+  unsigned int done_count = previewer->done_count;
+  memcpy(done, previewer->done, done_count * sizeof(PreviewEntry));
+  previewer->done_count = 0;
+  pthread_mutex_unlock(&previewer->lock);
+
+  for (unsigned int i = 0; i < done_count; i++) {
+    Previewer_put(previewer, &done[i]);
+  }
+  return done_count > 0;
+}
+
+extern void Previewer_free(Previewer *previewer) {
+  if (previewer->wake_fd < 0) {
+    return;
+  }
+  if (previewer->threads_count > 0) {
+    pthread_mutex_lock(&previewer->lock);
+    previewer->stop = true;
+    pthread_cond_broadcast(&previewer->cond);
+    pthread_mutex_unlock(&previewer->lock);
+    for (unsigned int i = 0; i < previewer->threads_count; i++) {
+      pthread_join(previewer->threads[i], NULL);
+    }
+    previewer->threads_count = 0;
+  }
+  for (unsigned int i = 0; i < previewer->done_count; i++) {
+    free(previewer->done[i].data);
+  }
+  for (unsigned int i = 0; i < previewer->cache_count; i++) {
+    free(previewer->cache[i].data);
+  }
+  previewer->done_count = 0;
+  previewer->cache_count = 0;
+  pthread_mutex_destroy(&previewer->lock);
+  pthread_cond_destroy(&previewer->cond);
+  close(previewer->wake_fd);
+  previewer->wake_fd = -1;
+}
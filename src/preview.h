@@ -0,0 +1,82 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "config.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// File version a preview was read from
+typedef struct PreviewKey {
+  dev_t dev;
+  ino_t ino;
+  int64_t mtime;
+  off_t size;
+} PreviewKey;
+
+typedef struct PreviewEntry {
+  PreviewKey key;
+  char path[PATH_MAX];
+  // Head of file, at most PREVIEW_MAX_BYTES
+  char *data;
+  size_t len;
+  bool binary;
+  // errno if file could not be read (EISDIR for anything not regular), else 0
+  int error;
+  unsigned long last_used;
+} PreviewEntry;
+
+// Heads of files for preview pane, read by PREVIEW_THREADS workers with
+// bounded pread and kept in LRU cache validated by inode and mtime.
+// Only the latest requested paths are read, older requests are dropped
+// (moving fast over listing doesn't queue reads of every passed file).
+// Cache is main thread only, wake_fd is readable when reads finished
+typedef struct Previewer {
+  PreviewEntry cache[PREVIEW_CACHE_SIZE];
+  unsigned int cache_count;
+  unsigned long tick;
+  pthread_t threads[PREVIEW_THREADS];
+  unsigned int threads_count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Guarded by lock
+  char queue[PREVIEW_PREFETCH_ROWS + 1][PATH_MAX];
+  unsigned int queue_count;
+  char reading[PREVIEW_THREADS][PATH_MAX];
+  PreviewEntry done[PREVIEW_THREADS * 2];
+  unsigned int done_count;
+  bool stop;
+  int wake_fd;
+  unsigned long hits;
+  unsigned long misses;
+} Previewer;
+
+extern int Previewer_init(Previewer *previewer);
+
+static inline int Previewer_fd(const Previewer *previewer) {
+  return previewer->wake_fd;
+}
+
+// Cached preview of path if file didn't change since (or still can't be
+// stat'd with the error its read had), else NULL
+extern const PreviewEntry *Previewer_get(Previewer *previewer, const char *path);
+
+// Read these paths (first is most wanted) unless cached, instead of
+// whatever was requested before and is not being read yet
+extern void Previewer_request(Previewer *previewer, const char *const *paths, unsigned int count);
+
+// Read path first, unless it is being read or waits already, or its last
+// read failed. Keeps other requested paths (those that fit after it)
+extern void Previewer_want(Previewer *previewer, const char *path);
+
+// Move finished reads into cache, true if there were any
+extern bool Previewer_poll(Previewer *previewer);
+
+extern void Previewer_free(Previewer *previewer);
+
+// NUL bytes or invalid UTF-8. Sequence cut at the end counts as valid
+extern bool preview_is_binary(const char *data, size_t len);
+
+#endif
@@ -0,0 +1,157 @@
+#include "session.h"
+#include "enums.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+extern int Session_save(WindowManager *wm, const char *path) {
+  Window *windows[SESSION_WINDOWS_MAX];
+  unsigned int count = 0;
+  if (wm->first_window != NULL) {
+    windows[count++] = wm->first_window;
+  }
+  if (wm->second_window != NULL) {
+    windows[count++] = wm->second_window;
+  }
+  if (count == 0) {
+    return ERROR;
+  }
+
+  SessionHeader header = {.version = SESSION_VERSION, .count = count, .preview_open = wm->preview.open};
+  memcpy(header.magic, SESSION_MAGIC, 4);
+  SessionWindow saved[SESSION_WINDOWS_MAX];
+  memset(saved, 0, sizeof(saved));
+  uint64_t offset = sizeof(header) + count * sizeof(SessionWindow);
+  for (unsigned int i = 0; i < count; i++) {
+    Window *win = windows[i];
+    SessionWindow *out = &saved[i];
+    if (win == wm->active_window) {
+      header.active = i;
+    }
+    snprintf(out->pwd, sizeof(out->pwd), "%s", win->pwd);
+    out->highlight = win->highlight;
+    out->scroll = win->scroll;
+    out->sort = win->sort;
+    out->relative_number = win->relative_number;
+    out->details = win->details;
+    // Partial listing, or one that can't be checked against directory
+    if (win->loader != NULL || !win->stamp_valid) {
+      continue;
+    }
+    out->has_listing = true;
+    out->stamp = win->stamp;
+    out->listing_sort = win->listing->files.sort;
+    out->files_count = win->listing->files.files_count;
+    out->names_used = win->listing->files.names_used;
+    // Both windows in the same directory, listing is written once
+    if (i > 0 && win->listing == windows[0]->listing && saved[0].has_listing) {
+      out->entries_offset = saved[0].entries_offset;
+      out->names_offset = saved[0].names_offset;
+      continue;
+    }
+    out->entries_offset = align8(offset);
+    out->names_offset = out->entries_offset + (uint64_t)out->files_count * sizeof(FileEntry);
+    offset = out->names_offset + out->names_used;
+  }
+
+  // Other tf instances may be quitting at the same time
+  char tmp_path[PATH_MAX + 32];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+  FILE *file = fopen(tmp_path, "wb");
+  bool ok = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(saved, sizeof(SessionWindow), count, file) == count;
+  offset = sizeof(header) + count * sizeof(SessionWindow);
+  static const char zeros[8] = {0};
+  for (unsigned int i = 0; ok && i < count; i++) {
+    const FilesArray *files = &windows[i]->listing->files;
+    // Not saved, or already written for first window
+    if (!saved[i].has_listing || saved[i].entries_offset < offset) {
+      continue;
+    }
+    size_t padding = saved[i].entries_offset - offset;
+    ok = (padding == 0 || fwrite(zeros, 1, padding, file) == padding) &&
+         (files->files_count == 0 ||
+          fwrite(files->entries, sizeof(FileEntry), files->files_count, file) == files->files_count) &&
+         (files->names_used == 0 || fwrite(files->names, 1, files->names_used, file) == files->names_used);
+    offset = saved[i].names_offset + saved[i].names_used;
+  }
+  if (file != NULL && fclose(file) != 0) {
+    ok = false;
+  }
+  if (ok && rename(tmp_path, path) == 0) {
+    return SUCCESS;
+  }
+  unlink(tmp_path);
+  return ERROR;
+}
+
+extern int Session_open(Session *session, const char *path) {
+  memset(session, 0, sizeof(*session));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ERROR;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) < 0 || (size_t)file_stat.st_size < sizeof(SessionHeader)) {
+    close(fd);
+    return ERROR;
+  }
+  void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return ERROR;
+  }
+  const SessionHeader *header = map;
+  uint64_t size = file_stat.st_size;
+  bool valid = memcmp(header->magic, SESSION_MAGIC, 4) == 0 && header->version == SESSION_VERSION &&
+               header->count > 0 && header->count <= SESSION_WINDOWS_MAX && header->active < header->count &&
+               sizeof(SessionHeader) + header->count * sizeof(SessionWindow) <= size;
+  const SessionWindow *windows = (const SessionWindow *)(header + 1);
+  for (unsigned int i = 0; valid && i < header->count; i++) {
+    const SessionWindow *saved = &windows[i];
+    valid = memchr(saved->pwd, '\0', sizeof(saved->pwd)) != NULL && saved->pwd[0] == '/' &&
+            (!saved->has_listing ||
+             (saved->entries_offset % 8 == 0 &&
+              saved->entries_offset + (uint64_t)saved->files_count * sizeof(FileEntry) <= saved->names_offset &&
+              saved->names_offset + saved->names_used <= size));
+  }
+  if (!valid) {
+    munmap(map, file_stat.st_size);
+    return ERROR;
+  }
+  session->map = map;
+  session->map_size = file_stat.st_size;
+  session->header = header;
+  session->windows = windows;
+  return SUCCESS;
+}
+
+extern Listing *Session_listing(const Session *session, unsigned int index) {
+  const SessionWindow *saved = &session->windows[index];
+  if (!saved->has_listing) {
+    return NULL;
+  }
+  const char *base = session->map;
+  FilesArray files;
+  if (FilesArray_load(&files, (const FileEntry *)(base + saved->entries_offset), saved->files_count,
+                      base + saved->names_offset, saved->names_used, saved->listing_sort) != SUCCESS) {
+    return NULL;
+  }
+  return Listing_wrap(&files);
+}
+
+extern void Session_close(Session *session) {
+  if (session->map != NULL) {
+    munmap(session->map, session->map_size);
+  }
+  memset(session, 0, sizeof(*session));
+}
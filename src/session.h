@@ -0,0 +1,72 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "cache.h"
+#include "files.h"
+#include "listing.h"
+#include "window.h"
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Windows as they were on exit, for "-l".
+//
+// One file "session" in data dir, written on exit and mmap'd on start:
+//   SessionHeader, SessionWindow[count], then listing of each window as it
+//   is in memory (FileEntry[files_count] and its names pool)
+// so restoring a listing is two memcpy instead of reading the directory.
+// Listings are drawn right away and checked against directory (DirStamp)
+// afterwards, changed ones are read again in background
+#define SESSION_MAGIC "TFSS"
+#define SESSION_VERSION 1
+#define SESSION_WINDOWS_MAX 2
+
+typedef struct SessionHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t active;
+  uint8_t preview_open;
+  uint8_t reserved[7];
+} SessionHeader;
+
+typedef struct SessionWindow {
+  char pwd[PATH_MAX];
+  // Directory state when listing was read
+  DirStamp stamp;
+  int32_t highlight;
+  int32_t scroll;
+  FileSort sort;
+  // Order of saved listing
+  FileSort listing_sort;
+  uint8_t relative_number;
+  uint8_t details;
+  // Window was still loading, directory is read again
+  uint8_t has_listing;
+  uint8_t reserved;
+  uint32_t files_count;
+  uint32_t names_used;
+  uint64_t entries_offset;
+  uint64_t names_offset;
+} SessionWindow;
+
+typedef struct Session {
+  void *map;
+  size_t map_size;
+  const SessionHeader *header;
+  const SessionWindow *windows;
+} Session;
+
+// Write windows of wm to path (replaced at once, old one stays on failure)
+extern int Session_save(WindowManager *wm, const char *path);
+
+// Map session file, ERROR if it is missing, broken or has no windows
+extern int Session_open(Session *session, const char *path);
+
+// New listing with saved one of window at index, NULL if it has none
+// (or there is no memory)
+extern Listing *Session_listing(const Session *session, unsigned int index);
+
+extern void Session_close(Session *session);
+
+#endif
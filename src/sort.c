@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include "sort.h"
+#include "enums.h"
+#include "perf.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Runs shorter than this are insertion sorted
+#define SORT_SMALL_RUN 32
+
+typedef struct SortItem {
+  // Next 8 key bytes (big endian, zero padded) or whole numeric key
+  uint64_t prefix;
+  uint32_t key_offset;
+  uint32_t index;
+} SortItem;
+
+// Second half of items is reused for reordered entries
+_Static_assert(sizeof(FileEntry) <= sizeof(SortItem), "FileEntry must fit in SortItem");
+
+static const char *sort_mode_names[SORT_MODES_COUNT] = {
+  [SORT_NAME] = "name",
+  [SORT_NATURAL] = "natural",
+  [SORT_LOCALE] = "locale",
+  [SORT_SIZE] = "size",
+  [SORT_MTIME] = "time",
+  [SORT_EXTENSION] = "ext",
+};
+
+extern const char *SortMode_name(SortMode mode) {
+  return mode < SORT_MODES_COUNT ? sort_mode_names[mode] : "";
+}
+
+// Stable LSD radix sort of items by prefix, byte passes where
+// all items have the same byte are skipped
+static void radix_sort_prefix(SortItem *items, SortItem *tmp, uint32_t count) {
+  uint32_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t prefix = items[i].prefix;
+    for (int byte = 0; byte < 8; byte++) {
+      counts[byte][(prefix >> (byte * 8)) & 0xff]++;
+    }
+  }
+
+  SortItem *from = items, *to = tmp;
+  for (int byte = 0; byte < 8; byte++) {
+    int shift = byte * 8;
+    if (counts[byte][(from[0].prefix >> shift) & 0xff] == count) {
+      continue;
+    }
+    uint32_t offsets[256], offset = 0;
+    for (int b = 0; b < 256; b++) {
+      offsets[b] = offset;
+      offset += counts[byte][b];
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      to[offsets[(from[i].prefix >> shift) & 0xff]++] = from[i];
+    }
+    SortItem *swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from != items) {
+    memcpy(items, from, count * sizeof(SortItem));
+  }
+}
+
+static inline uint64_t load_prefix(const unsigned char *key) {
+  uint64_t prefix = 0;
+  int i = 0;
+  for (; i < 8 && key[i] != '\0'; i++) {
+    prefix = (prefix << 8) | key[i];
+  }
+  return prefix << ((8 - i) * 8);
+}
+
+// Sort items whose keys share first 8 * depth bytes
+static void sort_strings(SortItem *items, SortItem *tmp, uint32_t count, const char *keys, size_t depth) {
+  size_t skip = depth * 8;
+  if (count < SORT_SMALL_RUN) {
+    for (uint32_t i = 1; i < count; i++) {
+      SortItem item = items[i];
+      const char *key = keys + item.key_offset + skip;
+      uint32_t j = i;
+      while (j > 0 && strcmp(keys + items[j - 1].key_offset + skip, key) > 0) {
+        items[j] = items[j - 1];
+        j--;
+      }
+      items[j] = item;
+    }
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    items[i].prefix = load_prefix((const unsigned char *)keys + items[i].key_offset + skip);
+  }
+  radix_sort_prefix(items, tmp, count);
+
+  // Equal 8 bytes not ending the key: order decided by next ones
+  for (uint32_t start = 0; start < count;) {
+    uint32_t end = start + 1;
+    while (end < count && items[end].prefix == items[start].prefix) {
+      end++;
+    }
+    if (end - start > 1 && (items[start].prefix & 0xff) != 0) {
+      sort_strings(items + start, tmp, end - start, keys, depth + 1);
+    }
+    start = end;
+  }
+}
+
+static inline bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Digit runs become '0', count of significant digits and the digits,
+// so longer numbers sort after shorter ones; name breaks ties ("01" vs "1")
+static size_t natural_key(char *dest, const char *name, size_t len) {
+  size_t out = 0;
+  for (size_t i = 0; i < len;) {
+    if (!is_digit(name[i])) {
+      dest[out++] = name[i++];
+      continue;
+    }
+    while (i < len - 1 && name[i] == '0' && is_digit(name[i + 1])) {
+      i++;
+    }
+    size_t start = i;
+    while (i < len && is_digit(name[i])) {
+      i++;
+    }
+    size_t digits = i - start < 254 ? i - start : 254;
+    dest[out++] = '0';
+    dest[out++] = (char)(1 + digits);
+    memcpy(dest + out, name + start, i - start);
+    out += i - start;
+  }
+  dest[out++] = '\x01';
+  memcpy(dest + out, name, len);
+  out += len;
+  dest[out++] = '\0';
+  return out;
+}
+
+// Extension (after last dot, dotfiles have none), then name
+static size_t extension_key(char *dest, const char *name, size_t len) {
+  const char *dot = memrchr(name, '.', len);
+  size_t out = 0;
+  if (dot != NULL && dot != name) {
+    size_t ext_len = len - (dot + 1 - name);
+    memcpy(dest, dot + 1, ext_len);
+    out = ext_len;
+  }
+  dest[out++] = '\x01';
+  memcpy(dest + out, name, len);
+  out += len;
+  dest[out++] = '\0';
+  return out;
+}
+
+// Collation key of locale, then name
+static size_t locale_key(char *dest, size_t room, const char *name, size_t len) {
+  size_t key_len = strxfrm(dest, name, room);
+  if (key_len + len + 2 > room) {
+    return 0;
+  }
+  dest[key_len] = '\x01';
+  memcpy(dest + key_len + 1, name, len + 1);
+  return key_len + len + 2;
+}
+
+// Room for key string of one name in string mode
+static size_t key_room(SortMode mode, const char *name, size_t len) {
+  if (mode == SORT_NATURAL) {
+    return len * 4 + 2;
+  }
+  if (mode == SORT_LOCALE) {
+    return strxfrm(NULL, name, 0) + len + 2;
+  }
+  return len * 2 + 2;
+}
+
+// Key string of one name in string mode, 0 if it didn't fit
+static size_t make_key(char *dest, size_t room, SortMode mode, const char *name, size_t len) {
+  if (mode == SORT_NATURAL) {
+    return natural_key(dest, name, len);
+  }
+  if (mode == SORT_LOCALE) {
+    return locale_key(dest, room, name, len);
+  }
+  return extension_key(dest, name, len);
+}
+
+// Key strings of string modes in one pool, NULL for plain names (pool itself is used)
+static char *build_keys(const FilesArray *fa, SortMode mode, SortItem *items) {
+  size_t size = 0;
+  for (unsigned int i = 0; i < fa->files_count; i++) {
+    size += key_room(mode, FilesArray_name(fa, i), fa->entries[i].name_len);
+  }
+
+  char *keys = malloc(size ? size : 1);
+  if (keys == NULL) {
+    return NULL;
+  }
+  size_t used = 0;
+  for (unsigned int i = 0; i < fa->files_count; i++) {
+    items[i].key_offset = used;
+    size_t key_len = make_key(keys + used, size - used, mode, FilesArray_name(fa, i), fa->entries[i].name_len);
+    if (key_len == 0) {
+      free(keys);
+      return NULL;
+    }
+    used += key_len;
+  }
+  return keys;
+}
+
+// Ascending 64 bit key of numeric modes
+static uint64_t numeric_key(int dir_fd, const char *name, SortMode mode) {
+  struct stat file_stat;
+  Perf_count(PERF_STAT, 1);
+  if (dir_fd < 0 || fstatat(dir_fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) < 0) {
+    return UINT64_MAX;
+  }
+  if (mode == SORT_SIZE) {
+    return ~(uint64_t)file_stat.st_size;
+  }
+  int64_t ns = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+  return ~((uint64_t)ns ^ (1ULL << 63));
+}
+
+extern int FileSort_compare(FileSort sort, int dir_fd, const char *a, FileType a_type, const char *b,
+                            FileType b_type) {
+  if (sort.dirs_first && (a_type == DIRECTORY) != (b_type == DIRECTORY)) {
+    return a_type == DIRECTORY ? -1 : 1;
+  }
+  if (sort.mode == SORT_SIZE || sort.mode == SORT_MTIME) {
+    uint64_t a_key = numeric_key(dir_fd, a, sort.mode);
+    uint64_t b_key = numeric_key(dir_fd, b, sort.mode);
+    if (a_key != b_key) {
+      return a_key < b_key ? -1 : 1;
+    }
+    return strcmp(a, b);
+  }
+  if (sort.mode == SORT_NAME) {
+    return strcmp(a, b);
+  }
+
+  size_t a_len = strlen(a), b_len = strlen(b);
+  size_t a_room = key_room(sort.mode, a, a_len), b_room = key_room(sort.mode, b, b_len);
+  char a_key[a_room], b_key[b_room];
+  if (make_key(a_key, a_room, sort.mode, a, a_len) == 0 || make_key(b_key, b_room, sort.mode, b, b_len) == 0) {
+    return strcmp(a, b);
+  }
+  // Same byte order as radix sort of keys
+  return strcmp(a_key, b_key);
+}
+
+static int sort_entries(FilesArray *fa, int dir_fd, FileSort sort) {
+  uint32_t count = fa->files_count;
+  if (count == 0) {
+    fa->sort = sort;
+    return FilesArray_index(fa);
+  }
+
+  SortItem *items = malloc(count * 2 * sizeof(SortItem));
+  if (items == NULL) {
+    return MALLOC_FAIL;
+  }
+  SortItem *tmp = items + count;
+  for (uint32_t i = 0; i < count; i++) {
+    items[i].key_offset = fa->entries[i].name_offset;
+    items[i].index = i;
+  }
+
+  // Name order first: string keys end with it, numeric ones keep it for ties
+  const char *keys = fa->names;
+  char *key_pool = NULL;
+  if (sort.mode == SORT_NATURAL || sort.mode == SORT_LOCALE || sort.mode == SORT_EXTENSION) {
+    key_pool = build_keys(fa, sort.mode, items);
+    if (key_pool == NULL) {
+      free(items);
+      return MALLOC_FAIL;
+    }
+    keys = key_pool;
+  }
+  sort_strings(items, tmp, count, keys, 0);
+  free(key_pool);
+
+  if (sort.mode == SORT_SIZE || sort.mode == SORT_MTIME) {
+    for (uint32_t i = 0; i < count; i++) {
+      items[i].prefix = numeric_key(dir_fd, FilesArray_name(fa, items[i].index), sort.mode);
+    }
+    radix_sort_prefix(items, tmp, count);
+  }
+
+  // Stable partition, directories keep their order among themselves
+  if (sort.dirs_first) {
+    uint32_t dirs = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      dirs += fa->entries[items[i].index].type == DIRECTORY;
+    }
+    uint32_t dir_pos = 0, file_pos = dirs;
+    for (uint32_t i = 0; i < count; i++) {
+      bool is_dir = fa->entries[items[i].index].type == DIRECTORY;
+      tmp[is_dir ? dir_pos++ : file_pos++] = items[i];
+    }
+    memcpy(items, tmp, count * sizeof(SortItem));
+  }
+
+  // Entries into new order, tmp reused as entries buffer
+  FileEntry *entries = (FileEntry *)tmp;
+  for (uint32_t i = 0; i < count; i++) {
+    entries[i] = fa->entries[items[i].index];
+  }
+  memcpy(fa->entries, entries, count * sizeof(FileEntry));
+  // Metadata moves with entries
+  if (fa->info != NULL) {
+    FileInfo *info = malloc(count * sizeof(FileInfo));
+    if (info == NULL) {
+      free(fa->info);
+      fa->info = NULL;
+      fa->info_size = 0;
+    } else {
+      for (uint32_t i = 0; i < count; i++) {
+        info[i] = items[i].index < fa->info_size ? fa->info[items[i].index] : (FileInfo){0};
+        if (info[i].state == FILE_INFO_PENDING) {
+          info[i].state = FILE_INFO_NONE;
+        }
+      }
+      free(fa->info);
+      fa->info = info;
+      fa->info_size = count;
+    }
+  }
+  free(items);
+
+  // Names in listing order: scans over listing (search, drawing)
+  // read memory sequentially instead of jumping around the pool.
+  // Keeps old pool if there is no memory for new one
+  FilesArray_repack(fa, fa->names_used);
+  fa->sort = sort;
+  // Listing is sorted after every fill, index is built along.
+  // Without memory for it lookups scan the listing
+  FilesArray_index(fa);
+  return SUCCESS;
+}
+
+extern int FilesArray_sort_by(FilesArray *fa, int dir_fd, FileSort sort) {
+  uint64_t start = Perf_start();
+  uint64_t trace_start = Trace_start();
+  int sort_res = sort_entries(fa, dir_fd, sort);
+  Perf_done(&perf.sort_ns, start);
+  Trace_end("sort", trace_start, SortMode_name(sort.mode));
+  return sort_res;
+}
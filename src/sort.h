@@ -0,0 +1,24 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "files.h"
+
+// Sort listing by sort.mode (then directories first if sort.dirs_first).
+//
+// Every entry gets its key computed once: string modes write a key string
+// (name, natural key, strxfrm() output, extension + name) to one pool,
+// numeric modes a 64 bit value (size, mtime; read with fstatat on dir_fd).
+// Entries are then radix sorted on packed 16 byte items: 8 key bytes at a
+// time, only items with equal 8 bytes go on to the next ones.
+// Equal keys keep name order. Names pool is rewritten in new order
+extern int FilesArray_sort_by(FilesArray *fa, int dir_fd, FileSort sort);
+
+// Order of two entries in sort, as FilesArray_sort_by puts them
+// (keys are made for these two only: for inserting into sorted listing)
+extern int FileSort_compare(FileSort sort, int dir_fd, const char *a, FileType a_type, const char *b,
+                            FileType b_type);
+
+// Short name for status line
+extern const char *SortMode_name(SortMode mode);
+
+#endif
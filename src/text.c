@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "text.h"
+#include <stdio.h>
+#include <string.h>
+
+extern int wide_decode(wchar_t *dest, const char *src, size_t src_len, size_t *dest_len) {
+  mbstate_t state;
+  memset(&state, 0, sizeof(state));
+
+  int width = 0;
+  size_t out = 0;
+  size_t pos = 0;
+  while (pos < src_len) {
+    wchar_t wc;
+    size_t used = mbrtowc(&wc, src + pos, src_len - pos, &state);
+    if (used == (size_t)-1 || used == (size_t)-2 || used == 0) {
+      // Broken sequence, show one byte as '?'
+      memset(&state, 0, sizeof(state));
+      wc = L'?';
+      used = 1;
+    }
+    int char_width = wcwidth(wc);
+    if (char_width < 0) {
+      wc = L'?';
+      char_width = 1;
+    }
+    dest[out++] = wc;
+    width += char_width;
+    pos += used;
+  }
+  dest[out] = L'\0';
+  if (dest_len != NULL) {
+    *dest_len = out;
+  }
+  return width;
+}
+
+static int char_width(wchar_t wc) {
+  int width = wcwidth(wc);
+  return width < 0 ? 1 : width;
+}
+
+extern void trim_wide(bool is_pwd, wchar_t *dest, size_t dest_cap, const wchar_t *src,
+                      size_t src_len, int src_width, int size_x) {
+  if (dest_cap == 0) {
+    return;
+  }
+  dest[0] = L'\0';
+  if (size_x <= 0) {
+    return;
+  }
+
+  // Nothing to trim
+  if (src_width <= size_x && src_len < dest_cap) {
+    wmemcpy(dest, src, src_len);
+    dest[src_len] = L'\0';
+    return;
+  }
+
+  // Columns left after "~"
+  int budget = size_x - 1;
+  size_t out = 0;
+
+  // Trim pwd
+  if (is_pwd) {
+    // src: /home/rostik/folder1/folder2
+    // trimmed: ~/rostik/folder1/folder2
+    // OR       ~/folder1/folder2  etc
+    size_t start = src_len;
+    int used = 0;
+    while (start > 0 && used + char_width(src[start - 1]) <= budget &&
+           src_len - start + 2 < dest_cap) {
+      used += char_width(src[--start]);
+    }
+    dest[out++] = L'~';
+    wmemcpy(dest + out, src + start, src_len - start);
+    out += src_len - start;
+    dest[out] = L'\0';
+    return;
+  }
+
+  // Trim any other text
+  // But somewhere in middle, by columns, so wide chars are counted right
+  int left_budget = budget / 2;
+  int used = 0;
+  size_t head = 0;
+  while (head < src_len && used + char_width(src[head]) <= left_budget && head + 2 < dest_cap) {
+    used += char_width(src[head++]);
+  }
+  int right_budget = budget - used;
+  size_t tail = src_len;
+  used = 0;
+  while (tail > head && used + char_width(src[tail - 1]) <= right_budget &&
+         head + (src_len - tail) + 2 < dest_cap) {
+    used += char_width(src[--tail]);
+  }
+
+  wmemcpy(dest, src, head);
+  out = head;
+  dest[out++] = L'~';
+  wmemcpy(dest + out, src + tail, src_len - tail);
+  out += src_len - tail;
+  dest[out] = L'\0';
+}
+
+extern void format_size(char *dest, size_t dest_size, uint64_t size) {
+  const char *units = "BKMGTP";
+  double value = size;
+  int unit = 0;
+  while (value >= 1000 && unit < 5) {
+    value /= 1024;
+    unit++;
+  }
+  if (unit == 0) {
+    snprintf(dest, dest_size, "%llu", (unsigned long long)size);
+  } else if (value < 10) {
+    snprintf(dest, dest_size, "%.1f%c", value, units[unit]);
+  } else {
+    snprintf(dest, dest_size, "%.0f%c", value, units[unit]);
+  }
+}
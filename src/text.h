@@ -0,0 +1,23 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// Decode multibyte src into dest (room for src_len + 1 wide chars).
+// Invalid bytes and non printable chars become '?'.
+// Returns display width in columns, *dest_len gets number of wide chars
+extern int wide_decode(wchar_t *dest, const char *src, size_t src_len, size_t *dest_len);
+
+// Fit src (src_width columns) into size_x columns.
+// is_pwd: keep the end, "~" in front. Otherwise "~" in the middle.
+// dest gets at most dest_cap wide chars including L'\0'
+extern void trim_wide(bool is_pwd, wchar_t *dest, size_t dest_cap, const wchar_t *src,
+                      size_t src_len, int src_width, int size_x);
+
+// Size in at most 5 chars: 999, 1.5K, 12K, 3.0G
+extern void format_size(char *dest, size_t dest_size, uint64_t size);
+
+#endif
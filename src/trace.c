@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_WRITE_BUFFER (16 * 1024)
+
+bool trace_enabled;
+
+static _Atomic(TraceRing *) trace_rings;
+static pthread_key_t trace_ring_key;
+static __thread TraceRing *thread_ring;
+static __thread pid_t thread_tid;
+static uint64_t trace_epoch_ns;
+static pid_t trace_pid;
+static char trace_path[PATH_MAX];
+static char trace_tmp_path[PATH_MAX + 8];
+
+// Thread exited, its ring can be taken by another one
+static void TraceRing_release(void *ring) {
+  atomic_store(&((TraceRing *)ring)->owned, false);
+}
+
+static TraceRing *TraceRing_get(void) {
+  if (thread_ring != NULL) {
+    return thread_ring;
+  }
+  for (TraceRing *ring = atomic_load(&trace_rings); ring != NULL && thread_ring == NULL; ring = ring->next) {
+    bool owned = false;
+    if (atomic_compare_exchange_strong(&ring->owned, &owned, true)) {
+      thread_ring = ring;
+    }
+  }
+  if (thread_ring == NULL) {
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (ring == NULL) {
+      return NULL;
+    }
+    atomic_store(&ring->owned, true);
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring)) {
+    }
+    thread_ring = ring;
+  }
+  thread_tid = syscall(SYS_gettid);
+  pthread_setspecific(trace_ring_key, thread_ring);
+  return thread_ring;
+}
+
+extern void Trace_record(const char *name, uint64_t start, const char *arg) {
+  uint64_t end = perf_clock_ns();
+  TraceRing *ring = TraceRing_get();
+  if (ring == NULL) {
+    return;
+  }
+  unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  TraceEvent *event = &ring->events[head % TRACE_RING_EVENTS];
+  event->name = name;
+  event->start_ns = start;
+  event->duration_ns = end - start;
+  event->tid = thread_tid;
+  size_t arg_len = arg ? strnlen(arg, TRACE_ARG_MAX - 1) : 0;
+  if (arg_len > 0) {
+    memcpy(event->arg, arg, arg_len);
+  }
+  event->arg[arg_len] = '\0';
+  // Event is complete before dump can see it
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// ---- Dump (async signal safe: no stdio, no malloc) ----
+
+typedef struct TraceWriter {
+  int fd;
+  bool ok;
+  size_t used;
+  char buffer[TRACE_WRITE_BUFFER];
+} TraceWriter;
+
+static void TraceWriter_flush(TraceWriter *writer) {
+  size_t done = 0;
+  while (writer->ok && done < writer->used) {
+    ssize_t written = write(writer->fd, writer->buffer + done, writer->used - done);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    writer->ok = written > 0;
+    done += written > 0 ? written : 0;
+  }
+  writer->used = 0;
+}
+
+static void TraceWriter_put(TraceWriter *writer, const char *text, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (writer->used == sizeof(writer->buffer)) {
+      TraceWriter_flush(writer);
+    }
+    writer->buffer[writer->used++] = text[i];
+  }
+}
+
+static void TraceWriter_text(TraceWriter *writer, const char *text) {
+  TraceWriter_put(writer, text, strlen(text));
+}
+
+static void TraceWriter_number(TraceWriter *writer, uint64_t value) {
+  char digits[24];
+  int len = 0;
+  do {
+    digits[sizeof(digits) - 1 - len++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  TraceWriter_put(writer, digits + sizeof(digits) - len, len);
+}
+
+// Trace-event times are microseconds
+static void TraceWriter_micros(TraceWriter *writer, uint64_t ns) {
+  TraceWriter_number(writer, ns / 1000);
+  char fraction[4] = {'.', '0' + ns / 100 % 10, '0' + ns / 10 % 10, '0' + ns % 10};
+  TraceWriter_put(writer, fraction, sizeof(fraction));
+}
+
+// Bytes past ASCII become '?', so file is valid JSON whatever names are
+// At most max bytes of text, in case it is being written by another thread
+static void TraceWriter_string(TraceWriter *writer, const char *text, size_t max) {
+  static const char hex[] = "0123456789abcdef";
+  TraceWriter_put(writer, "\"", 1);
+  const unsigned char *end = (const unsigned char *)text + max;
+  for (const unsigned char *c = (const unsigned char *)text; c < end && *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      char escaped[2] = {'\\', *c};
+      TraceWriter_put(writer, escaped, 2);
+    } else if (*c < 0x20) {
+      char escaped[6] = {'\\', 'u', '0', '0', hex[*c >> 4], hex[*c & 0xf]};
+      TraceWriter_put(writer, escaped, 6);
+    } else {
+      char plain = *c < 0x80 ? *c : '?';
+      TraceWriter_put(writer, &plain, 1);
+    }
+  }
+  TraceWriter_put(writer, "\"", 1);
+}
+
+static void TraceWriter_event(TraceWriter *writer, const TraceEvent *event, bool first) {
+  TraceWriter_text(writer, first ? "\n{\"name\":" : ",\n{\"name\":");
+  TraceWriter_string(writer, event->name, TRACE_ARG_MAX);
+  TraceWriter_text(writer, ",\"ph\":\"X\",\"pid\":");
+  TraceWriter_number(writer, trace_pid);
+  TraceWriter_text(writer, ",\"tid\":");
+  TraceWriter_number(writer, event->tid);
+  TraceWriter_text(writer, ",\"ts\":");
+  TraceWriter_micros(writer, event->start_ns > trace_epoch_ns ? event->start_ns - trace_epoch_ns : 0);
+  TraceWriter_text(writer, ",\"dur\":");
+  TraceWriter_micros(writer, event->duration_ns);
+  if (event->arg[0] != '\0') {
+    TraceWriter_text(writer, ",\"args\":{\"detail\":");
+    TraceWriter_string(writer, event->arg, TRACE_ARG_MAX);
+    TraceWriter_text(writer, "}");
+  }
+  TraceWriter_text(writer, "}");
+}
+
+extern void Trace_dump(void) {
+  if (!trace_enabled) {
+    return;
+  }
+  TraceWriter writer;
+  writer.fd = open(trace_tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  writer.ok = writer.fd >= 0;
+  writer.used = 0;
+  if (!writer.ok) {
+    return;
+  }
+  TraceWriter_text(&writer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  for (TraceRing *ring = atomic_load(&trace_rings); ring != NULL; ring = ring->next) {
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    // Slot head % TRACE_RING_EVENTS is the one being written (maybe by the
+    // thread this signal interrupted), oldest complete event is after it
+    unsigned long oldest = head >= TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS + 1 : 0;
+    for (unsigned long i = oldest; i < head; i++) {
+      const TraceEvent *event = &ring->events[i % TRACE_RING_EVENTS];
+      if (event->name != NULL) {
+        TraceWriter_event(&writer, event, first);
+        first = false;
+      }
+    }
+  }
+  TraceWriter_text(&writer, "\n]}\n");
+  TraceWriter_flush(&writer);
+  close(writer.fd);
+  if (!writer.ok || rename(trace_tmp_path, trace_path) < 0) {
+    unlink(trace_tmp_path);
+  }
+}
+
+static void Trace_signal(int signal) {
+  (void)signal;
+  int saved_errno = errno;
+  Trace_dump();
+  errno = saved_errno;
+}
+
+extern void Trace_enable(const char *data_dir) {
+  if (trace_enabled || pthread_key_create(&trace_ring_key, TraceRing_release) != 0) {
+    return;
+  }
+  trace_pid = getpid();
+  trace_epoch_ns = perf_clock_ns();
+  snprintf(trace_path, sizeof(trace_path), "%s/trace-%d.json", data_dir, (int)trace_pid);
+  snprintf(trace_tmp_path, sizeof(trace_tmp_path), "%s.tmp", trace_path);
+  trace_enabled = true;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = Trace_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "config.h"
+#include "perf.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Span recorded by one thread
+typedef struct TraceEvent {
+  // Static string
+  const char *name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  pid_t tid;
+  // Path, key, ... (cut to TRACE_ARG_MAX - 1 bytes)
+  char arg[TRACE_ARG_MAX];
+} TraceEvent;
+
+// Events of one thread, oldest overwritten when full. Only owner writes,
+// ring of exited thread is taken over by next new one
+typedef struct TraceRing {
+  struct TraceRing *next;
+  atomic_bool owned;
+  atomic_ulong head;
+  TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+// Opt-in tracing ("-trace"): spans of input handling, chdir, directory
+// reads, sorts, draws and background jobs in per thread rings (no locks).
+// Dumped as Chrome trace-event JSON (trace-<pid>.json in data dir) on exit
+// and on SIGUSR1. Dump only uses async signal safe calls, so it works
+// while main thread hangs. Disabled, every span is one branch
+extern bool trace_enabled;
+
+extern void Trace_enable(const char *data_dir);
+
+// Start of span, 0 when disabled
+static inline uint64_t Trace_start(void) {
+  return trace_enabled ? perf_clock_ns() : 0;
+}
+
+extern void Trace_record(const char *name, uint64_t start, const char *arg);
+
+// End span started at start, arg may be NULL
+static inline void Trace_end(const char *name, uint64_t start, const char *arg) {
+  if (start != 0) {
+    Trace_record(name, start, arg);
+  }
+}
+
+// Write rings to trace file (replaced at once)
+extern void Trace_dump(void);
+
+#endif
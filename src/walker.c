@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include "walker.h"
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Open directory, shared by its queued children (they openat() from it)
+typedef struct WalkDir {
+  int fd;
+  atomic_int refs;
+  dev_t dev;
+  int depth;
+  size_t path_len;
+  char path[];
+} WalkDir;
+
+// Directory waiting to be read: name relative to parent
+typedef struct WalkItem {
+  WalkDir *parent;
+  size_t name_len;
+  char name[];
+} WalkItem;
+
+typedef struct WalkVisited {
+  dev_t dev;
+  ino_t ino;
+} WalkVisited;
+
+struct Walker {
+  const WalkOptions *options;
+  WalkCallback visit;
+  void *ctx;
+  WalkThread *threads;
+  int thread_count;
+  // Queued or being read directories, walk is over at 0
+  atomic_long pending;
+  dev_t root_dev;
+  // (dev, ino) of entered directories, only when following symlinks
+  pthread_mutex_t visited_lock;
+  WalkVisited *visited;
+  size_t visited_count, visited_size;
+};
+
+extern int Walker_thread_count(const WalkOptions *options) {
+  if (options->threads > 0) {
+    return options->threads;
+  }
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) {
+    cpus = 1;
+  }
+  return cpus > WALKER_THREADS_MAX ? WALKER_THREADS_MAX : cpus;
+}
+
+static void WalkDir_release(WalkDir *dir) {
+  if (dir != NULL && atomic_fetch_sub(&dir->refs, 1) == 1) {
+    close(dir->fd);
+    free(dir);
+  }
+}
+
+// ---- Deque: owner pushes and pops at the end, thieves take from the start ----
+
+static int WalkThread_push(WalkThread *thread, WalkItem *item) {
+  pthread_mutex_lock(&thread->lock);
+  if (thread->count == thread->size) {
+    size_t new_size = thread->size ? thread->size * 2 : 256;
+    WalkItem **new_items = malloc(new_size * sizeof(WalkItem *));
+    if (new_items == NULL) {
+      pthread_mutex_unlock(&thread->lock);
+      return MALLOC_FAIL;
+    }
+    for (size_t i = 0; i < thread->count; i++) {
+      new_items[i] = thread->items[(thread->head + i) % thread->size];
+    }
+    free(thread->items);
+    thread->items = new_items;
+    thread->head = 0;
+    thread->size = new_size;
+  }
+  thread->items[(thread->head + thread->count) % thread->size] = item;
+  thread->count++;
+  pthread_mutex_unlock(&thread->lock);
+  return SUCCESS;
+}
+
+static WalkItem *WalkThread_pop(WalkThread *thread) {
+  WalkItem *item = NULL;
+  pthread_mutex_lock(&thread->lock);
+  if (thread->count > 0) {
+    thread->count--;
+    item = thread->items[(thread->head + thread->count) % thread->size];
+  }
+  pthread_mutex_unlock(&thread->lock);
+  return item;
+}
+
+static WalkItem *WalkThread_steal(WalkThread *victim) {
+  WalkItem *item = NULL;
+  // Don't queue behind a busy owner, try someone else
+  if (pthread_mutex_trylock(&victim->lock) != 0) {
+    return NULL;
+  }
+  if (victim->count > 0) {
+    item = victim->items[victim->head];
+    victim->head = (victim->head + 1) % victim->size;
+    victim->count--;
+  }
+  pthread_mutex_unlock(&victim->lock);
+  return item;
+}
+
+static WalkItem *Walker_find_work(WalkThread *thread) {
+  WalkItem *item = WalkThread_pop(thread);
+  if (item != NULL) {
+    return item;
+  }
+  Walker *walker = thread->walker;
+  int start = rand_r(&thread->seed) % walker->thread_count;
+  for (int i = 0; i < walker->thread_count; i++) {
+    WalkThread *victim = &walker->threads[(start + i) % walker->thread_count];
+    if (victim != thread && (item = WalkThread_steal(victim)) != NULL) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+// ---- Walking ----
+
+static bool Walker_excluded(const Walker *walker, const char *name, const char *path) {
+  const char **exclude = walker->options->exclude;
+  if (exclude == NULL) {
+    return false;
+  }
+  for (int i = 0; exclude[i] != NULL; i++) {
+    const char *subject = strchr(exclude[i], '/') ? path : name;
+    if (fnmatch(exclude[i], subject, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// True if directory was not entered before
+static bool Walker_mark_visited(Walker *walker, dev_t dev, ino_t ino) {
+  bool added = false;
+  pthread_mutex_lock(&walker->visited_lock);
+  if ((walker->visited_count + 1) * 2 > walker->visited_size) {
+    size_t new_size = walker->visited_size ? walker->visited_size * 2 : 1024;
+    WalkVisited *new_visited = calloc(new_size, sizeof(WalkVisited));
+    if (new_visited == NULL) {
+      pthread_mutex_unlock(&walker->visited_lock);
+      return false;
+    }
+    for (size_t i = 0; i < walker->visited_size; i++) {
+      WalkVisited *old = &walker->visited[i];
+      if (old->ino == 0) {
+        continue;
+      }
+      size_t slot = (old->ino * 31 + old->dev) & (new_size - 1);
+      while (new_visited[slot].ino != 0) {
+        slot = (slot + 1) & (new_size - 1);
+      }
+      new_visited[slot] = *old;
+    }
+    free(walker->visited);
+    walker->visited = new_visited;
+    walker->visited_size = new_size;
+  }
+  size_t slot = (ino * 31 + dev) & (walker->visited_size - 1);
+  while (walker->visited[slot].ino != 0 &&
+         !(walker->visited[slot].ino == ino && walker->visited[slot].dev == dev)) {
+    slot = (slot + 1) & (walker->visited_size - 1);
+  }
+  if (walker->visited[slot].ino == 0) {
+    walker->visited[slot] = (WalkVisited){dev, ino};
+    walker->visited_count++;
+    added = true;
+  }
+  pthread_mutex_unlock(&walker->visited_lock);
+  return added;
+}
+
+static int Walker_queue(WalkThread *thread, WalkDir *parent, const char *name, size_t name_len) {
+  WalkItem *item = malloc(sizeof(WalkItem) + name_len + 1);
+  if (item == NULL) {
+    return MALLOC_FAIL;
+  }
+  item->parent = parent;
+  item->name_len = name_len;
+  memcpy(item->name, name, name_len);
+  item->name[name_len] = '\0';
+  if (parent != NULL) {
+    atomic_fetch_add(&parent->refs, 1);
+  }
+  atomic_fetch_add(&thread->walker->pending, 1);
+  if (WalkThread_push(thread, item) != SUCCESS) {
+    atomic_fetch_sub(&thread->walker->pending, 1);
+    WalkDir_release(parent);
+    free(item);
+    return MALLOC_FAIL;
+  }
+  return SUCCESS;
+}
+
+extern int Walker_add_child(WalkThread *thread, const char *name, size_t name_len) {
+  WalkDir *dir = thread->current;
+  const WalkOptions *options = thread->walker->options;
+  if (dir == NULL || (options->max_depth >= 0 && dir->depth + 1 > options->max_depth)) {
+    return ERROR;
+  }
+  return Walker_queue(thread, dir, name, name_len);
+}
+
+// Join dir path and name into dest, returns length or 0 if too long
+static size_t join_path(char *dest, const char *dir, size_t dir_len, const char *name, size_t name_len) {
+  // Root is "/", don't make "//name"
+  if (dir_len == 1 && dir[0] == '/') {
+    dir_len = 0;
+  }
+  if (dir_len + 1 + name_len >= PATH_MAX) {
+    return 0;
+  }
+  memmove(dest, dir, dir_len);
+  dest[dir_len] = '/';
+  memcpy(dest + dir_len + 1, name, name_len);
+  dest[dir_len + 1 + name_len] = '\0';
+  return dir_len + 1 + name_len;
+}
+
+// Report and queue everything in opened directory dir
+static void Walker_read_dir(WalkThread *thread, WalkDir *dir) {
+  Walker *walker = thread->walker;
+  const WalkOptions *options = walker->options;
+  char *child_path = thread->path;
+  int child_depth = dir->depth + 1;
+
+  ssize_t read_bytes;
+  while ((read_bytes = getdents64(dir->fd, thread->buffer, DIR_READ_BUFFER_SIZE)) > 0) {
+    for (ssize_t pos = 0; pos < read_bytes;) {
+      struct dirent64 *entry = (struct dirent64 *)(thread->buffer + pos);
+      pos += entry->d_reclen;
+
+      const char *name = entry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+      unsigned char d_type = entry->d_type;
+      if (d_type == DT_UNKNOWN) {
+        struct stat file_stat;
+        if (fstatat(dir->fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) < 0) {
+          continue;
+        }
+        d_type = S_ISDIR(file_stat.st_mode) ? DT_DIR : S_ISLNK(file_stat.st_mode) ? DT_LNK : DT_REG;
+      }
+      if (options->dirs_only && d_type != DT_DIR && !(d_type == DT_LNK && options->symlinks == WALK_SYMLINKS_FOLLOW)) {
+        continue;
+      }
+      if (d_type == DT_LNK && options->symlinks == WALK_SYMLINKS_SKIP) {
+        continue;
+      }
+
+      size_t name_len = strlen(name);
+      size_t path_len = join_path(child_path, dir->path, dir->path_len, name, name_len);
+      if (path_len == 0 || Walker_excluded(walker, name, child_path)) {
+        continue;
+      }
+
+      bool is_dir = d_type == DT_DIR;
+      if (d_type == DT_LNK && options->symlinks == WALK_SYMLINKS_FOLLOW) {
+        struct stat target_stat;
+        is_dir = fstatat(dir->fd, name, &target_stat, 0) == 0 && S_ISDIR(target_stat.st_mode);
+        if (!is_dir && options->dirs_only) {
+          continue;
+        }
+      }
+      // Directories are reported when entered
+      if (is_dir) {
+        Walker_queue(thread, dir, name, name_len);
+        continue;
+      }
+      WalkEntry walk_entry = {
+          .path = child_path,
+          .path_len = path_len,
+          .name_start = path_len - name_len,
+          .type = REGULAR,
+          .is_symlink = d_type == DT_LNK,
+          .depth = child_depth,
+          .dir_fd = -1,
+      };
+      walker->visit(walker->ctx, thread, &walk_entry);
+    }
+  }
+}
+
+static void Walker_enter(WalkThread *thread, WalkItem *item) {
+  Walker *walker = thread->walker;
+  const WalkOptions *options = walker->options;
+  WalkDir *parent = item->parent;
+
+  char *path = thread->path;
+  size_t path_len, name_start;
+  int depth = parent ? parent->depth + 1 : 0;
+  if (parent == NULL) {
+    path_len = item->name_len < PATH_MAX ? item->name_len : 0;
+    memcpy(path, item->name, path_len);
+    path[path_len] = '\0';
+    const char *slash = strrchr(path, '/');
+    name_start = (slash && slash[1] != '\0') ? slash + 1 - path : 0;
+  } else {
+    path_len = join_path(path, parent->path, parent->path_len, item->name, item->name_len);
+    name_start = path_len - item->name_len;
+  }
+  if (path_len == 0) {
+    WalkDir_release(parent);
+    return;
+  }
+
+  int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  if (options->symlinks != WALK_SYMLINKS_FOLLOW) {
+    flags |= O_NOFOLLOW;
+  }
+  int fd = parent ? openat(parent->fd, item->name, flags) : open(path, flags);
+  // Too many parents kept open, fall back to full path
+  if (fd < 0 && errno == EMFILE) {
+    fd = open(path, flags);
+  }
+  WalkDir_release(parent);
+
+  WalkEntry entry = {
+      .path = path,
+      .path_len = path_len,
+      .name_start = name_start,
+      .type = DIRECTORY,
+      .is_symlink = false,
+      .depth = depth,
+      .dir_fd = fd,
+  };
+  if (fd < 0) {
+    walker->visit(walker->ctx, thread, &entry);
+    return;
+  }
+
+  dev_t dev = 0;
+  bool enter = options->max_depth < 0 || depth < options->max_depth;
+  if (options->one_filesystem || options->symlinks == WALK_SYMLINKS_FOLLOW) {
+    struct stat dir_stat;
+    if (fstat(fd, &dir_stat) < 0) {
+      close(fd);
+      return;
+    }
+    dev = dir_stat.st_dev;
+    if (parent == NULL) {
+      walker->root_dev = dev;
+    }
+    if (options->symlinks == WALK_SYMLINKS_FOLLOW && !Walker_mark_visited(walker, dev, dir_stat.st_ino)) {
+      close(fd);
+      return;
+    }
+    // Mount point is reported, not entered
+    if (options->one_filesystem && dev != walker->root_dev) {
+      enter = false;
+    }
+  }
+
+  WalkDir *dir = malloc(sizeof(WalkDir) + path_len + 1);
+  if (dir == NULL) {
+    close(fd);
+    return;
+  }
+  dir->fd = fd;
+  atomic_init(&dir->refs, 1);
+  dir->dev = dev;
+  dir->depth = depth;
+  dir->path_len = path_len;
+  memcpy(dir->path, path, path_len + 1);
+
+  thread->current = enter ? dir : NULL;
+  WalkAction action = walker->visit(walker->ctx, thread, &entry);
+  thread->current = NULL;
+  if (enter && action == WALK_CONTINUE) {
+    Walker_read_dir(thread, dir);
+  }
+  WalkDir_release(dir);
+}
+
+static void *Walker_worker(void *arg) {
+  WalkThread *thread = arg;
+  Walker *walker = thread->walker;
+  int idle = 0;
+
+  while (true) {
+    WalkItem *item = Walker_find_work(thread);
+    if (item == NULL) {
+      if (atomic_load(&walker->pending) == 0) {
+        break;
+      }
+      // Others are still reading, their subdirectories will show up
+      if (++idle < 64) {
+        sched_yield();
+      } else {
+        nanosleep(&(struct timespec){.tv_nsec = 50 * 1000}, NULL);
+      }
+      continue;
+    }
+    idle = 0;
+    Walker_enter(thread, item);
+    free(item);
+    atomic_fetch_sub(&walker->pending, 1);
+  }
+  return NULL;
+}
+
+extern int Walker_run(const char *root, const WalkOptions *options, WalkCallback visit, void *ctx) {
+  Walker walker = {
+      .options = options,
+      .visit = visit,
+      .ctx = ctx,
+      .thread_count = Walker_thread_count(options),
+  };
+  atomic_init(&walker.pending, 0);
+  pthread_mutex_init(&walker.visited_lock, NULL);
+  walker.threads = calloc(walker.thread_count, sizeof(WalkThread));
+  if (walker.threads == NULL) {
+    return MALLOC_FAIL;
+  }
+
+  int status = SUCCESS;
+  int started = 0;
+  for (int i = 0; i < walker.thread_count; i++) {
+    WalkThread *thread = &walker.threads[i];
+    thread->walker = &walker;
+    thread->index = i;
+    thread->seed = i + 1;
+    pthread_mutex_init(&thread->lock, NULL);
+    if ((thread->buffer = malloc(DIR_READ_BUFFER_SIZE)) == NULL) {
+      status = MALLOC_FAIL;
+    }
+  }
+
+  if (status == SUCCESS && Walker_queue(&walker.threads[0], NULL, root, strlen(root)) == SUCCESS) {
+    // Calling thread is worker 0
+    for (started = 1; started < walker.thread_count; started++) {
+      WalkThread *thread = &walker.threads[started];
+      if (pthread_create(&thread->thread, NULL, Walker_worker, thread) != 0) {
+        break;
+      }
+    }
+    Walker_worker(&walker.threads[0]);
+    for (int i = 1; i < started; i++) {
+      pthread_join(walker.threads[i].thread, NULL);
+    }
+  } else {
+    status = MALLOC_FAIL;
+  }
+
+  for (int i = 0; i < walker.thread_count; i++) {
+    free(walker.threads[i].buffer);
+    free(walker.threads[i].items);
+    pthread_mutex_destroy(&walker.threads[i].lock);
+  }
+  free(walker.threads);
+  free(walker.visited);
+  pthread_mutex_destroy(&walker.visited_lock);
+  return status;
+}
@@ -0,0 +1,94 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+#include "enums.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Parallel recursive directory walk.
+//
+// Every thread owns a deque of directories to read: it pushes subdirectories
+// it finds and pops them back (depth first, so few directories are open),
+// idle threads steal the oldest ones from others (big subtrees near the root).
+// Directories are opened with openat() relative to their already open parent
+// and read with getdents64, so no path is resolved from "/" again.
+
+typedef enum WalkSymlinks {
+  // Don't report symlinks
+  WALK_SYMLINKS_SKIP,
+  // Report symlinks as entries, never enter them
+  WALK_SYMLINKS_LIST,
+  // Enter symlinked directories (each directory is walked once)
+  WALK_SYMLINKS_FOLLOW,
+} WalkSymlinks;
+
+typedef struct WalkOptions {
+  // 0: one per CPU (up to WALKER_THREADS_MAX)
+  int threads;
+  // Deepest level reported, root is 0. Negative: no limit
+  int max_depth;
+  // Don't enter directories on other filesystems (mount points are reported)
+  bool one_filesystem;
+  WalkSymlinks symlinks;
+  // NULL terminated fnmatch() patterns, matched against name,
+  // or full path for patterns with '/'. Excluded directories are not entered
+  const char **exclude;
+  // Report only directories (saves stat of DT_UNKNOWN non-directories)
+  bool dirs_only;
+} WalkOptions;
+
+typedef struct WalkEntry {
+  const char *path;
+  size_t path_len;
+  // Basename starts at path + name_start
+  size_t name_start;
+  FileType type;
+  bool is_symlink;
+  int depth;
+  // Directories are reported when entered, fd stays open while callback runs.
+  // -1 for other entries and directories that couldn't be opened
+  int dir_fd;
+} WalkEntry;
+
+typedef enum WalkAction {
+  WALK_CONTINUE,
+  // Don't read this directory (children may still be added with Walker_add_child)
+  WALK_SKIP,
+} WalkAction;
+
+typedef struct Walker Walker;
+
+typedef struct WalkThread {
+  Walker *walker;
+  pthread_t thread;
+  // Index of thread, 0 .. Walker_thread_count() - 1, for per thread results
+  int index;
+  pthread_mutex_t lock;
+  struct WalkItem **items;
+  size_t head, count, size;
+  // Directory being read
+  struct WalkDir *current;
+  char *buffer;
+  char path[PATH_MAX];
+  unsigned int seed;
+} WalkThread;
+
+// Called from walker threads concurrently.
+// Return value matters only for directories
+typedef WalkAction (*WalkCallback)(void *ctx, WalkThread *thread, const WalkEntry *entry);
+
+extern int Walker_thread_count(const WalkOptions *options);
+
+// Walk root, calling visit for root and everything under it.
+// Returns when whole tree is walked
+extern int Walker_run(const char *root, const WalkOptions *options, WalkCallback visit, void *ctx);
+
+// From visit of a directory: queue its child directory name for walking,
+// e.g when children are already known and visit returns WALK_SKIP
+extern int Walker_add_child(WalkThread *thread, const char *name, size_t name_len);
+
+#endif
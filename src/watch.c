@@ -0,0 +1,235 @@
+#include "watch.h"
+#include "config.h"
+#include "enums.h"
+#include "perf.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_MASK                                                            \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |     \
+   IN_MOVE_SELF | IN_ONLYDIR)
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+extern int Watch_init(WindowManager *wm) {
+  wm->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  wm->watched_count = 0;
+  wm->last_patch_ms = 0;
+  return wm->watch_fd < 0 ? ERROR : SUCCESS;
+}
+
+extern void Watch_free(WindowManager *wm) {
+  if (wm->watch_fd >= 0) {
+    close(wm->watch_fd);
+  }
+  wm->watch_fd = -1;
+  wm->watched_count = 0;
+}
+
+extern void Window_watch(Window *win) {
+  win->patch.files_count = 0;
+  win->patch.names_used = 0;
+  win->reload = false;
+  if (win->watch_fd < 0) {
+    win->watch_wd = -1;
+    return;
+  }
+  // Same directory in both windows gives the same watch descriptor
+  win->watch_wd = inotify_add_watch(win->watch_fd, win->pwd, WATCH_MASK);
+}
+
+static bool WindowManager_uses_wd(WindowManager *wm, int wd) {
+  return (wm->first_window && wm->first_window->watch_wd == wd) ||
+         (wm->second_window && wm->second_window->watch_wd == wd);
+}
+
+extern void WindowManager_update_watches(WindowManager *wm) {
+  if (wm->watch_fd < 0) {
+    return;
+  }
+  // Forget watches of directories windows left
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < wm->watched_count; i++) {
+    int wd = wm->watched[i];
+    if (WindowManager_uses_wd(wm, wd)) {
+      wm->watched[kept++] = wd;
+    } else {
+      inotify_rm_watch(wm->watch_fd, wd);
+    }
+  }
+  wm->watched_count = kept;
+
+  // Remember new ones
+  Window *windows[2] = {wm->first_window, wm->second_window};
+  for (int w = 0; w < 2; w++) {
+    if (windows[w] == NULL || windows[w]->watch_wd < 0) {
+      continue;
+    }
+    bool known = false;
+    for (unsigned int i = 0; i < wm->watched_count; i++) {
+      known = known || wm->watched[i] == windows[w]->watch_wd;
+    }
+    if (!known && wm->watched_count < WATCHED_MAX) {
+      wm->watched[wm->watched_count++] = windows[w]->watch_wd;
+    }
+  }
+}
+
+static void Window_push_patch(Window *win, const char *name, FileType type, bool removed) {
+  if (FilesArray_push(&win->patch, name, strlen(name), type) != SUCCESS) {
+    // Can't remember change, read directory again instead
+    win->reload = true;
+    return;
+  }
+  if (removed) {
+    win->patch.entries[win->patch.files_count - 1].flags |= FILE_FLAG_REMOVED;
+  }
+}
+
+static void Window_add_event(Window *win, const struct inotify_event *event) {
+  if (win == NULL || win->watch_wd != event->wd) {
+    return;
+  }
+  if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+    win->reload = true;
+    return;
+  }
+  if (event->len == 0) {
+    return;
+  }
+
+  FileType type = (event->mask & IN_ISDIR) ? DIRECTORY : REGULAR;
+  Window_push_patch(win, event->name, type, event->mask & (IN_DELETE | IN_MOVED_FROM));
+}
+
+extern void WindowManager_patch_entry(WindowManager *wm, const char *dir, const char *name, bool removed) {
+  FileType type = REGULAR;
+  if (!removed) {
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    Perf_count(PERF_STAT, 1);
+    if (lstat(path, &st) < 0) {
+      return;
+    }
+    type = S_ISDIR(st.st_mode) ? DIRECTORY : REGULAR;
+  }
+
+  Window *windows[2] = {wm->first_window, wm->second_window};
+  for (int w = 0; w < 2; w++) {
+    Window *win = windows[w];
+    if (win != NULL && strcmp(win->pwd, dir) == 0) {
+      Window_push_patch(win, name, type, removed);
+    }
+  }
+}
+
+extern void WindowManager_read_events(WindowManager *wm) {
+  if (wm->watch_fd < 0) {
+    return;
+  }
+  char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;) {
+    ssize_t read_bytes = read(wm->watch_fd, buffer, sizeof(buffer));
+    if (read_bytes <= 0) {
+      return;
+    }
+
+    for (char *ptr = buffer; ptr < buffer + read_bytes;) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      // Kernel dropped events, nothing to patch with
+      if (event->mask & IN_Q_OVERFLOW) {
+        if (wm->first_window) {
+          wm->first_window->reload = true;
+        }
+        if (wm->second_window) {
+          wm->second_window->reload = true;
+        }
+        continue;
+      }
+      Window_add_event(wm->first_window, event);
+      Window_add_event(wm->second_window, event);
+    }
+  }
+}
+
+static bool Window_has_patch(Window *win) {
+  return win != NULL && (win->reload || (win->loader == NULL && win->patch.files_count > 0));
+}
+
+extern int WindowManager_patch_timeout(WindowManager *wm) {
+  if (!Window_has_patch(wm->first_window) && !Window_has_patch(wm->second_window)) {
+    return -1;
+  }
+  long wait = wm->last_patch_ms + PATCH_INTERVAL_MS - now_ms();
+  return wait > 0 ? wait : 0;
+}
+
+static void Window_drop_patch(Window *win) {
+  if (win != NULL) {
+    win->patch.files_count = 0;
+    win->patch.names_used = 0;
+  }
+}
+
+static bool Window_apply_patch(WindowManager *wm, Window *win) {
+  if (!Window_has_patch(win)) {
+    return false;
+  }
+  if (win->reload) {
+    Window_load(win);
+    Window_clear(win);
+    return true;
+  }
+
+  // Listing shared with other window is patched once, for both
+  // (other one has seen the same events since it started sharing)
+  Window *other = win == wm->first_window ? wm->second_window : wm->first_window;
+  Window *windows[2] = {win, other != NULL && other->listing == win->listing ? other : NULL};
+  unsigned int count = windows[1] != NULL ? 2 : 1;
+
+  // Highlights follow their files by position through patch
+  int track[2];
+  for (unsigned int w = 0; w < count; w++) {
+    track[w] = windows[w]->highlight;
+  }
+
+  int patch_res = Listing_apply_patch(win->listing, win->pwd, &win->patch, track, count);
+  Window_drop_patch(windows[0]);
+  Window_drop_patch(windows[1]);
+  if (patch_res != SUCCESS) {
+    for (unsigned int w = 0; w < count; w++) {
+      Window_load(windows[w]);
+    }
+    return true;
+  }
+
+  for (unsigned int w = 0; w < count; w++) {
+    Window_select(windows[w], track[w]);
+    // Rows of removed, renamed or moved files would stay on screen
+    Window_clear(windows[w]);
+  }
+  return true;
+}
+
+extern bool WindowManager_apply_patches(WindowManager *wm) {
+  if (WindowManager_patch_timeout(wm) != 0) {
+    return false;
+  }
+  bool changed = Window_apply_patch(wm, wm->first_window);
+  changed = Window_apply_patch(wm, wm->second_window) || changed;
+  wm->last_patch_ms = now_ms();
+  return changed;
+}
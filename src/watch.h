@@ -0,0 +1,34 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "window.h"
+#include <stdbool.h>
+
+// Live refresh of open windows through inotify.
+// Events are collected into Window.patch and applied at most once
+// per PATCH_INTERVAL_MS, as sorted inserts/removes in existing listing
+
+extern int Watch_init(WindowManager *wm);
+
+extern void Watch_free(WindowManager *wm);
+
+// Start watching win->pwd, must be called before directory is read
+extern void Window_watch(Window *win);
+
+// Drop inotify watches that no window uses anymore
+extern void WindowManager_update_watches(WindowManager *wm);
+
+// Read all pending inotify events into windows patches
+extern void WindowManager_read_events(WindowManager *wm);
+
+// Add or remove name in listings of windows showing dir without waiting
+// for inotify (file operations started here). Added only if it exists
+extern void WindowManager_patch_entry(WindowManager *wm, const char *dir, const char *name, bool removed);
+
+// Milliseconds until patches should be applied, -1 if nothing pending
+extern int WindowManager_patch_timeout(WindowManager *wm);
+
+// Apply pending patches if it is time to. Returns true if any window changed
+extern bool WindowManager_apply_patches(WindowManager *wm);
+
+#endif
@@ -1,52 +1,77 @@
 #include "window.h"
 #include "enums.h"
 #include "files.h"
+#include "watch.h"
+#include "text.h"
+#include "sort.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
 
 
+// Width of details columns: mode, owner, size, mtime
+#define DETAILS_WIDTH 38
+// Columns name keeps before details are hidden
+#define DETAILS_NAME_MIN 12
+
 extern void trim_text(bool is_pwd, wchar_t *dest, const char *src, int sizeX) {
 	// Convert src to wide char
-  wchar_t wsrc[1024];
-  mbstowcs(wsrc, src, 1024);
-
-  int src_len = wcswidth(wsrc, -1);
-  // Nothing to trim
-  if (src_len < sizeX) {
-    wcsncpy(dest, wsrc, sizeX);
-    dest[sizeX] = L'\0';
-    return;
-  }
+  wchar_t wsrc[PATH_MAX];
+  size_t src_len = strnlen(src, PATH_MAX - 1);
+  size_t wsrc_len;
+  int src_width = wide_decode(wsrc, src, src_len, &wsrc_len);
+
+  trim_wide(is_pwd, dest, sizeX > 0 ? sizeX + 1 : 1, wsrc, wsrc_len, src_width, sizeX);
+}
 
-  // Trim pwd
-  if (is_pwd) {
-    // src: /home/rostik/folder1/folder2
-    // trimmed: ~/rostik/folder1/folder2
-    // OR       ~/folder1/folder2  etc
+static void TrimCache_reset(TrimCache *cache, unsigned int pool_id) {
+  memset(cache->slots, 0, sizeof(cache->slots));
+  cache->text_used = 0;
+  cache->pool_id = pool_id;
+}
 
-    // How much to trim from start
-    int trim_count = src_len - sizeX;
-    // First char is ~
-    dest[0] = L'~';
-    // Copy the rest of the src
-    wcsncpy(dest + 1, 1 + wsrc + trim_count, sizeX);
-    dest[sizeX] = L'\0';
-    return;
+// Name of file index trimmed to size_x columns,
+// kept until window is resized or listing changes
+static const wchar_t *Window_trimmed_name(Window *win, int index, const wchar_t *wide,
+                                          size_t wide_len, int width, int size_x) {
+  TrimCache *cache = &win->trim_cache;
+  if (cache->pool_id != win->listing->files.pool_id || cache->text_used + size_x + 1 > TRIM_CACHE_TEXT_MAX) {
+    TrimCache_reset(cache, win->listing->files.pool_id);
   }
 
-  // Trim any other text
-  // But somewhere in middle
-
-  int mid_index = sizeX / 2 / wcwidth(wsrc[0]);
+  uint32_t name_offset = win->listing->files.entries[index].name_offset;
+  TrimCacheSlot *slot = &cache->slots[(name_offset * 2654435761u) % TRIM_CACHE_SIZE];
+  if (slot->used && slot->name_offset == name_offset && slot->width == size_x) {
+    return cache->text + slot->text_offset;
+  }
 
-  wcsncpy(dest, wsrc, mid_index);
-  dest[mid_index] = L'~';
-  wcsncpy(dest + mid_index + 1, wsrc + mid_index + 2, mid_index);
-  dest[sizeX / wcwidth(wsrc[0])] = '\0';
+  if (cache->text_used + size_x + 1 > cache->text_size) {
+    size_t new_size = cache->text_size ? cache->text_size * 2 : 4096;
+    while (new_size < cache->text_used + size_x + 1) {
+      new_size *= 2;
+    }
+    wchar_t *new_text = realloc(cache->text, new_size * sizeof(wchar_t));
+    if (new_text == NULL) {
+      return L"";
+    }
+    cache->text = new_text;
+    cache->text_size = new_size;
+  }
 
+  wchar_t *dest = cache->text + cache->text_used;
+  trim_wide(false, dest, size_x + 1, wide, wide_len, width, size_x);
+  slot->used = true;
+  slot->name_offset = name_offset;
+  slot->width = size_x;
+  slot->text_offset = cache->text_used;
+  cache->text_used += wcslen(dest) + 1;
+  return dest;
 }
 
 extern void free_ncurses_window(WINDOW **win) {
@@ -60,29 +85,23 @@ extern void free_ncurses_window(WINDOW **win) {
 }
 
 extern int Window_copy(Window *dest, Window *src) {
-  if (src->files.filenames == NULL) {
+  if (src->listing->files.files_count == 0 && src->loader == NULL) {
     return ERROR;
   }
-  if (dest->files.filenames != NULL) {
-    FilesArray_free(&dest->files);
-  }
 
   strncpy(dest->pwd, src->pwd, sizeof(src->pwd));
-  dest->files.size = src->files.size;
-  dest->files.files_count = src->files.files_count;
-  dest->files.filenames = malloc(dest->files.size * sizeof(char *));
-  if (dest->files.filenames == NULL) {
-    return MALLOC_FAIL;
-  }
-  memset(dest->files.filenames, 0, dest->files.size * sizeof(char *));
-
-  for (int i = 0; i < dest->files.files_count; i++) {
-    char *src_filename = src->files.filenames[i];
-    dest->files.filenames[i] = strdup(src_filename);
-    if (dest->files.filenames[i] == NULL) {
-      return MALLOC_FAIL;
-    }
+  dest->sort = src->sort;
+  dest->details = src->details;
+  // Source listing is still partial, read directory again for dest
+  if (src->loader != NULL) {
+    return Window_load(dest);
   }
+  Window_watch(dest);
+  // Same listing, only highlight, scroll etc. are per window
+  Listing_unref(&dest->listing);
+  dest->listing = Listing_ref(src->listing);
+  dest->stamp = src->stamp;
+  dest->stamp_valid = src->stamp_valid;
   return SUCCESS;
 }
 
@@ -90,12 +109,34 @@ extern int Window_update_size(WindowManager *wm) {
   int stdscrY, stdscrX;
   getmaxyx(stdscr, stdscrY, stdscrX);
 
+  // New curses windows, nothing of them is on screen yet,
+  // and names have to be trimmed for new width
+  if (wm->first_window) {
+    Window_clear(wm->first_window);
+    TrimCache_reset(&wm->first_window->trim_cache, 0);
+  }
+  if (wm->second_window) {
+    Window_clear(wm->second_window);
+    TrimCache_reset(&wm->second_window->trim_cache, 0);
+  }
+
+  free_ncurses_window(&wm->preview.curses_win);
+  wm->preview.dirty = true;
+
   if (wm->window_counter == 1) {
+    // Preview takes place of second window
+    int window_x = wm->preview.open ? stdscrX / 2 : stdscrX;
     free_ncurses_window(&wm->active_window->curses_win);
-    wm->active_window->curses_win = newwin(stdscrY, stdscrX, 0, 0);
+    wm->active_window->curses_win = newwin(stdscrY, window_x, 0, 0);
     if (wm->active_window->curses_win == NULL) {
       return ERROR;
     }
+    if (wm->preview.open) {
+      wm->preview.curses_win = newwin(stdscrY, stdscrX - window_x, 0, window_x);
+      if (wm->preview.curses_win == NULL) {
+        return ERROR;
+      }
+    }
 
     if (stdscrY - 5 < 0) {
       return SUCCESS;
@@ -130,14 +171,46 @@ extern int Window_update_size(WindowManager *wm) {
           wm->first_window->highlight - first_bottom_border;
     }
   }
+
+  // Let curses scroll file rows with terminal scroll region
+  if (wm->first_window && wm->first_window->curses_win) {
+    idlok(wm->first_window->curses_win, true);
+  }
+  if (wm->second_window && wm->second_window->curses_win) {
+    idlok(wm->second_window->curses_win, true);
+  }
   return SUCCESS;
 }
 
 extern int Window_create(Window *win, WindowManager *wm, const char *pwd) {
-  win->files.filenames = NULL;
+  win->listing = Listing_new();
+  if (win->listing == NULL) {
+    return MALLOC_FAIL;
+  }
+  win->loader = NULL;
+  win->select_after_load[0] = '\0';
+  win->stamp_valid = false;
+  win->revalidate = false;
+  win->keep_listing = false;
+  win->cache = &wm->cache;
+  win->frecency = &wm->frecency;
+  win->meta = &wm->meta;
+  win->jobs = &wm->jobs;
+  win->details = false;
+  win->meta_dir_fd = -1;
+  win->info_changed = false;
+  win->watch_fd = wm->watch_fd;
+  win->watch_wd = -1;
+  win->reload = false;
+  win->sort = (FileSort){SORT_NAME, false};
+  memset(&win->patch, 0, sizeof(win->patch));
+  win->relative_number = false;
   win->highlight = 0;
   win->curses_win = NULL;
   win->scroll = 0;
+  memset(&win->render, 0, sizeof(win->render));
+  win->render.full = true;
+  memset(&win->trim_cache, 0, sizeof(win->trim_cache));
 
   if (pwd != NULL) {
     snprintf(win->pwd, sizeof(win->pwd), "%s", pwd);
@@ -151,14 +224,17 @@ extern int Window_create(Window *win, WindowManager *wm, const char *pwd) {
     wm->window_counter += 1;
   }
 
+  // New window shows directory of the other one, unless given its own (session)
   if (wm->window_counter == 1) {
     wm->first_window = win;
   } else {
+    Window *other = wm->first_window ? wm->first_window : wm->second_window;
+    if (pwd == NULL) {
+      Window_copy(win, other);
+    }
     if (!wm->first_window) {
-      Window_copy(win, wm->second_window);
       wm->first_window = win;
     } else {
-      Window_copy(win, wm->first_window);
       wm->second_window = win;
     }
   }
@@ -172,6 +248,7 @@ extern int Window_chdir(const char *path, Window *win) {
 	if (strlen(win->pwd) == 1 && strcmp(path, "..") == 0) { // If at '/' and trying to cd ..
     return ERROR;
   }
+  uint64_t trace_start = Trace_start();
 	//Restore current window path
 	if (chdir(win->pwd) < 0) {
 		return ERROR;
@@ -185,103 +262,520 @@ extern int Window_chdir(const char *path, Window *win) {
 	if (getcwd(win->pwd, sizeof(win->pwd)) == NULL) {
 		return ERROR;
   }
+	Frecency_add(win->frecency, win->pwd);
 
 	win->highlight = 0;
 	win->scroll = 0;
-	FilesArray_free(&win->files);
-	int fill_res = FilesArray_fill(&win->files, win->pwd);
-	if (fill_res > 0) { 
-		return fill_res;
+	win->select_after_load[0] = '\0';
+	int load_res = Window_load(win);
+	Trace_end("chdir", trace_start, win->pwd);
+	if (load_res > 0) { 
+		return load_res;
 	}
 	Window_clear(win);
 	return SUCCESS;
 }
 
-extern void Window_draw(WindowManager wm, Window *win) {
-  if (win == NULL) {
-    return;
+extern int Window_load(Window *win) {
+  // Previous load is no longer needed
+  if (win->loader != NULL) {
+    DirLoader_cancel(win->loader);
+    win->loader = NULL;
   }
+  win->revalidate = false;
+  win->keep_listing = false;
+  MetaEngine_close_dir(win->meta, win->meta_dir_fd);
+  win->meta_dir_fd = -1;
+  // Watch before reading, so no change is missed
+  Window_watch(win);
 
-  // Get win size
-  int win_size_y, win_size_x;
-  getmaxyx(win->curses_win, win_size_y, win_size_x);
+  // One stat to check if listing we already have is still valid
+  win->stamp_valid = DirStamp_get(win->pwd, &win->stamp) == SUCCESS;
+  Listing *cached = win->stamp_valid ? ListingCache_get(win->cache, win->pwd, &win->stamp) : NULL;
+  Listing *listing = cached != NULL ? cached : Listing_new();
+  if (listing == NULL) {
+    return MALLOC_FAIL;
+  }
+  // Other window or cache may still hold old one
+  Listing_unref(&win->listing);
+  win->listing = listing;
+  if (cached != NULL) {
+    return Window_sort(win, win->sort);
+  }
+
+  win->loader = DirLoader_start(win->pwd);
+  // No thread, read directory right here
+  if (win->loader == NULL) {
+    int fill_res = FilesArray_fill(&win->listing->files, win->pwd);
+    if (fill_res == SUCCESS) {
+      fill_res = Window_sort(win, win->sort);
+    }
+    if (fill_res == SUCCESS && win->stamp_valid) {
+      ListingCache_put(win->cache, win->pwd, &win->stamp, win->listing);
+    }
+    return fill_res;
+  }
+  return SUCCESS;
+}
+
+static int Window_sort_files(Window *win, FileSort sort) {
+  // Order is per window, shared listing is copied first
+  if (Listing_mutable(&win->listing) == NULL) {
+    return MALLOC_FAIL;
+  }
+  return Listing_sort(win->listing, win->pwd, sort);
+}
 
-  // Draw box around win
-  if (wm.active_window == win) {
-    box(win->curses_win, 0, 0);
+extern bool Window_poll_load(Window *win) {
+  if (win == NULL || win->loader == NULL) {
+    return false;
+  }
+
+  FilesArray result = {0};
+  int status;
+  unsigned int old_count = win->listing->files.files_count;
+  // Restored listing is replaced only by the complete new one
+  FilesArray chunk = {0};
+  bool done = DirLoader_take(win->loader, win->keep_listing ? &chunk : &win->listing->files, &result, &status);
+  FilesArray_free(&chunk);
+  if (!done) {
+    if (win->listing->files.files_count != old_count) {
+      Window_clear(win);
+    }
+    return true;
+  }
+  Window_clear(win);
+  DirLoader_free(win->loader);
+  win->loader = NULL;
+  win->keep_listing = false;
+
+  if (status != SUCCESS) {
+    FilesArray_free(&result);
+    return true;
+  }
+
+  // Keep highlight on the same file after sorting if user moved it,
+  // or on requested one (e.g directory we came from)
+  char selected[NAME_MAX + 1];
+  if (win->select_after_load[0] != '\0') {
+    snprintf(selected, sizeof(selected), "%s", win->select_after_load);
+    win->select_after_load[0] = '\0';
+  } else if (win->highlight > 0 && win->highlight < win->listing->files.files_count) {
+    snprintf(selected, sizeof(selected), "%s", FilesArray_name(&win->listing->files, win->highlight));
   } else {
-    Window_draw_inactive_box(win, win_size_y, win_size_x);
+    selected[0] = '\0';
   }
 
-  // Draw line for status_line;
-  int status_line_y = getmaxy(win->curses_win) - STATUSLINE_HEIGHT;
-  int status_line_x = getmaxx(win->curses_win) - 2;
-  mvwhline(win->curses_win, status_line_y, 1, '-', status_line_x);
+  Listing *listing = Listing_wrap(&result);
+  if (listing == NULL) {
+    return true;
+  }
+  Listing_unref(&win->listing);
+  win->listing = listing;
+  // Loader sorts by name
+  if (!FileSort_equal(win->listing->files.sort, win->sort)) {
+    Window_sort_files(win, win->sort);
+  }
+  if (win->stamp_valid) {
+    ListingCache_put(win->cache, win->pwd, &win->stamp, win->listing);
+  }
 
-  // Display pwd
-  wchar_t pwd[win_size_x];
-  trim_text(true, pwd, win->pwd, win_size_x - 2);
-  mvwaddwstr(win->curses_win, status_line_y + 1, 1, pwd);
+  int found_file_index = selected[0] ? FilesArray_find(&win->listing->files, selected) : -1;
+  Window_select(win, found_file_index >= 0 ? found_file_index : 0);
+  return true;
+}
 
-  wrefresh(win->curses_win);
-  // Draw files
-  if (win->files.filenames == NULL) {
+extern void Window_restore(Window *win, Listing *listing, const DirStamp *stamp, int highlight, int scroll) {
+  if (win->loader != NULL) {
+    DirLoader_cancel(win->loader);
+    win->loader = NULL;
+  }
+  // Changes from now on come as patches
+  Window_watch(win);
+  Listing_unref(&win->listing);
+  win->listing = listing;
+  win->stamp = *stamp;
+  win->stamp_valid = true;
+  win->revalidate = true;
+  // Saved values come from a file, rows drawn are scroll + row
+  win->scroll = scroll > highlight ? highlight : scroll;
+  win->scroll = win->scroll < 0 ? 0 : win->scroll;
+  Window_select(win, highlight);
+  Window_clear(win);
+}
+
+extern void Window_revalidate(Window *win) {
+  if (win == NULL || !win->revalidate) {
+    return;
+  }
+  win->revalidate = false;
+  DirStamp stamp;
+  if (DirStamp_get(win->pwd, &stamp) != SUCCESS) {
+    // Directory is gone, same as loading it
+    Window_load(win);
+    return;
+  }
+  if (DirStamp_equal(&stamp, &win->stamp)) {
+    ListingCache_put(win->cache, win->pwd, &stamp, win->listing);
+    return;
+  }
+  win->stamp = stamp;
+  win->loader = DirLoader_start(win->pwd);
+  if (win->loader == NULL) {
+    Window_load(win);
     return;
   }
+  win->keep_listing = true;
+}
 
-  int win_limit = win_size_y - STATUSLINE_HEIGHT;
-  int filename_draw_y = 1;
-  int filename_draw_x = (int)(log10(win->files.files_count)) + 3;
+extern void Window_select_name(Window *win, const char *name) {
+  // Listing is not complete yet, select when it is
+  if (win->loader != NULL) {
+    snprintf(win->select_after_load, sizeof(win->select_after_load), "%s", name);
+    return;
+  }
+  int found_file_index = FilesArray_find(&win->listing->files, name);
+  if (found_file_index >= 0) {
+    Window_select(win, found_file_index);
+  }
+}
 
-	//If user just changed dir to ..
-	//Seek for previous 
+extern int Window_sort(Window *win, FileSort sort) {
+  // Partial listing is sorted once loaded
+  if (FileSort_equal(win->listing->files.sort, sort) || win->loader != NULL) {
+    return SUCCESS;
+  }
+  char selected[NAME_MAX + 1] = "";
+  if (win->highlight > 0 && win->highlight < (int)win->listing->files.files_count) {
+    snprintf(selected, sizeof(selected), "%s", FilesArray_name(&win->listing->files, win->highlight));
+  }
 
-  for (int i = win->scroll; i < win->files.files_count; i++) {
-    // Leave from loop if on win limit
-    if (filename_draw_y >= win_limit) {
-      break;
+  int sort_res = Window_sort_files(win, sort);
+  if (sort_res != SUCCESS) {
+    return sort_res;
+  }
+
+  int found_file_index = selected[0] ? FilesArray_find(&win->listing->files, selected) : -1;
+  Window_select(win, found_file_index >= 0 ? found_file_index : 0);
+  Window_clear(win);
+  return SUCCESS;
+}
+
+extern void Window_move_highlight(Window *window, int jump_counter, bool move_down) {
+  if (window->listing->files.files_count == 0) {
+    return;
+  }
+
+  int files_count = window->listing->files.files_count;
+  int window_height = getmaxy(window->curses_win) - STATUSLINE_HEIGHT;
+
+  if (move_down) {
+    if (window->highlight + 1 >= window->listing->files.files_count) {
+      return;
+    }
+    // If try to jump to unexisting file position
+    if (jump_counter >= files_count ||
+        window->highlight + jump_counter + 1 > files_count) {
+      // Set highlight to last file index
+      window->highlight = files_count - 1; //-1 because we want last index
+    } else {
+      // if: jump_number != 0, add it
+      // else: add 1
+      window->highlight += jump_counter;
     }
 
-    char *filename = win->files.filenames[i];
-    wchar_t filename_trimmed[win_size_x];
-    trim_text(false, filename_trimmed, filename, win_size_x - filename_draw_x);
+    // Scroll
+    int last_visible_file_idx = window_height + window->scroll;
 
-    // Getting file type
-    // TODO. can you cache smth here? (at least, with cache values, check if dir
-    // is changed, it`s gonna be faster)
-    char filepath[PATH_MAX];
-    strcpy(filepath, win->pwd);
-    strcat(filepath, "/");
-    strcat(filepath, filename);
-    FileType filetype = get_filetype(filepath);
+    if (window->highlight + 1 >= last_visible_file_idx) {
 
-    mvwhline(win->curses_win, filename_draw_y, 1, ' ', win_size_x - 2);
+      if (window->highlight > files_count - window_height) {
+        window->scroll = files_count - window_height + 1;
+      } else {
+        window->scroll += jump_counter ? jump_counter : 1;
+      }
+    }
+    return;
+  }
 
-    if (filetype == DIRECTORY) {
-      wattron(win->curses_win, COLOR_PAIR(COLOR_PAIR_RED));
+  // Move up
+  if (window->highlight - 1 < 0) {
+    return;
+  }
+
+  if (jump_counter >= files_count || window->highlight - jump_counter < 0) {
+    window->highlight = 0;
+  } else {
+    window->highlight -= jump_counter ? jump_counter : 1;
+  }
+  // Scroll
+  if (window->highlight + 1 <= window->scroll) {
+    if (window->scroll - jump_counter < 0) {
+      window->scroll = 0;
+    } else {
+      window->scroll -= jump_counter ? jump_counter : 1;
+    }
+  }
+  return;
+}
+
+extern void Window_select(Window *win, int index) {
+  if (index < 0 || index >= (int)win->listing->files.files_count) {
+    index = 0;
+  }
+  win->highlight = index;
+
+  // Rows between top border and status line
+  int visible_rows = getmaxy(win->curses_win) - STATUSLINE_HEIGHT - 1;
+  if (visible_rows < 1) {
+    visible_rows = 1;
+  }
+  if (index < win->scroll) {
+    win->scroll = index;
+  } else if (index >= win->scroll + visible_rows) {
+    win->scroll = index - visible_rows + 1;
+  }
+}
+
+// Submit rows [from, to) without metadata, false when engine is full
+static bool Window_request_range(Window *win, int from, int to) {
+  for (int i = from; i < to; i++) {
+    FileInfo *info = FilesArray_info(&win->listing->files, i);
+    if (info == NULL) {
+      return false;
     }
-    if (win->highlight == i) {
-      wattron(win->curses_win, A_REVERSE);
+    if (info->state != FILE_INFO_NONE) {
+      continue;
     }
-    // Draw file index
-    if (!win->relative_number || win->highlight == i) { // Draw absolute numbers
-      mvwprintw(win->curses_win, filename_draw_y, 1, "%d", i);
-    } else { // Draw relative numbers */
-      mvwprintw(win->curses_win, filename_draw_y, 1, "%d", abs(win->highlight - i));
+    if (!MetaEngine_submit(win->meta, win->meta_dir_fd, win->listing->files.pool_id, i,
+                           FilesArray_name(&win->listing->files, i))) {
+      return false;
     }
-		//Display file
-    mvwaddwstr(win->curses_win, filename_draw_y, filename_draw_x, filename_trimmed);
+    info->state = FILE_INFO_PENDING;
+  }
+  return true;
+}
 
-    wattroff(win->curses_win, COLOR_PAIR(COLOR_PAIR_RED));
-    wattroff(win->curses_win, A_REVERSE);
+extern void Window_request_info(Window *win) {
+  if (win == NULL || !win->details || win->listing->files.files_count == 0 || MetaEngine_full(win->meta)) {
+    return;
+  }
+  if (win->meta_dir_fd < 0) {
+    win->meta_dir_fd = open(win->pwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (win->meta_dir_fd < 0) {
+      return;
+    }
+  }
 
-    filename_draw_y++;
+  // Visible rows first, then the ones scrolling would show next
+  int count = win->listing->files.files_count;
+  int rows = getmaxy(win->curses_win) - STATUSLINE_HEIGHT - 1;
+  int first = win->scroll < count ? win->scroll : count;
+  int last = first + rows < count ? first + rows : count;
+  int after = last + META_PREFETCH_ROWS < count ? last + META_PREFETCH_ROWS : count;
+  int before = first > META_PREFETCH_ROWS ? first - META_PREFETCH_ROWS : 0;
+  if (Window_request_range(win, first, last) && Window_request_range(win, last, after)) {
+    Window_request_range(win, before, first);
   }
-  wrefresh(win->curses_win);
+  // Whole batch with one syscall
+  MetaEngine_flush(win->meta);
 }
 
-extern void Window_draw_inactive_box(Window *win, int sizeY, int sizeX) {
-  WINDOW *curs_win = win->curses_win;
+static void Window_info_done(void *ctx, const MetaRequest *request) {
+  WindowManager *wm = ctx;
+  Window *windows[2] = {wm->first_window, wm->second_window};
+  for (int w = 0; w < 2; w++) {
+    Window *win = windows[w];
+    // Listing replaced or entries moved since request
+    if (win == NULL || win->listing->files.pool_id != request->pool_id ||
+        request->index >= win->listing->files.files_count ||
+        strcmp(FilesArray_name(&win->listing->files, request->index), request->name) != 0) {
+      continue;
+    }
+    FileInfo *info = FilesArray_info(&win->listing->files, request->index);
+    if (info == NULL) {
+      continue;
+    }
+    if (request->result < 0) {
+      info->state = FILE_INFO_FAILED;
+    } else {
+      info->filesize = request->stx.stx_size;
+      info->mtime = request->stx.stx_mtime.tv_sec;
+      info->mode = request->stx.stx_mode;
+      info->uid = request->stx.stx_uid;
+      info->is_regular = S_ISREG(request->stx.stx_mode);
+      info->state = FILE_INFO_DONE;
+    }
+    win->info_changed = true;
+  }
+}
+
+extern void WindowManager_poll_meta(WindowManager *wm) {
+  // Nothing in flight, no read() of wake fd
+  if (wm->meta.free_count == META_QUEUE_DEPTH) {
+    return;
+  }
+  MetaEngine_reap(&wm->meta, Window_info_done, wm);
+}
+
+// "drwxr-xr-x" of mode
+static void format_mode(char *dest, uint32_t mode) {
+  dest[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c' : S_ISBLK(mode) ? 'b' :
+            S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+  const char *rwx = "rwxrwxrwx";
+  for (int i = 0; i < 9; i++) {
+    dest[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+  }
+  dest[10] = '\0';
+}
+
+// Mode, owner, size and mtime columns (ls -l like), blank until fetched
+static void format_details(char *dest, size_t dest_size, const FileInfo *info) {
+  if (info == NULL || info->state != FILE_INFO_DONE) {
+    snprintf(dest, dest_size, "%*s", DETAILS_WIDTH, info && info->state == FILE_INFO_FAILED ? "?" : "");
+    return;
+  }
+  char mode[11], size[16], time_text[16];
+  format_mode(mode, info->mode);
+  format_size(size, sizeof(size), info->filesize);
+
+  // Time for recent files, year for older ones
+  time_t mtime = info->mtime;
+  struct tm tm;
+  localtime_r(&mtime, &tm);
+  bool recent = labs(time(NULL) - mtime) < 180L * 24 * 3600;
+  strftime(time_text, sizeof(time_text), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+  snprintf(dest, dest_size, "%s %-8.8s %5s %s", mode, MetaEngine_user_name(info->uid), size, time_text);
+}
+
+// Left & right border of one row
+static void Window_draw_row_border(Window *win, bool active, int y, int size_x) {
+  if (active) {
+    mvwaddch(win->curses_win, y, 0, ACS_VLINE);
+    mvwaddch(win->curses_win, y, size_x - 1, ACS_VLINE);
+  } else {
+    mvwaddch(win->curses_win, y, 0, '|');
+    mvwaddch(win->curses_win, y, size_x - 1, '|');
+  }
+}
+
+// Draw file row y (1 is first row under top border)
+static void Window_draw_row(Window *win, int y, int size_x) {
+  mvwhline(win->curses_win, y, 1, ' ', size_x - 2);
+
+  int i = win->scroll + y - 1;
+  if (i >= (int)win->listing->files.files_count) {
+    return;
+  }
+
+  int filename_draw_x = (int)(log10(win->listing->files.files_count)) + 3;
+  FileEntry *file = &win->listing->files.entries[i];
+
+  // Wide name and width are computed once per listing,
+  // only names too long for window are trimmed (and cached)
+  int name_width;
+  size_t name_len;
+  const wchar_t *filename = FilesArray_wide_name(&win->listing->files, i, &name_width, &name_len);
+  int name_columns = size_x - 1 - filename_draw_x;
+  // Details only if name still gets some room
+  bool details = win->details && name_columns - DETAILS_WIDTH - 1 >= DETAILS_NAME_MIN;
+  if (details) {
+    name_columns -= DETAILS_WIDTH + 1;
+  }
+  if (name_width > name_columns) {
+    filename = Window_trimmed_name(win, i, filename, name_len, name_width, name_columns);
+  }
+
+  // File type is cached in listing, no stat() per row
+  if (file->type == DIRECTORY) {
+    wattron(win->curses_win, COLOR_PAIR(COLOR_PAIR_RED));
+  }
+  if (win->highlight == i) {
+    wattron(win->curses_win, A_REVERSE);
+  }
+  // Draw file index
+  if (!win->relative_number || win->highlight == i) { // Draw absolute numbers
+    mvwprintw(win->curses_win, y, 1, "%d", i);
+  } else { // Draw relative numbers */
+    mvwprintw(win->curses_win, y, 1, "%d", abs(win->highlight - i));
+  }
+  //Display file
+  mvwaddwstr(win->curses_win, y, filename_draw_x, filename);
+  if (details) {
+    char text[DETAILS_WIDTH * 2];
+    format_details(text, sizeof(text), i < (int)win->listing->files.info_size ? &win->listing->files.info[i] : NULL);
+    mvwaddstr(win->curses_win, y, size_x - 1 - DETAILS_WIDTH, text);
+  }
+
+  wattroff(win->curses_win, COLOR_PAIR(COLOR_PAIR_RED));
+  wattroff(win->curses_win, A_REVERSE);
+}
+
+// Progress of copy/move queue, or its last error. False if there is nothing to show
+static bool format_jobs(char *dest, size_t dest_size, JobQueue *jobs) {
+  JobProgress progress;
+  if (!JobQueue_progress(jobs, &progress)) {
+    JobQueue_error(jobs, dest, dest_size);
+    return dest[0] != '\0';
+  }
+  if (progress.type == JOB_DELETE) {
+    snprintf(dest, dest_size, "delete %u/%u %lu removed", progress.jobs_done + 1, progress.jobs_total,
+             (unsigned long)progress.files_done);
+    return true;
+  }
+  char done[16], total[16], rate[16], eta[16] = "";
+  format_size(done, sizeof(done), progress.bytes_done);
+  format_size(total, sizeof(total), progress.bytes_total);
+  format_size(rate, sizeof(rate), (uint64_t)progress.rate);
+  if (progress.eta >= 0) {
+    snprintf(eta, sizeof(eta), " ETA %ld:%02ld", progress.eta / 60, progress.eta % 60);
+  }
+  snprintf(dest, dest_size, "%s %u/%u %lu files %s/%s %s/s%s", progress.type == JOB_MOVE ? "move" : "copy",
+           progress.jobs_done + 1, progress.jobs_total, (unsigned long)progress.files_done, done, total, rate,
+           eta);
+  return true;
+}
+
+static void Window_draw_statusline(Window *win, int size_y, int size_x) {
+  // Draw line for status_line;
+  int status_line_y = size_y - STATUSLINE_HEIGHT;
+  mvwhline(win->curses_win, status_line_y, 1, '-', size_x - 2);
+  char jobs[PATH_MAX + 64];
+  win->render.jobs = format_jobs(jobs, sizeof(jobs), win->jobs);
+  if (win->render.jobs) {
+    wchar_t jobs_text[size_x];
+    trim_text(false, jobs_text, jobs, size_x - 4);
+    mvwaddch(win->curses_win, status_line_y, 2, ' ');
+    waddwstr(win->curses_win, jobs_text);
+    waddch(win->curses_win, ' ');
+  }
+
+  // Display loading progress at the end of pwd line
+  char loading[64] = "";
+  if (win->loader != NULL) {
+    snprintf(loading, sizeof(loading), " loading %u entries...", win->listing->files.files_count);
+  } else if (!FileSort_equal(win->sort, (FileSort){SORT_NAME, false})) {
+    // Non-default order
+    snprintf(loading, sizeof(loading), " [%s%s]", SortMode_name(win->sort.mode),
+             win->sort.dirs_first ? ", dirs first" : "");
+  }
+  int loading_len = strlen(loading);
+  if (loading_len > size_x - 2) {
+    loading_len = 0;
+  }
+
+  // Display pwd
+  mvwhline(win->curses_win, status_line_y + 1, 1, ' ', size_x - 2);
+  wchar_t pwd[size_x];
+  trim_text(true, pwd, win->pwd, size_x - 3 - loading_len);
+  mvwaddwstr(win->curses_win, status_line_y + 1, 1, pwd);
+  if (loading_len > 0) {
+    mvwaddstr(win->curses_win, status_line_y + 1, size_x - 1 - loading_len, loading);
+  }
+}
+
+static void draw_inactive_box(WINDOW *curs_win, int sizeY, int sizeX) {
   // Corners
   mvwaddch(curs_win, 0, 0, '+');
   mvwaddch(curs_win, 0, sizeX - 1, '+');
@@ -293,20 +787,313 @@ extern void Window_draw_inactive_box(Window *win, int sizeY, int sizeX) {
   // Top & bottom lines
   mvwhline(curs_win, 0, 1, '-', sizeX - 2);
   mvwhline(curs_win, sizeY - 1, 1, '-', sizeX - 2);
+}
 
-  wrefresh(curs_win);
+extern void WindowManager_toggle_preview(WindowManager *wm) {
+  if (wm->window_counter != 1 && !wm->preview.open) {
+    return;
+  }
+  wm->preview.open = !wm->preview.open;
+  wm->preview.path[0] = '\0';
+  Window_update_size(wm);
 }
 
-extern void Window_clear(Window *win) {
-  int maxY, maxX;
-  getmaxyx(win->curses_win, maxY, maxX);
-  // Clear files
-  for (int y = 1; y < maxY; y++) {
-    mvwhline(win->curses_win, y, 1, ' ', maxX - 2);
+extern void WindowManager_update_preview(WindowManager *wm) {
+  PreviewPane *preview = &wm->preview;
+  // Reads still finish after pane is closed, their wake fd must be drained
+  if (Previewer_poll(&wm->previewer)) {
+    preview->dirty = true;
+  }
+  if (!preview->open) {
+    return;
+  }
+
+  Window *win = wm->active_window;
+  FilesArray *files = &win->listing->files;
+  if (files->files_count == 0 || win->highlight >= (int)files->files_count) {
+    preview->dirty = preview->dirty || preview->path[0] != '\0';
+    preview->path[0] = '\0';
+    return;
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", strcmp(win->pwd, "/") == 0 ? "" : win->pwd,
+           FilesArray_name(files, win->highlight));
+  if (strcmp(path, preview->path) == 0) {
+    return;
   }
-	//Clear pwd
-	mvwhline(win->curses_win, 1 + maxY - STATUSLINE_HEIGHT, 1, ' ', maxX - 2);
-	wrefresh(win->curses_win);
+  memcpy(preview->path, path, sizeof(path));
+  preview->is_dir = files->entries[win->highlight].type == DIRECTORY;
+  preview->dirty = true;
+
+  // Highlighted file (unless it is cached) and files after it,
+  // so moving down finds them read already
+  char wanted[PREVIEW_PREFETCH_ROWS + 1][PATH_MAX];
+  const char *paths[PREVIEW_PREFETCH_ROWS + 1];
+  unsigned int count = 0;
+  if (!preview->is_dir && Previewer_get(&wm->previewer, path) == NULL) {
+    paths[count++] = preview->path;
+  }
+  for (unsigned int i = win->highlight + 1; i < files->files_count && count < PREVIEW_PREFETCH_ROWS + 1; i++) {
+    if (files->entries[i].type == DIRECTORY) {
+      continue;
+    }
+    snprintf(wanted[count], PATH_MAX, "%s/%s", strcmp(win->pwd, "/") == 0 ? "" : win->pwd,
+             FilesArray_name(files, i));
+    paths[count] = wanted[count];
+    count++;
+    if (i - win->highlight >= PREVIEW_PREFETCH_ROWS) {
+      break;
+    }
+  }
+  Previewer_request(&wm->previewer, paths, count);
+}
+
+// Text lines from the head of file, tabs expanded, cut at pane width
+static void draw_preview_text(WINDOW *curses_win, const PreviewEntry *entry, int rows, int cols) {
+  const char *pos = entry->data;
+  const char *end = entry->data + entry->len;
+  wchar_t line[cols * 2 + 1];
+  for (int y = 1; y <= rows && pos < end; y++) {
+    const char *line_end = memchr(pos, '\n', end - pos);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    int width = 0;
+    int out = 0;
+    for (const char *c = pos; c < line_end && width < cols && out < cols * 2;) {
+      wchar_t wc;
+      size_t used = mbrtowc(&wc, c, line_end - c, &state);
+      if (used == (size_t)-1 || used == (size_t)-2 || used == 0) {
+        memset(&state, 0, sizeof(state));
+        wc = L'?';
+        used = 1;
+      }
+      c += used;
+      if (wc == L'\t') {
+        for (int spaces = PREVIEW_TAB_WIDTH - width % PREVIEW_TAB_WIDTH; spaces > 0 && width < cols; spaces--) {
+          line[out++] = L' ';
+          width++;
+        }
+        continue;
+      }
+      if (wc == L'\r') {
+        continue;
+      }
+      int char_width = wcwidth(wc);
+      if (char_width < 0) {
+        wc = L'?';
+        char_width = 1;
+      }
+      if (width + char_width > cols) {
+        break;
+      }
+      line[out++] = wc;
+      width += char_width;
+    }
+    line[out] = L'\0';
+    mvwaddwstr(curses_win, y, 1, line);
+    pos = line_end + 1;
+  }
+}
+
+// Offset, bytes in hex and printable ones, as many bytes per row as fit
+static void draw_preview_hex(WINDOW *curses_win, const PreviewEntry *entry, int rows, int cols) {
+  int per_row = 16;
+  while (per_row > 1 && 10 + per_row * 4 + 2 > cols) {
+    per_row /= 2;
+  }
+  char line[16 * 4 + 32];
+  size_t offset = 0;
+  for (int y = 1; y <= rows && offset < entry->len; y++) {
+    int used = snprintf(line, sizeof(line), "%08zx  ", offset);
+    for (int i = 0; i < per_row; i++) {
+      if (offset + i < entry->len) {
+        used += snprintf(line + used, sizeof(line) - used, "%02x ", (unsigned char)entry->data[offset + i]);
+      } else {
+        used += snprintf(line + used, sizeof(line) - used, "   ");
+      }
+    }
+    line[used++] = '|';
+    for (int i = 0; i < per_row && offset + i < entry->len; i++) {
+      unsigned char byte = entry->data[offset + i];
+      line[used++] = byte >= 0x20 && byte < 0x7f ? byte : '.';
+    }
+    line[used++] = '|';
+    line[used] = '\0';
+    mvwaddnstr(curses_win, y, 1, line, cols);
+    offset += per_row;
+  }
+}
+
+extern void WindowManager_draw_preview(WindowManager *wm) {
+  PreviewPane *preview = &wm->preview;
+  if (!preview->open || !preview->dirty || preview->curses_win == NULL) {
+    return;
+  }
+  preview->dirty = false;
+  WINDOW *curses_win = preview->curses_win;
+  int size_y, size_x;
+  getmaxyx(curses_win, size_y, size_x);
+  int rows = size_y - STATUSLINE_HEIGHT - 1;
+  int cols = size_x - 2;
+  werase(curses_win);
+  draw_inactive_box(curses_win, size_y, size_x);
+
+  const PreviewEntry *entry = NULL;
+  char status[PATH_MAX + 64] = "";
+  const char *name = strrchr(preview->path, '/');
+  name = name != NULL ? name + 1 : preview->path;
+  if (preview->path[0] == '\0') {
+    // Empty directory, nothing to show
+  } else if (preview->is_dir) {
+    snprintf(status, sizeof(status), "%s: directory", name);
+  } else if ((entry = Previewer_get(&wm->previewer, preview->path)) == NULL) {
+    // File changed since it was read, or its read was dropped: pane is
+    // drawn again when this one arrives
+    Previewer_want(&wm->previewer, preview->path);
+    snprintf(status, sizeof(status), "%s: reading...", name);
+  } else if (entry->error != 0) {
+    snprintf(status, sizeof(status), "%s: %s", name,
+             entry->error == EISDIR ? "not a regular file" : strerror(entry->error));
+  } else {
+    char size[16];
+    format_size(size, sizeof(size), entry->key.size);
+    snprintf(status, sizeof(status), "%s %s %s", name, size, entry->binary ? "binary" : "text");
+    if (rows > 0 && cols > 0) {
+      if (entry->binary) {
+        draw_preview_hex(curses_win, entry, rows, cols);
+      } else {
+        draw_preview_text(curses_win, entry, rows, cols);
+      }
+    }
+  }
+
+  int status_line_y = size_y - STATUSLINE_HEIGHT;
+  mvwhline(curses_win, status_line_y, 1, '-', cols);
+  if (cols > 1) {
+    wchar_t text[size_x];
+    trim_text(false, text, status, cols - 1);
+    mvwaddwstr(curses_win, status_line_y + 1, 1, text);
+  }
+  wnoutrefresh(curses_win);
+}
+
+extern bool Window_confirm(Window *win, const char *question) {
+  int size_y, size_x;
+  getmaxyx(win->curses_win, size_y, size_x);
+  int line_y = size_y - STATUSLINE_HEIGHT + 1;
+  char prompt[PATH_MAX + 64];
+  snprintf(prompt, sizeof(prompt), "%s [y/N]", question);
+  wchar_t line[size_x];
+  trim_text(false, line, prompt, size_x - 3);
+  mvwhline(win->curses_win, line_y, 1, ' ', size_x - 2);
+  mvwaddwstr(win->curses_win, line_y, 1, line);
+  wrefresh(win->curses_win);
+
+  timeout(-1);
+  int answer = getch();
+  nodelay(stdscr, true);
+  // Status line is drawn again
+  Window_clear(win);
+  return answer == 'y' || answer == 'Y';
+}
+
+extern void Window_draw(WindowManager *wm, Window *win) {
+  if (win == NULL) {
+    return;
+  }
+  WindowRender *render = &win->render;
+
+  // Get win size
+  int win_size_y, win_size_x;
+  getmaxyx(win->curses_win, win_size_y, win_size_x);
+  int win_limit = win_size_y - STATUSLINE_HEIGHT;
+  int rows = win_limit - 1;
+  bool active = wm->active_window == win;
+
+  // Anything that changes every row or the frame itself
+  bool full = render->full || render->curses_win != win->curses_win ||
+              render->size_y != win_size_y || render->size_x != win_size_x ||
+              render->active != active || render->files_count != win->listing->files.files_count ||
+              render->relative_number != win->relative_number || render->details != win->details ||
+              (win->relative_number && render->highlight != win->highlight) ||
+              abs(render->scroll - win->scroll) >= rows;
+
+  if (full) {
+    werase(win->curses_win);
+    // Draw box around win
+    if (active) {
+      box(win->curses_win, 0, 0);
+    } else {
+      Window_draw_inactive_box(win, win_size_y, win_size_x);
+    }
+    Window_draw_statusline(win, win_size_y, win_size_x);
+    for (int y = 1; y < win_limit; y++) {
+      Window_draw_row(win, y, win_size_x);
+    }
+  } else {
+    int scroll_delta = win->scroll - render->scroll;
+    if (scroll_delta != 0) {
+      // Shift rows on screen and draw only uncovered ones,
+      // terminal does the rest with its scroll region
+      wsetscrreg(win->curses_win, 1, win_limit - 1);
+      scrollok(win->curses_win, true);
+      wscrl(win->curses_win, scroll_delta);
+      scrollok(win->curses_win, false);
+
+      int first = scroll_delta > 0 ? win_limit - scroll_delta : 1;
+      int last = scroll_delta > 0 ? win_limit - 1 : -scroll_delta;
+      for (int y = first; y <= last; y++) {
+        Window_draw_row_border(win, active, y, win_size_x);
+        Window_draw_row(win, y, win_size_x);
+      }
+    }
+    if (render->highlight != win->highlight || scroll_delta != 0) {
+      int old_y = render->highlight - win->scroll + 1;
+      int new_y = win->highlight - win->scroll + 1;
+      if (old_y >= 1 && old_y < win_limit) {
+        Window_draw_row(win, old_y, win_size_x);
+      }
+      if (new_y >= 1 && new_y < win_limit) {
+        Window_draw_row(win, new_y, win_size_x);
+      }
+    }
+    if (win->loader != NULL || render->loading || render->jobs || JobQueue_active(win->jobs)) {
+      Window_draw_statusline(win, win_size_y, win_size_x);
+    }
+    // Metadata arrived for some of visible rows
+    if (win->info_changed) {
+      for (int y = 1; y < win_limit; y++) {
+        Window_draw_row(win, y, win_size_x);
+      }
+    }
+  }
+  win->info_changed = false;
+
+  render->full = false;
+  render->curses_win = win->curses_win;
+  render->size_y = win_size_y;
+  render->size_x = win_size_x;
+  render->active = active;
+  render->files_count = win->listing->files.files_count;
+  render->relative_number = win->relative_number;
+  render->details = win->details;
+  render->highlight = win->highlight;
+  render->scroll = win->scroll;
+  render->loading = win->loader != NULL;
+
+  // Only copy to virtual screen, caller sends everything with one doupdate()
+  wnoutrefresh(win->curses_win);
+}
+
+extern void Window_draw_inactive_box(Window *win, int sizeY, int sizeX) {
+  draw_inactive_box(win->curses_win, sizeY, sizeX);
+}
+
+extern void Window_clear(Window *win) {
+  win->render.full = true;
 }
 
 extern void Window_close(WindowManager *wm) {
@@ -333,8 +1120,12 @@ extern void Window_free(Window **win) {
   }
   Window *win_ = *win;
   // Free stuff from win
+  DirLoader_cancel(win_->loader);
   free_ncurses_window(&win_->curses_win);
-  FilesArray_free(&win_->files);
+  Listing_unref(&win_->listing);
+  FilesArray_free(&win_->patch);
+  MetaEngine_close_dir(win_->meta, win_->meta_dir_fd);
+  free(win_->trim_cache.text);
 
   free(win_);
   *win = NULL;
@@ -3,23 +3,115 @@
 
 #include "config.h"
 #include "files.h"
+#include "loader.h"
+#include "cache.h"
+#include "listing.h"
+#include "frecency.h"
+#include "meta.h"
+#include "jobs.h"
+#include "preview.h"
 #include <ncursesw/ncurses.h>
 #include <linux/limits.h>
 
 
 
+// What was drawn last time, so only changed rows are redrawn
+typedef struct WindowRender {
+  WINDOW *curses_win;
+  bool full;
+  bool active;
+  bool relative_number;
+  bool details;
+  bool loading;
+  // Jobs progress was shown on separator line
+  bool jobs;
+  int size_y, size_x;
+  int highlight;
+  int scroll;
+  unsigned int files_count;
+} WindowRender;
+
+typedef struct TrimCacheSlot {
+  uint32_t name_offset;
+  uint32_t text_offset;
+  int width;
+  bool used;
+} TrimCacheSlot;
+
+// Names trimmed for current window width, keyed by listing name offset.
+// Valid until resize or until listing pool changes
+typedef struct TrimCache {
+  TrimCacheSlot slots[TRIM_CACHE_SIZE];
+  wchar_t *text;
+  size_t text_used;
+  size_t text_size;
+  unsigned int pool_id;
+} TrimCache;
+
 typedef struct Window {
-  FilesArray files;
+  // Shared with other window and cache, never NULL
+  Listing *listing;
   WINDOW *curses_win;
 	bool relative_number;
   char pwd[PATH_MAX];
   int highlight;
   int scroll;
+  // Directory is still being read in background
+  DirLoader *loader;
+  // File to highlight once loading is finished
+  char select_after_load[NAME_MAX + 1];
+  // pwd state when listing was read, to validate cache
+  DirStamp stamp;
+  bool stamp_valid;
+  // Listing came from session snapshot, stamp is checked after first draw
+  bool revalidate;
+  // Loader reads directory again, listing shown meanwhile is kept whole
+  bool keep_listing;
+  ListingCache *cache;
+  // Directory changes are recorded here
+  Frecency *frecency;
+  // inotify watch of pwd and changes not yet applied to files
+  int watch_fd;
+  int watch_wd;
+  FilesArray patch;
+  bool reload;
+  // Wanted order, listing is re-sorted when it arrives in another one
+  FileSort sort;
+  // Details columns, metadata comes from meta engine through meta_dir_fd
+  bool details;
+  MetaEngine *meta;
+  int meta_dir_fd;
+  // Metadata of some rows arrived since last draw
+  bool info_changed;
+  // Copy/move queue, progress is shown on separator line
+  JobQueue *jobs;
+  WindowRender render;
+  TrimCache trim_cache;
 } Window;
 
+// Head of highlighted file of active window, in place of second window
+typedef struct PreviewPane {
+  bool open;
+  WINDOW *curses_win;
+  // File shown, pane is redrawn when it changes or its preview arrives
+  char path[PATH_MAX];
+  bool is_dir;
+  bool dirty;
+} PreviewPane;
+
 typedef struct WindowManager {
   Window *first_window, *second_window, *active_window;
   uint8_t window_counter;
+  ListingCache cache;
+  Frecency frecency;
+  MetaEngine meta;
+  JobQueue jobs;
+  Previewer previewer;
+  PreviewPane preview;
+  int watch_fd;
+  int watched[WATCHED_MAX];
+  unsigned int watched_count;
+  long last_patch_ms;
 } WindowManager;
 
 typedef struct Popup{
@@ -30,6 +122,7 @@ typedef struct Popup{
   int last_used_y;
 } Popup;
 
+// Fit src into sizeX columns, dest must have room for sizeX + 1 wide chars
 extern void trim_text(bool is_pwd, wchar_t *dest, const char *src, int sizeX);
 
 extern void free_ncurses_window(WINDOW **win);
@@ -42,10 +135,53 @@ extern int Window_create(Window *win, WindowManager *wm, const char *pwd);
 
 extern int Window_chdir(const char *path, Window *win);
 
-extern void Window_draw(WindowManager wm, Window *win);
+extern int Window_load(Window *win);
+
+extern bool Window_poll_load(Window *win);
+
+// Show listing read when directory was as stamp (session snapshot) right away,
+// Window_revalidate checks it later
+extern void Window_restore(Window *win, Listing *listing, const DirStamp *stamp, int highlight, int scroll);
+
+// Restored listing still matches directory, else read it again in background
+extern void Window_revalidate(Window *win);
+
+extern void Window_select(Window *win, int index);
+
+// Move highlight jump_counter rows, scrolling with it
+extern void Window_move_highlight(Window *win, int jump_counter, bool move_down);
+
+extern void Window_select_name(Window *win, const char *name);
+
+// Order listing as sort, highlight stays on the same file
+extern int Window_sort(Window *win, FileSort sort);
+
+// Ask for metadata of visible rows and rows around them (details view)
+extern void Window_request_info(Window *win);
+
+// Put finished metadata requests into windows listings
+extern void WindowManager_poll_meta(WindowManager *wm);
+
+// Open/close preview pane, only when there is one window
+extern void WindowManager_toggle_preview(WindowManager *wm);
+
+// Follow highlight of active window: take finished previews, ask for
+// the highlighted file and the ones after it
+extern void WindowManager_update_preview(WindowManager *wm);
+
+// Redraw preview pane if it changed (wnoutrefresh)
+extern void WindowManager_draw_preview(WindowManager *wm);
+
+// Draw changes since last call into virtual screen (wnoutrefresh),
+// doupdate() is left to caller
+extern void Window_draw(WindowManager *wm, Window *win);
+
+// Ask on status line, true if answered 'y'
+extern bool Window_confirm(Window *win, const char *question);
 
 extern void Window_draw_inactive_box(Window *win, int sizeY, int sizeX);
 
+// Repaint whole window on next draw (listing or directory changed)
 extern void Window_clear(Window *win);
 
 extern void Window_close(WindowManager *wm);